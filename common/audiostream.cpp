@@ -89,8 +89,101 @@ auto FindBestChannelLayout(const AVCodec* codec, uint64_t channel_layout) {
 	return best_layout;
 }
 
-AudioStream::AudioStream(std::shared_ptr<AVFormatContext>& format_context, const AVCodec& codec, AVDictionaryPtr& options, AVSampleFormat sample_fmt, int sample_rate, uint64_t channel_layout)
-	: Stream{ format_context, codec }
+AVPacketPtr CreateAudioPacket(const AVFrame& frame, const AVRational& time_base, const std::shared_ptr<MemoryAccount>& memory) {
+	LOG_ENTER;
+	auto pkt = CreateAVPacket();
+	auto sample_fmt = static_cast<AVSampleFormat>(frame.format);
+	int size = av_samples_get_buffer_size(nullptr, frame.channels, frame.nb_samples, sample_fmt, 1);
+	if (size < 0)
+		throw std::runtime_error(fmt::format("failed to get audio buffer size: {}", AVErrorString(size)));
+	if (frame.buf[0] && frame.data[0] >= frame.buf[0]->data && frame.data[0] + size <= frame.buf[0]->data + frame.buf[0]->size) {
+		// zero copy: the packet shares the frame buffer
+		pkt->buf = av_buffer_ref(frame.buf[0]);
+		if (!pkt->buf)
+			throw std::runtime_error("failed to reference frame buffer");
+		pkt->data = frame.data[0];
+		pkt->size = size;
+	}
+	else {
+		int ret = av_new_packet(pkt.get(), size);
+		if (ret < 0)
+			throw std::runtime_error(fmt::format("failed to allocate packet: {}", AVErrorString(ret)));
+		memcpy(pkt->data, frame.data[0], size);
+		CountAVBuffer(pkt->buf, memory, MemoryStage::Muxer);
+	}
+	// same timestamps and flags as the pcm encoders
+	pkt->pts = frame.pts;
+	pkt->dts = frame.pts;
+	pkt->duration = av_rescale_q(frame.nb_samples, AVRational{ 1, frame.sample_rate }, time_base);
+	pkt->flags |= AV_PKT_FLAG_KEY;
+	LOG_EXIT;
+	return pkt;
+}
+
+// pcm encoders in native byte order only copy interleaved samples into the packet
+auto IsAudioCodecDirect(const AVCodecContext& context) {
+	return
+		!av_sample_fmt_is_planar(context.sample_fmt) &&
+		context.codec->id != AV_CODEC_ID_NONE &&
+		context.codec->id == av_get_pcm_codec(context.sample_fmt, -1);
+}
+
+SwrContextPtr CreateResampler(
+	uint64_t out_channel_layout, AVSampleFormat out_sample_fmt, int out_sample_rate,
+	uint64_t in_channel_layout, AVSampleFormat in_sample_fmt, int in_sample_rate,
+	const ResamplerOptions& options)
+{
+	LOG_ENTER;
+	if (out_channel_layout == in_channel_layout && out_sample_fmt == in_sample_fmt && out_sample_rate == in_sample_rate) {
+		LOG->info("audio format matches codec, bypassing resampler");
+		LOG_EXIT;
+		return nullptr;
+	}
+	const bool resample = (out_sample_rate != in_sample_rate);
+	auto make_options = [&](ResamplerEngine engine) {
+		AVDictionary* dict{ nullptr };
+		if (!options.dither.empty() && options.dither != "none")
+			av_dict_set(&dict, "dither_method", options.dither.c_str(), 0);
+		if (resample && engine == ResamplerEngine::Soxr) {
+			av_dict_set(&dict, "resampler", "soxr", 0);
+			av_dict_set_int(&dict, "precision", options.precision, 0);
+		}
+		else if (resample) {
+			av_dict_set_int(&dict, "filter_size", options.filter_size, 0);
+		}
+		return AVDictionaryPtr{ dict };
+	};
+	if (resample)
+		LOG->info(
+			"resampling from {} Hz to {} Hz with {}",
+			in_sample_rate, out_sample_rate,
+			(options.engine == ResamplerEngine::Soxr) ? fmt::format("soxr at precision {}", options.precision) : fmt::format("swr at filter size {}", options.filter_size));
+	SwrContextPtr swr{ nullptr };
+	try {
+		auto swr_options = make_options(options.engine);
+		swr = CreateSwrContext(
+			out_channel_layout, out_sample_fmt, out_sample_rate,
+			in_channel_layout, in_sample_fmt, in_sample_rate,
+			swr_options.get());
+	}
+	catch (const std::exception& e) {
+		if (!resample || options.engine != ResamplerEngine::Soxr)
+			throw;
+		LOG->warn("soxr not available, falling back on swr: {}", e.what());
+		auto swr_options = make_options(ResamplerEngine::Swr);
+		swr = CreateSwrContext(
+			out_channel_layout, out_sample_fmt, out_sample_rate,
+			in_channel_layout, in_sample_fmt, in_sample_rate,
+			swr_options.get());
+	}
+	LOG_EXIT;
+	return swr;
+}
+
+AudioStream::AudioStream(
+	std::shared_ptr<AVFormatContext>& format_context, const AVCodec& codec, AVDictionaryPtr& options, AVSampleFormat sample_fmt, int sample_rate, uint64_t channel_layout,
+	const ResamplerOptions& resampler, const ThreadPolicy& codec_policy, const std::shared_ptr<MemoryAccount>& memory)
+	: Stream{ format_context, codec, memory }
 	, sample_fmt{ sample_fmt }, sample_rate{ sample_rate }
 	, channel_layout{ channel_layout }, channels { av_get_channel_layout_nb_channels(channel_layout) }
 	, dst_frame{ nullptr }, swr{ nullptr }, fifo{ nullptr }
@@ -119,9 +212,7 @@ AudioStream::AudioStream(std::shared_ptr<AVFormatContext>& format_context, const
 			GetChannelLayoutString(context->channel_layout));
 	context->channels = av_get_channel_layout_nb_channels(context->channel_layout);
 	context->time_base = AVRational{ 1, context->sample_rate };
-	auto dict = options.release();
-	auto ret = avcodec_open2(context.get(), nullptr, &dict);
-	options.reset(dict);
+	auto ret = Open(options, codec_policy);
 	if (ret < 0)
 		throw std::runtime_error(fmt::format("failed to open audio codec: {}", AVErrorString(ret)));
 	avcodec_parameters_from_context(stream->codecpar, context.get());
@@ -129,12 +220,17 @@ AudioStream::AudioStream(std::shared_ptr<AVFormatContext>& format_context, const
 	// avformat_write_header will set the final stream time_base
 	// see https://ffmpeg.org/doxygen/trunk/structAVStream.html#a9db755451f14e2bf590d4b85d82b32e6
 	stream->time_base = context->time_base;
+	direct = IsAudioCodecDirect(*context);
+	if (direct)
+		LOG->info("codec {} output matches its input, bypassing encoder", context->codec->name);
 	int nb_samples = (context->codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE) ? 1000 : context->frame_size;
 	LOG->debug("codec frame size is {}", nb_samples);
 	dst_frame = CreateAudioFrame(context->sample_fmt, context->sample_rate, context->channel_layout, nb_samples);
-	swr = CreateSwrContext(
+	CountAVFrame(*dst_frame, memory, MemoryStage::Frames);
+	swr = CreateResampler(
 		context->channel_layout, context->sample_fmt, context->sample_rate, // out
-		channel_layout, sample_fmt, sample_rate); // in
+		channel_layout, sample_fmt, sample_rate, // in
+		resampler);
 	fifo = CreateAVAudioFifo(context->sample_fmt, context->channels, dst_frame->nb_samples);
 	LOG_EXIT_METHOD;
 }
@@ -142,40 +238,93 @@ AudioStream::AudioStream(std::shared_ptr<AVFormatContext>& format_context, const
 void AudioStream::Transcode(const AVFramePtr& src_frame)
 {
 	LOG_ENTER_METHOD;
-	// create buffer frame
-	auto buf_frame = CreateAudioFrame(context->sample_fmt, context->sample_rate, context->channel_layout);
-	// resample source frame to buffer frame
-	int ret = swr_convert_frame(swr.get(), buf_frame.get(), src_frame.get());
-	if (ret < 0)
-		throw std::runtime_error(fmt::format("resampling error: {}", AVErrorString(ret)));
+	if (src_frame)
+		SVE_TRACE(frame_ingest, stream->index, src_frame->nb_samples);
+	// resample source frame to buffer frame, unless the formats match and it can go to the fifo as it is
+	AVFramePtr buf_frame{ nullptr };
+	if (swr) {
+		buf_frame = CreateAudioFrame(context->sample_fmt, context->sample_rate, context->channel_layout);
+		SVE_TRACE(convert_start, stream->index, dst_frame->pts + av_audio_fifo_size(fifo.get()));
+		int ret = swr_convert_frame(swr.get(), buf_frame.get(), src_frame.get());
+		SVE_TRACE(convert_end, stream->index, dst_frame->pts + av_audio_fifo_size(fifo.get()));
+		if (ret < 0)
+			throw std::runtime_error(fmt::format("resampling error: {}", AVErrorString(ret)));
+	}
+	const AVFrame* fifo_frame = swr ? buf_frame.get() : src_frame.get();
 	// save buffer frame to fifo buffer
-	int nb_written = av_audio_fifo_write(fifo.get(), reinterpret_cast<void**>(buf_frame->data), buf_frame->nb_samples);
-	if (nb_written < 0)
-		throw std::runtime_error(fmt::format("failed to write to audio buffer: {}", AVErrorString(nb_written)));
-	if (nb_written != buf_frame->nb_samples)
-		LOG->warn("expected {} samples to be written to audio buffer but wrote {}", buf_frame->nb_samples, nb_written);
+	int nb_written{ 0 };
+	if (fifo_frame) {
+		nb_written = av_audio_fifo_write(fifo.get(), reinterpret_cast<void**>(const_cast<uint8_t**>(fifo_frame->data)), fifo_frame->nb_samples);
+		if (nb_written < 0)
+			throw std::runtime_error(fmt::format("failed to write to audio buffer: {}", AVErrorString(nb_written)));
+		if (nb_written != fifo_frame->nb_samples)
+			LOG->warn("expected {} samples to be written to audio buffer but wrote {}", fifo_frame->nb_samples, nb_written);
+	}
+	if (telemetry)
+		telemetry->Received(AVMEDIA_TYPE_AUDIO, nb_written);
+	if (memory && src_frame)
+		memory->Check();
 	// read from fifo buffer in chunks of dst_frame->nb_samples, until no further chunks can be read
-	while (av_audio_fifo_size(fifo.get()) >= dst_frame->nb_samples) {
+	// codecs that take frames of any size end a frame at the cut of a segment, so the audio splits at the exact sample
+	const bool split = segmenter && (direct || (context->codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE));
+	const int frame_size = dst_frame->nb_samples;
+	while (av_audio_fifo_size(fifo.get()) >= frame_size) {
+		MakeWritable();
+		if (split)
+			dst_frame->nb_samples = segmenter->SamplesBeforeCut(dst_frame->pts, frame_size, context->time_base);
 		int nb_read = av_audio_fifo_read(fifo.get(), reinterpret_cast<void**>(dst_frame->data), dst_frame->nb_samples);
 		if (nb_read < 0)
 			throw std::runtime_error(fmt::format("audio buffer read error: {}", AVErrorString(nb_read)));
 		if (nb_read != dst_frame->nb_samples)
 			LOG->warn("expected {} samples from audio buffer but got {}", dst_frame->nb_samples, nb_read);
-		Encode(dst_frame);
+		EncodeFrame();
 		dst_frame->pts += nb_read;
+		dst_frame->nb_samples = frame_size;
 	}
 	// flush buffer if needed
 	if (!src_frame) {
+		MakeWritable();
 		int nb_read = av_audio_fifo_read(fifo.get(), reinterpret_cast<void**>(dst_frame->data), dst_frame->nb_samples);
 		if (nb_read < 0)
 			throw std::runtime_error(fmt::format("audio buffer read error: {}", AVErrorString(nb_read)));
 		dst_frame->nb_samples = nb_read;
-		Encode(dst_frame);
+		EncodeFrame();
 		dst_frame->pts += nb_read;
-		Encode(nullptr);
+		if (!direct)
+			Encode(nullptr);
 		int nb_lost = av_audio_fifo_size(fifo.get());
 		if (nb_lost)
 			LOG->warn("audio buffer not completely flushed, {} samples lost");
 	}
+	if (memory) {
+		auto sample_size = av_samples_get_buffer_size(nullptr, context->channels, 1, context->sample_fmt, 1);
+		memory->Set(MemoryStage::Fifo, (av_audio_fifo_size(fifo.get()) + av_audio_fifo_space(fifo.get())) * static_cast<int64_t>(sample_size));
+	}
+	LOG_EXIT_METHOD;
+}
+
+void AudioStream::MakeWritable()
+{
+	LOG_ENTER_METHOD;
+	// the muxer may still hold a reference to the buffer of the previous direct packet
+	if (direct && !av_frame_is_writable(dst_frame.get())) {
+		int ret = av_frame_make_writable(dst_frame.get());
+		if (ret < 0)
+			throw std::runtime_error(fmt::format("failed to make audio frame writable: {}", AVErrorString(ret)));
+		CountAVFrame(*dst_frame, memory, MemoryStage::Frames);
+	}
+	LOG_EXIT_METHOD;
+}
+
+void AudioStream::EncodeFrame()
+{
+	LOG_ENTER_METHOD;
+	if (!direct) {
+		Encode(dst_frame);
+	}
+	else if (dst_frame->nb_samples > 0) {
+		auto pkt = CreateAudioPacket(*dst_frame, context->time_base, memory);
+		Write(*pkt);
+	}
 	LOG_EXIT_METHOD;
 }
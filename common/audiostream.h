@@ -2,6 +2,7 @@
 
 #include "stream.h"
 #include "avcreate.h"
+#include "options.h"
 
 extern "C" {
 #include <libswresample/swresample.h>
@@ -17,6 +18,14 @@ AVFramePtr CreateAudioFrame(AVSampleFormat sample_fmt, int sample_rate, uint64_t
 // create an audio frame whose buffer is managed externally by ptr
 AVFramePtr CreateAudioFrame(AVSampleFormat sample_fmt, int sample_rate, uint64_t channel_layout, int nb_samples, const uint8_t* ptr);
 
+// resampler from the input to the output format, or nullptr if the formats are the same
+// the filter is only set up if the sample rates differ, otherwise only the sample format and channel layout are converted
+// soxr falls back on swr if ffmpeg was built without it
+SwrContextPtr CreateResampler(
+	uint64_t out_channel_layout, AVSampleFormat out_sample_fmt, int out_sample_rate,
+	uint64_t in_channel_layout, AVSampleFormat in_sample_fmt, int in_sample_rate,
+	const ResamplerOptions& options);
+
 class AudioStream :
 	public Stream
 {
@@ -27,7 +36,7 @@ private:
 	const uint64_t channel_layout;
 	const int channels;
 
-	// resampler context
+	// resampler context, nullptr if frames go to the fifo as they are
 	SwrContextPtr swr;
 
 	// audio fifo buffer
@@ -36,9 +45,17 @@ private:
 	// frame for encoder (converted from the src_frame)
 	AVFramePtr dst_frame;
 
+	// ensure dst_frame can be written to without touching packets still queued in the muxer
+	void MakeWritable();
+
+	// encode dst_frame, or write it as a packet directly if the encoder is bypassed
+	void EncodeFrame();
+
 public:
 	// set up stream with the given parameters
-	AudioStream(std::shared_ptr<AVFormatContext>& format_context, const AVCodec& codec, AVDictionaryPtr& options, AVSampleFormat sample_fmt, int sample_rate, uint64_t channel_layout);
+	AudioStream(
+		std::shared_ptr<AVFormatContext>& format_context, const AVCodec& codec, AVDictionaryPtr& options, AVSampleFormat sample_fmt, int sample_rate, uint64_t channel_layout,
+		const ResamplerOptions& resampler, const ThreadPolicy& codec_policy, const std::shared_ptr<MemoryAccount>& memory);
 
 	// transcode the data to a format that is compatible with the codec
 	// (needs to match sample_fmt and channel_layout as specified in constructor)
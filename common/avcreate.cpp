@@ -1,12 +1,21 @@
 #include "avcreate.h"
 #include "logger.h"
 
+extern "C" {
+#include <libavutil/opt.h>
+}
+
 AVFormatContextPtr CreateAVFormatContext(const std::filesystem::path& filename) {
+	return CreateAVFormatContext(filename, "");
+}
+
+AVFormatContextPtr CreateAVFormatContext(const std::filesystem::path& filename, const std::string& format_name) {
 	LOG_ENTER;
 	AVFormatContext* context{ nullptr };
 	auto u8_filename{ filename.u8string() };
 	auto c_filename{ reinterpret_cast<const char*>(u8_filename.c_str()) };
-	auto ret{ avformat_alloc_output_context2(&context, nullptr, nullptr, c_filename) };
+	auto c_format_name{ format_name.empty() ? nullptr : format_name.c_str() };
+	auto ret{ avformat_alloc_output_context2(&context, nullptr, c_format_name, c_filename) };
 	if (ret < 0)
 		throw std::runtime_error(fmt::format("failed to allocate output context for '{}': {}", c_filename, AVErrorString(ret)));
 	if (!context)
@@ -17,11 +26,34 @@ AVFormatContextPtr CreateAVFormatContext(const std::filesystem::path& filename)
 
 void AVFormatContextDeleter::operator()(AVFormatContext* context) const {
 	LOG_ENTER_METHOD;
-	if (context) avio_closep(&context->pb);
+	// custom io is owned by whoever set it up
+	if (context && !(context->flags & AVFMT_FLAG_CUSTOM_IO)) avio_closep(&context->pb);
 	avformat_free_context(context);
 	LOG_EXIT_METHOD;
 }
 
+AVInputFormatContextPtr CreateAVInputFormatContext(const std::filesystem::path& filename) {
+	LOG_ENTER;
+	AVFormatContext* context{ nullptr };
+	auto u8_filename{ filename.u8string() };
+	auto c_filename{ reinterpret_cast<const char*>(u8_filename.c_str()) };
+	auto ret{ avformat_open_input(&context, c_filename, nullptr, nullptr) };
+	if (ret < 0)
+		throw std::runtime_error(fmt::format("failed to open '{}' for reading: {}", c_filename, AVErrorString(ret)));
+	AVInputFormatContextPtr input{ context };
+	ret = avformat_find_stream_info(context, nullptr);
+	if (ret < 0)
+		throw std::runtime_error(fmt::format("failed to find stream info for '{}': {}", c_filename, AVErrorString(ret)));
+	LOG_EXIT;
+	return input;
+}
+
+void AVInputFormatContextDeleter::operator()(AVFormatContext* context) const {
+	LOG_ENTER_METHOD;
+	avformat_close_input(&context);
+	LOG_EXIT_METHOD;
+}
+
 AVCodecPtr CreateAVCodec(const std::string& name, const AVCodecID& fallback) {
 	LOG_ENTER;
 	auto codec = avcodec_find_encoder_by_name(name.c_str());
@@ -82,21 +114,27 @@ void AVFrameDeleter::operator()(AVFrame* frame) const {
 
 SwrContextPtr CreateSwrContext(
 	uint64_t out_channel_layout, AVSampleFormat out_sample_fmt, int out_sample_rate,
-	uint64_t in_channel_layout, AVSampleFormat in_sample_fmt, int in_sample_rate)
+	uint64_t in_channel_layout, AVSampleFormat in_sample_fmt, int in_sample_rate,
+	const AVDictionary* options)
 {
 	LOG_ENTER;
-	auto swr = swr_alloc_set_opts(
+	SwrContextPtr swr{ swr_alloc_set_opts(
 		NULL,
 		out_channel_layout, out_sample_fmt, out_sample_rate,
 		in_channel_layout, in_sample_fmt, in_sample_rate,
-		0, NULL);
+		0, NULL) };
 	if (!swr)
 		throw std::runtime_error("failed to allocate resampling context");
-	int ret = swr_init(swr);
+	for (AVDictionaryEntry* entry = nullptr; (entry = av_dict_get(options, "", entry, AV_DICT_IGNORE_SUFFIX));) {
+		int ret = av_opt_set(swr.get(), entry->key, entry->value, 0);
+		if (ret < 0)
+			throw std::runtime_error(fmt::format("resampling context rejects {}={}: {}", entry->key, entry->value, AVErrorString(ret)));
+	}
+	int ret = swr_init(swr.get());
 	if (ret < 0)
 		throw std::runtime_error(fmt::format("failed to initialize resampling context: {}", AVErrorString(ret)));
 	LOG_EXIT;
-	return SwrContextPtr{ swr };
+	return swr;
 }
 
 void SwrContextDeleter::operator()(SwrContext* swr) const {
@@ -149,6 +187,19 @@ AVDictionaryPtr CreateAVDictionary(const std::string& options, const std::string
 	return AVDictionaryPtr{ dict };
 }
 
+AVDictionaryPtr CopyAVDictionary(const AVDictionary* dict)
+{
+	LOG_ENTER;
+	AVDictionary* copy{};
+	auto ret = av_dict_copy(&copy, dict, 0);
+	if (ret < 0) {
+		av_dict_free(&copy);
+		throw std::runtime_error(fmt::format("failed to copy dictionary: {}", AVErrorString(ret)));
+	}
+	LOG_EXIT;
+	return AVDictionaryPtr{ copy };
+}
+
 void AVDictionaryDeleter::operator()(AVDictionary* dict) const
 {
 	LOG_ENTER_METHOD;
@@ -172,3 +223,44 @@ void AVPacketDeleter::operator()(AVPacket* pkt) const
 	av_packet_free(&pkt);
 	LOG_EXIT_METHOD;
 }
+
+// the wrapped buffer, and where to release its size once the wrapper is freed
+struct CountedAVBuffer {
+	AVBufferRef* buf;
+	std::shared_ptr<MemoryAccount> memory;
+	MemoryStage stage;
+};
+
+void CountedAVBufferFree(void* opaque, uint8_t* data)
+{
+	auto counted = static_cast<CountedAVBuffer*>(opaque);
+	counted->memory->Add(counted->stage, -static_cast<int64_t>(counted->buf->size));
+	av_buffer_unref(&counted->buf);
+	delete counted;
+}
+
+void CountAVBuffer(AVBufferRef*& buf, const std::shared_ptr<MemoryAccount>& memory, MemoryStage stage)
+{
+	LOG_ENTER;
+	if (buf && memory) {
+		auto counted = new CountedAVBuffer{ buf, memory, stage };
+		// a buffer shared with others must stay read only through the wrapper
+		auto flags = av_buffer_is_writable(buf) ? 0 : AV_BUFFER_FLAG_READONLY;
+		auto wrapper = av_buffer_create(buf->data, buf->size, CountedAVBufferFree, counted, flags);
+		if (!wrapper) {
+			delete counted;
+			throw std::runtime_error("failed to allocate counted buffer");
+		}
+		memory->Add(stage, buf->size);
+		buf = wrapper;
+	}
+	LOG_EXIT;
+}
+
+void CountAVFrame(AVFrame& frame, const std::shared_ptr<MemoryAccount>& memory, MemoryStage stage)
+{
+	LOG_ENTER;
+	for (auto& buf : frame.buf)
+		CountAVBuffer(buf, memory, stage);
+	LOG_EXIT;
+}
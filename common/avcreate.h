@@ -1,6 +1,8 @@
 #pragma once
 #pragma warning( disable : 26812 )
 
+#include "memory.h"
+
 #include <filesystem>
 #include <memory>
 
@@ -13,6 +15,7 @@ extern "C" {
 }
 
 struct AVFormatContextDeleter { void operator()(AVFormatContext* context) const; };
+struct AVInputFormatContextDeleter { void operator()(AVFormatContext* context) const; };
 struct AVStreamDeleter { void operator()(AVStream* stream) const; };
 struct AVCodecContextDeleter { void operator()(AVCodecContext* context) const; };
 struct AVFrameDeleter { void operator()(AVFrame* frame) const; };
@@ -23,6 +26,7 @@ struct AVAudioFifoDeleter { void operator()(AVAudioFifo* fifo) const; };
 struct AVDictionaryDeleter{ void operator()(AVDictionary * dict) const; };
 
 using AVFormatContextPtr = std::unique_ptr<AVFormatContext, AVFormatContextDeleter>;
+using AVInputFormatContextPtr = std::unique_ptr<AVFormatContext, AVInputFormatContextDeleter>;
 using AVCodecPtr = const AVCodec*;
 using AVStreamPtr = std::unique_ptr<AVStream, AVStreamDeleter>;
 using AVCodecContextPtr = std::unique_ptr<AVCodecContext, AVCodecContextDeleter>;
@@ -34,6 +38,8 @@ using AVAudioFifoPtr = std::unique_ptr<AVAudioFifo, AVAudioFifoDeleter>;
 using AVDictionaryPtr = std::unique_ptr<AVDictionary, AVDictionaryDeleter>;
 
 AVFormatContextPtr CreateAVFormatContext(const std::filesystem::path& filename);
+AVFormatContextPtr CreateAVFormatContext(const std::filesystem::path& filename, const std::string& format_name);
+AVInputFormatContextPtr CreateAVInputFormatContext(const std::filesystem::path& filename);
 AVCodecPtr CreateAVCodec(const std::string& name, const AVCodecID& fallback);
 AVStreamPtr CreateAVStream(AVFormatContext& format_context, const AVCodec& codec);
 AVCodecContextPtr CreateAVCodecContext(const AVCodec& codec);
@@ -41,10 +47,19 @@ AVFramePtr CreateAVFrame();
 AVPacketPtr CreateAVPacket();
 SwrContextPtr CreateSwrContext(
 	uint64_t out_channel_layout, AVSampleFormat out_sample_fmt, int out_sample_rate,
-	uint64_t in_channel_layout, AVSampleFormat in_sample_fmt, int in_sample_rate);
+	uint64_t in_channel_layout, AVSampleFormat in_sample_fmt, int in_sample_rate,
+	const AVDictionary* options = nullptr);
 SwsContextPtr CreateSwsContext(
 	int srcW, int srcH, AVPixelFormat srcFormat,
 	int dstW, int dstH, AVPixelFormat dstFormat,
 	int flags);
 AVAudioFifoPtr CreateAVAudioFifo(AVSampleFormat sample_fmt, int channels, int nb_samples);
-AVDictionaryPtr CreateAVDictionary(const std::string& options, const std::string& key_val_sep, const std::string& pairs_sep);
\ No newline at end of file
+AVDictionaryPtr CreateAVDictionary(const std::string& options, const std::string& key_val_sep, const std::string& pairs_sep);
+AVDictionaryPtr CopyAVDictionary(const AVDictionary* dict);
+
+// wrap a freshly allocated buffer so that its size is accounted to the stage until the last reference is gone
+// does nothing if buf or memory is null
+void CountAVBuffer(AVBufferRef*& buf, const std::shared_ptr<MemoryAccount>& memory, MemoryStage stage);
+
+// count all buffers of a freshly allocated frame
+void CountAVFrame(AVFrame& frame, const std::shared_ptr<MemoryAccount>& memory, MemoryStage stage);
\ No newline at end of file
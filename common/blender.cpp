@@ -0,0 +1,165 @@
+#include "blender.h"
+#include "converter.h"
+#include "logger.h"
+#include "videostream.h"
+
+#include <algorithm>
+
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+}
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SVE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// first frame stores, later frames add, so the accumulator never needs clearing
+void AccumulateRow(uint16_t* acc, const uint8_t* src, int n, bool first)
+{
+	int x{ 0 };
+#ifdef SVE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	for (; x + 16 <= n; x += 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+		__m128i lo = _mm_unpacklo_epi8(v, zero);
+		__m128i hi = _mm_unpackhi_epi8(v, zero);
+		auto acc_lo = reinterpret_cast<__m128i*>(acc + x);
+		auto acc_hi = reinterpret_cast<__m128i*>(acc + x + 8);
+		if (!first) {
+			lo = _mm_add_epi16(lo, _mm_loadu_si128(acc_lo));
+			hi = _mm_add_epi16(hi, _mm_loadu_si128(acc_hi));
+		}
+		_mm_storeu_si128(acc_lo, lo);
+		_mm_storeu_si128(acc_hi, hi);
+	}
+#endif
+	if (first)
+		for (; x < n; x++)
+			acc[x] = src[x];
+	else
+		for (; x < n; x++)
+			acc[x] += src[x];
+}
+
+// dst = (acc + count / 2) / count in fixed point, as (acc + bias) * reciprocal >> 16
+// with reciprocal = ceil(65536 / count), which is at most one too high, and saturated to 255
+// a count of 1 (reciprocal 0) passes the accumulator through
+void AverageRow(uint8_t* dst, const uint16_t* acc, int n, uint16_t bias, uint16_t reciprocal)
+{
+	int x{ 0 };
+#ifdef SVE_SSE2
+	const __m128i vbias = _mm_set1_epi16(static_cast<short>(bias));
+	const __m128i vreciprocal = _mm_set1_epi16(static_cast<short>(reciprocal));
+	for (; x + 16 <= n; x += 16) {
+		__m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + x));
+		__m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + x + 8));
+		if (reciprocal) {
+			lo = _mm_mulhi_epu16(_mm_add_epi16(lo, vbias), vreciprocal);
+			hi = _mm_mulhi_epu16(_mm_add_epi16(hi, vbias), vreciprocal);
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_packus_epi16(lo, hi));
+	}
+#endif
+	for (; x < n; x++) {
+		uint32_t value = reciprocal ? ((uint32_t{ acc[x] } + bias) * reciprocal) >> 16 : acc[x];
+		dst[x] = static_cast<uint8_t>(std::min(value, 255u));
+	}
+}
+
+}
+
+FrameBlender::FrameBlender(int width, int height, AVPixelFormat pix_fmt, int nb_frames, const ThreadPolicy& policy)
+	: width{ width }, height{ height }, pix_fmt{ pix_fmt }
+	, planes{}, accumulator{}, pending{ 0 }, frame{ nullptr }
+	, pool{ nullptr }, nb_bands{ 1 }
+	, nb_frames{ nb_frames }
+{
+	LOG_ENTER_METHOD;
+	auto desc = av_pix_fmt_desc_get(pix_fmt);
+	if (!desc || (desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BITSTREAM)))
+		throw std::invalid_argument(fmt::format("cannot blend pixel format {}", av_get_pix_fmt_name(pix_fmt)));
+	for (int c = 0; c < desc->nb_components; c++)
+		if (desc->comp[c].depth != 8)
+			throw std::invalid_argument(fmt::format("cannot blend pixel format {}, components must be 8 bit", desc->name));
+	// 255 * 256 still fits in 16 bits
+	if (nb_frames < 2 || nb_frames > 256)
+		throw std::invalid_argument(fmt::format("cannot blend {} frames, must be between 2 and 256", nb_frames));
+	size_t offset{ 0 };
+	for (int i = 0; i < av_pix_fmt_count_planes(pix_fmt); i++) {
+		auto row_bytes = av_image_get_linesize(pix_fmt, width, i);
+		auto rows = (i == 1 || i == 2) ? AV_CEIL_RSHIFT(height, desc->log2_chroma_h) : height;
+		planes.push_back(Plane{ offset, row_bytes, rows });
+		offset += size_t(row_bytes) * rows;
+	}
+	accumulator.resize(offset);
+	frame = CreateVideoFrame(width, height, pix_fmt);
+	int threads = (policy.threads > 0) ? policy.threads : DefaultConversionThreads();
+	nb_bands = std::max(1, std::min(threads, height / 16));
+	if (nb_bands > 1)
+		pool = std::make_unique<ThreadPool>(nb_bands, policy);
+	LOG->info("blending every {} frames of {} in {} bands", nb_frames, desc->name, nb_bands);
+	LOG_EXIT_METHOD;
+}
+
+void FrameBlender::AccumulateBand(int band, const AVFrame& src_frame)
+{
+	for (size_t i = 0; i < planes.size(); i++) {
+		const auto& plane = planes[i];
+		auto acc = accumulator.data() + plane.offset;
+		for (int y = plane.rows * band / nb_bands; y < plane.rows * (band + 1) / nb_bands; y++)
+			AccumulateRow(acc + size_t(y) * plane.row_bytes, src_frame.data[i] + ptrdiff_t(y) * src_frame.linesize[i], plane.row_bytes, pending == 0);
+	}
+}
+
+void FrameBlender::BlendBand(int band)
+{
+	uint16_t bias = static_cast<uint16_t>(pending / 2);
+	uint16_t reciprocal = (pending > 1) ? static_cast<uint16_t>((65536 + pending - 1) / pending) : 0;
+	for (size_t i = 0; i < planes.size(); i++) {
+		const auto& plane = planes[i];
+		auto acc = accumulator.data() + plane.offset;
+		for (int y = plane.rows * band / nb_bands; y < plane.rows * (band + 1) / nb_bands; y++)
+			AverageRow(frame->data[i] + ptrdiff_t(y) * frame->linesize[i], acc + size_t(y) * plane.row_bytes, plane.row_bytes, bias, reciprocal);
+	}
+}
+
+bool FrameBlender::Add(const AVFrame& src_frame)
+{
+	LOG_ENTER_METHOD;
+	if (src_frame.width != width || src_frame.height != height || src_frame.format != pix_fmt)
+		throw std::invalid_argument("frame does not match blend format");
+	if (pool)
+		pool->Run(nb_bands, [&](int band) { AccumulateBand(band, src_frame); });
+	else
+		AccumulateBand(0, src_frame);
+	pending++;
+	LOG_EXIT_METHOD;
+	return pending >= nb_frames;
+}
+
+int FrameBlender::Pending() const
+{
+	return pending;
+}
+
+const AVFramePtr& FrameBlender::Blend()
+{
+	LOG_ENTER_METHOD;
+	if (pending == 0)
+		throw std::runtime_error("no frames to blend");
+	// the encoder or muxer may still hold a reference to the previous blend
+	int ret = av_frame_make_writable(frame.get());
+	if (ret < 0)
+		throw std::runtime_error(fmt::format("failed to make blend frame writable: {}", AVErrorString(ret)));
+	if (pool)
+		pool->Run(nb_bands, [&](int band) { BlendBand(band); });
+	else
+		BlendBand(0);
+	pending = 0;
+	LOG_EXIT_METHOD;
+	return frame;
+}
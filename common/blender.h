@@ -0,0 +1,54 @@
+#pragma once
+
+#include "avcreate.h"
+#include "threadpool.h"
+
+#include <vector>
+
+// Temporal blending: averages every nb_frames consecutive frames into one,
+// for motion blurred exports at a fraction of the capture frame rate.
+// The average is approximate: dividing by a 16 bit fixed point reciprocal can give one more than
+// the rounded average (never less), which is invisible but means blends are not bit exact.
+// Frames are summed into a 16 bit accumulator per byte, so only formats with 8 bit components are supported,
+// but the layout of the bytes (planar, semi planar, or packed) does not matter.
+// Rows are split into bands that are processed concurrently.
+class FrameBlender {
+private:
+	// bytes of a plane, and where its accumulator starts
+	struct Plane {
+		size_t offset;
+		int row_bytes;
+		int rows;
+	};
+
+	const int width;
+	const int height;
+	const AVPixelFormat pix_fmt;
+	std::vector<Plane> planes;
+	std::vector<uint16_t> accumulator;
+	int pending; // frames accumulated since the last blend
+	AVFramePtr frame;
+
+	// pool for running the bands, nullptr if there is only one band
+	std::unique_ptr<ThreadPool> pool;
+	int nb_bands;
+
+	void AccumulateBand(int band, const AVFrame& src_frame);
+	void BlendBand(int band);
+
+public:
+	const int nb_frames;
+
+	// set up accumulator and output frame, with the number of threads of the policy (0 = automatic)
+	FrameBlender(int width, int height, AVPixelFormat pix_fmt, int nb_frames, const ThreadPolicy& policy);
+
+	// add a frame, returns true once nb_frames frames are accumulated
+	bool Add(const AVFrame& src_frame);
+
+	// frames accumulated since the last blend
+	int Pending() const;
+
+	// approximate average of the pending frames (at most one above rounding), which are then cleared
+	// the frame stays valid until the next call
+	const AVFramePtr& Blend();
+};
@@ -0,0 +1,163 @@
+#include "changemap.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/imgutils.h>
+}
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SVE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// sum of absolute differences between the rows, and copy the current row over the previous one
+uint32_t CompareRow(uint8_t* prev, const uint8_t* cur, int n)
+{
+	uint32_t sum{ 0 };
+	int x{ 0 };
+#ifdef SVE_SSE2
+	__m128i acc = _mm_setzero_si128();
+	for (; x + 16 <= n; x += 16) {
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur + x));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + x));
+		// two 16 bit sums, one in each 64 bit half
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(a, b));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(prev + x), a);
+	}
+	sum = static_cast<uint32_t>(_mm_cvtsi128_si32(acc)) + static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+#endif
+	for (; x < n; x++) {
+		sum += static_cast<uint32_t>(std::abs(int{ cur[x] } - int{ prev[x] }));
+		prev[x] = cur[x];
+	}
+	return sum;
+}
+
+}
+
+bool CodecHonoursRegions(const AVCodec& codec)
+{
+	static const std::set<std::string> names{ "libx264", "libx264rgb", "libx265", "libvpx", "libvpx-vp9" };
+	return names.count(codec.name) > 0;
+}
+
+ChangeMap::ChangeMap(int width, int height, AVPixelFormat pix_fmt, int threshold)
+	: width{ width }, height{ height }, row_bytes{ 0 }, block_bytes{ 0 }
+	, previous{}, sums{}, changed{}, has_previous{ false }, threshold{ threshold }
+	, blocks_x{ (width + block_size - 1) / block_size }, blocks_y{ (height + block_size - 1) / block_size }
+	, nb_blocks{ 0 }, nb_static{ 0 }
+{
+	LOG_ENTER_METHOD;
+	row_bytes = av_image_get_linesize(pix_fmt, width, 0);
+	if (row_bytes <= 0)
+		throw std::runtime_error(fmt::format("failed to get line size for {}x{}", width, height));
+	block_bytes = std::max(1, (row_bytes * block_size + width - 1) / width);
+	previous.resize(static_cast<size_t>(row_bytes) * height);
+	sums.resize(blocks_x);
+	changed.resize(static_cast<size_t>(blocks_x) * blocks_y);
+	LOG->debug("change map of {}x{} blocks, {} bytes per block row", blocks_x, blocks_y, block_bytes);
+	LOG_EXIT_METHOD;
+}
+
+const std::vector<uint8_t>& ChangeMap::Update(const AVFrame& frame)
+{
+	LOG_ENTER_METHOD;
+	if (!has_previous) {
+		for (int y = 0; y < height; y++)
+			std::memcpy(previous.data() + static_cast<size_t>(y) * row_bytes, frame.data[0] + static_cast<ptrdiff_t>(y) * frame.linesize[0], row_bytes);
+		std::fill(changed.begin(), changed.end(), uint8_t{ 1 });
+		has_previous = true;
+	}
+	else {
+		for (int by = 0; by < blocks_y; by++) {
+			std::fill(sums.begin(), sums.end(), 0);
+			const int y_begin = by * block_size;
+			const int y_end = std::min(height, y_begin + block_size);
+			for (int y = y_begin; y < y_end; y++) {
+				auto cur = frame.data[0] + static_cast<ptrdiff_t>(y) * frame.linesize[0];
+				auto prev = previous.data() + static_cast<size_t>(y) * row_bytes;
+				for (int bx = 0; bx < blocks_x; bx++) {
+					const int x = bx * block_bytes;
+					if (x < row_bytes)
+						sums[bx] += CompareRow(prev + x, cur + x, std::min(block_bytes, row_bytes - x));
+				}
+			}
+			// compare the mean, so the partial blocks at the edges count the same
+			for (int bx = 0; bx < blocks_x; bx++) {
+				const int x = bx * block_bytes;
+				const int64_t bytes = int64_t{ std::max(0, std::min(block_bytes, row_bytes - x)) } * (y_end - y_begin);
+				changed[static_cast<size_t>(by) * blocks_x + bx] = (sums[bx] > threshold * bytes) ? 1 : 0;
+			}
+		}
+	}
+	nb_blocks += changed.size();
+	nb_static += std::count(changed.begin(), changed.end(), uint8_t{ 0 });
+	LOG_EXIT_METHOD;
+	return changed;
+}
+
+double ChangeMap::StaticFraction() const
+{
+	return nb_blocks ? static_cast<double>(nb_static) / nb_blocks : 0.0;
+}
+
+void ChangeMap::AttachRegions(AVFrame& frame, const AVRational& qoffset) const
+{
+	LOG_ENTER_METHOD;
+	av_frame_remove_side_data(&frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+	// runs of static blocks in every block row, extended downwards while the next row has a run over the same blocks
+	struct Run {
+		int x0, x1; // blocks, x1 exclusive
+		int y0, y1; // block rows, y1 exclusive
+	};
+	std::vector<Run> runs{};
+	std::vector<size_t> open{}; // runs that reach the previous block row
+	std::vector<size_t> next{};
+	for (int by = 0; by < blocks_y; by++) {
+		const auto row = changed.data() + static_cast<size_t>(by) * blocks_x;
+		next.clear();
+		for (int bx = 0; bx < blocks_x;) {
+			if (row[bx]) {
+				bx++;
+				continue;
+			}
+			const int x0 = bx;
+			while (bx < blocks_x && !row[bx])
+				bx++;
+			auto above = std::find_if(open.begin(), open.end(), [&](size_t i) { return runs[i].x0 == x0 && runs[i].x1 == bx; });
+			if (above != open.end()) {
+				runs[*above].y1 = by + 1;
+				next.push_back(*above);
+			}
+			else {
+				runs.push_back(Run{ x0, bx, by, by + 1 });
+				next.push_back(runs.size() - 1);
+			}
+		}
+		std::swap(open, next);
+	}
+	if (!runs.empty()) {
+		auto side_data = av_frame_new_side_data(&frame, AV_FRAME_DATA_REGIONS_OF_INTEREST, runs.size() * sizeof(AVRegionOfInterest));
+		if (!side_data)
+			throw std::runtime_error("failed to allocate regions of interest");
+		auto regions = reinterpret_cast<AVRegionOfInterest*>(side_data->data);
+		for (size_t i = 0; i < runs.size(); i++) {
+			regions[i].self_size = sizeof(AVRegionOfInterest);
+			regions[i].top = runs[i].y0 * block_size;
+			regions[i].bottom = std::min(runs[i].y1 * block_size, height);
+			regions[i].left = runs[i].x0 * block_size;
+			regions[i].right = std::min(runs[i].x1 * block_size, width);
+			regions[i].qoffset = qoffset;
+		}
+	}
+	LOG_EXIT_METHOD;
+}
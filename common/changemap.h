@@ -0,0 +1,51 @@
+#pragma once
+
+#include "avcreate.h"
+
+#include <vector>
+
+// codecs that take regions of interest (AV_FRAME_DATA_REGIONS_OF_INTEREST) into account
+bool CodecHonoursRegions(const AVCodec& codec);
+
+// Static region detection: compares the first plane (luma, or packed samples) of every frame
+// with that of the previous frame, in blocks of 16x16 pixels, and marks the blocks whose
+// mean absolute difference exceeds a threshold as changed.
+// The static blocks can then be attached to the frame as regions of interest with a higher quantizer,
+// so the encoder spends its bits on the parts of the frame that move.
+// Only the bytes are compared, so any pixel format works, but the threshold is meant for 8 bit components.
+class ChangeMap {
+private:
+	const int width;
+	const int height;
+	int row_bytes;   // bytes of a row of the first plane
+	int block_bytes; // bytes of a row of a block
+	std::vector<uint8_t> previous; // first plane of the previous frame, packed
+	std::vector<uint32_t> sums;    // sum of absolute differences of each block of the current block row
+	std::vector<uint8_t> changed;  // per block of the last frame, row by row
+	bool has_previous;
+	const int threshold;           // mean absolute difference per byte
+
+public:
+	static constexpr int block_size = 16;
+	const int blocks_x;
+	const int blocks_y;
+
+	// totals over all frames
+	int64_t nb_blocks;
+	int64_t nb_static;
+
+	// threshold is the mean absolute difference per byte above which a block counts as changed
+	ChangeMap(int width, int height, AVPixelFormat pix_fmt, int threshold);
+
+	// compare the frame with the previous one, and keep it for the next call
+	// the first frame counts as changed everywhere
+	// returns one byte per block, row by row, non zero if the block changed
+	const std::vector<uint8_t>& Update(const AVFrame& frame);
+
+	// fraction of static blocks over all frames so far
+	double StaticFraction() const;
+
+	// replace the regions of interest of the frame by the static blocks of the last update, merged into rectangles,
+	// with the given quantizer offset (from -1 to 1, positive means fewer bits)
+	void AttachRegions(AVFrame& frame, const AVRational& qoffset) const;
+};
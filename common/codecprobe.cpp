@@ -0,0 +1,208 @@
+#include "codecprobe.h"
+#include "audiostream.h"
+#include "framering.h"
+#include "settings.h"
+#include "videostream.h"
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+}
+
+namespace {
+
+std::string ProbeKey(const AVCodec& codec, const AVDictionary* options)
+{
+	char* buffer{ nullptr };
+	std::string options_string{ };
+	if (av_dict_get_string(options, &buffer, '=', ':') >= 0 && buffer)
+		options_string = buffer;
+	av_freep(&buffer);
+	return fmt::format("{} {} {} {}", av_version_info(), avcodec_version(), codec.name, options_string);
+}
+
+// drain and discard all packets
+int ProbeReceive(AVCodecContext& context)
+{
+	auto pkt = CreateAVPacket();
+	int ret{ 0 };
+	while ((ret = avcodec_receive_packet(&context, pkt.get())) >= 0)
+		av_packet_unref(pkt.get());
+	return (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) ? 0 : ret;
+}
+
+// open the encoder with the options, as a stream would, and encode a single small frame
+CodecProbe RunProbe(const AVCodec& codec, const AVDictionary* options)
+{
+	LOG_ENTER;
+	CodecProbe probe{ };
+	probe.time = std::chrono::system_clock::now();
+	auto context = CreateAVCodecContext(codec);
+	AVFramePtr frame{ nullptr };
+	if (codec.type == AVMEDIA_TYPE_VIDEO) {
+		// some hardware encoders have a minimum size, so not too tiny
+		context->width = 256;
+		context->height = 256;
+		context->time_base = AVRational{ 1, 30 };
+		context->pix_fmt = codec.pix_fmts ? avcodec_find_best_pix_fmt_of_list(codec.pix_fmts, AV_PIX_FMT_NV12, 0, nullptr) : AV_PIX_FMT_NV12;
+		for (auto p = codec.pix_fmts; p && *p != AV_PIX_FMT_NONE; p++)
+			probe.pix_fmts += (probe.pix_fmts.empty() ? "" : " ") + std::string{ av_get_pix_fmt_name(*p) };
+	}
+	else if (codec.type == AVMEDIA_TYPE_AUDIO) {
+		context->sample_fmt = codec.sample_fmts ? codec.sample_fmts[0] : AV_SAMPLE_FMT_S16;
+		context->sample_rate = codec.supported_samplerates ? codec.supported_samplerates[0] : 48000;
+		context->channel_layout = AV_CH_LAYOUT_STEREO;
+		context->channels = 2;
+		context->time_base = AVRational{ 1, context->sample_rate };
+	}
+	else {
+		probe.error = "not an audio or video encoder";
+		LOG_EXIT;
+		return probe;
+	}
+	auto opts = CopyAVDictionary(options);
+	auto dict = opts.release();
+	auto start = std::chrono::steady_clock::now();
+	int ret = avcodec_open2(context.get(), &codec, &dict);
+	std::chrono::duration<double, std::milli> open_time = std::chrono::steady_clock::now() - start;
+	opts.reset(dict);
+	probe.open_ms = open_time.count();
+	if (ret < 0) {
+		probe.error = fmt::format("failed to open: {}", AVErrorString(ret));
+		LOG_EXIT;
+		return probe;
+	}
+	if (codec.type == AVMEDIA_TYPE_VIDEO) {
+		frame = CreateVideoFrame(context->width, context->height, context->pix_fmt);
+		ptrdiff_t linesize[4]{ frame->linesize[0], frame->linesize[1], frame->linesize[2], frame->linesize[3] };
+		av_image_fill_black(frame->data, linesize, context->pix_fmt, AVCOL_RANGE_MPEG, frame->width, frame->height);
+	}
+	else {
+		auto nb_samples = (context->frame_size > 0) ? context->frame_size : 1024;
+		frame = CreateAudioFrame(context->sample_fmt, context->sample_rate, context->channel_layout, nb_samples);
+		av_samples_set_silence(frame->data, 0, nb_samples, context->channels, context->sample_fmt);
+	}
+	frame->pts = 0;
+	ret = avcodec_send_frame(context.get(), frame.get());
+	if (ret >= 0)
+		ret = ProbeReceive(*context);
+	if (ret >= 0)
+		ret = avcodec_send_frame(context.get(), nullptr);
+	if (ret >= 0)
+		ret = ProbeReceive(*context);
+	if (ret < 0)
+		probe.error = fmt::format("failed to encode: {}", AVErrorString(ret));
+	else
+		probe.ok = true;
+	LOG_EXIT;
+	return probe;
+}
+
+}
+
+CodecProbeCache::CodecProbeCache(const std::filesystem::path& filename)
+	: mutex{ }, probes{ }, filename{ filename }
+{
+	LOG_ENTER_METHOD;
+	Load();
+	LOG_EXIT_METHOD;
+}
+
+// one probe per line: key, ok, open time, pixel formats, error, seconds since the epoch when probed, separated by tabs
+// failures without time (from files of earlier versions) or older than retry_interval are ignored, so those encoders are probed again
+void CodecProbeCache::Load()
+{
+	LOG_ENTER_METHOD;
+	std::ifstream is(filename);
+	std::string line{ };
+	while (std::getline(is, line)) {
+		std::istringstream fields{ line };
+		std::string key{ };
+		std::string ok{ };
+		std::string open_ms{ };
+		std::string time{ };
+		CodecProbe probe{ };
+		if (!std::getline(fields, key, '\t') || !std::getline(fields, ok, '\t') || !std::getline(fields, open_ms, '\t'))
+			continue;
+		std::getline(fields, probe.pix_fmts, '\t');
+		std::getline(fields, probe.error, '\t');
+		std::getline(fields, time, '\t');
+		probe.ok = (ok == "1");
+		try {
+			probe.open_ms = std::stod(open_ms);
+			if (!time.empty())
+				probe.time = std::chrono::system_clock::time_point{ std::chrono::seconds{ std::stoll(time) } };
+			else if (!probe.ok)
+				continue;
+		}
+		catch (std::exception&) {
+			continue;
+		}
+		if (!probe.ok && std::chrono::system_clock::now() - probe.time >= retry_interval)
+			continue;
+		probes[key] = probe;
+	}
+	LOG->debug("{} codec probes in {}", probes.size(), filename.string());
+	LOG_EXIT_METHOD;
+}
+
+// write to a temporary file of this process first, so other processes never read half a file,
+// nor write to the same temporary file
+void CodecProbeCache::Save()
+{
+	LOG_ENTER_METHOD;
+	auto tmp_filename = filename;
+	tmp_filename += fmt::format(".{}.tmp", CurrentProcessId());
+	{
+		std::ofstream os(tmp_filename, std::ios::trunc);
+		for (const auto& [key, probe] : probes)
+			os << key << '\t' << (probe.ok ? 1 : 0) << '\t' << probe.open_ms << '\t' << probe.pix_fmts << '\t' << probe.error
+				<< '\t' << std::chrono::duration_cast<std::chrono::seconds>(probe.time.time_since_epoch()).count() << '\n';
+		if (!os) {
+			LOG->error("failed to write codec probes to {}", tmp_filename.string());
+			LOG_EXIT_METHOD;
+			return;
+		}
+	}
+	std::error_code ec;
+	std::filesystem::rename(tmp_filename, filename, ec);
+	if (ec) {
+		LOG->error("failed to write codec probes to {}: {}", filename.string(), ec.message());
+		std::filesystem::remove(tmp_filename, ec);
+	}
+	LOG_EXIT_METHOD;
+}
+
+CodecProbe CodecProbeCache::Probe(const AVCodec& codec, const AVDictionary* options)
+{
+	LOG_ENTER_METHOD;
+	auto key = ProbeKey(codec, options);
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = probes.find(key);
+	if (it != probes.end() && !it->second.ok && std::chrono::system_clock::now() - it->second.time >= retry_interval) {
+		probes.erase(it);
+		it = probes.end();
+	}
+	if (it == probes.end()) {
+		LOG->info("probing encoder {}", codec.name);
+		auto probe = RunProbe(codec, options);
+		if (probe.ok)
+			LOG->info("encoder {} works, opened in {:.1f} ms", codec.name, probe.open_ms);
+		else
+			LOG->warn("encoder {} does not work: {}", codec.name, probe.error);
+		it = probes.emplace(key, probe).first;
+		Save();
+	}
+	LOG_EXIT_METHOD;
+	return it->second;
+}
+
+CodecProbeCache& GetCodecProbeCache()
+{
+	static CodecProbeCache cache{ std::filesystem::path{ Settings::ini_filename_ }.replace_extension(".probe") };
+	return cache;
+}
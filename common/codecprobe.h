@@ -0,0 +1,48 @@
+#pragma once
+
+#include "avcreate.h"
+
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+
+// result of test-opening an encoder with a set of options
+struct CodecProbe {
+	bool ok{ false };
+	std::string pix_fmts{ };  // space separated pixel formats that the encoder accepts, empty for audio
+	double open_ms{ 0.0 };    // time taken by avcodec_open2
+	std::string error{ };     // why the probe failed
+	std::chrono::system_clock::time_point time{ }; // when the probe ran, default for working encoders in files of earlier versions
+};
+
+// Remembers which encoders actually work on this machine, so exports never start with an encoder that is known to fail
+// (for instance a hardware encoder without the hardware).
+// An encoder is probed by opening it with its options and encoding a tiny frame.
+// Results are kept in a text file, keyed by ffmpeg version, codec, and options,
+// so every working encoder is probed only once per machine and ffmpeg build.
+// Failures are probed again once they are older than retry_interval, as they may be transient
+// (for instance a hardware encoder that has no session left while another program uses it),
+// but within that time, processes that start do not probe a missing encoder again.
+// Delete the file to probe again, for instance after installing new drivers.
+class CodecProbeCache {
+private:
+	std::mutex mutex;
+	std::map<std::string, CodecProbe> probes;
+
+	void Load();
+	void Save();
+
+public:
+	const std::filesystem::path filename;
+	static constexpr std::chrono::seconds retry_interval{ 3600 };
+
+	explicit CodecProbeCache(const std::filesystem::path& filename);
+
+	// cached result, or probe the encoder now and store the result
+	CodecProbe Probe(const AVCodec& codec, const AVDictionary* options);
+};
+
+// cache shared by everything in the process, stored next to the ini file
+CodecProbeCache& GetCodecProbeCache();
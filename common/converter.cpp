@@ -0,0 +1,94 @@
+#include "converter.h"
+#include "logger.h"
+
+#include <algorithm>
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+}
+
+int DefaultConversionThreads()
+{
+	auto nb_cores = static_cast<int>(std::thread::hardware_concurrency());
+	return std::clamp(nb_cores / 4, 1, 4);
+}
+
+// vertical shift of the given plane with respect to the luma plane
+auto GetPlaneShift(const AVPixFmtDescriptor& desc, int plane) {
+	auto is_chroma = (desc.nb_components >= 3) && (plane != desc.comp[0].plane) && (plane == desc.comp[1].plane || plane == desc.comp[2].plane);
+	return is_chroma ? desc.log2_chroma_h : 0;
+}
+
+Converter::Converter(int width, int height, AVPixelFormat src_pix_fmt, AVPixelFormat dst_pix_fmt, const ThreadPolicy& policy)
+	: width{ width }, height{ height }
+	, src_pix_fmt{ src_pix_fmt }, dst_pix_fmt{ dst_pix_fmt }
+	, band_y{}, sws{}, pool{ nullptr }
+{
+	LOG_ENTER_METHOD;
+	auto src_desc = av_pix_fmt_desc_get(src_pix_fmt);
+	auto dst_desc = av_pix_fmt_desc_get(dst_pix_fmt);
+	if (!src_desc || !dst_desc)
+		throw std::invalid_argument("unknown pixel format for conversion");
+	int threads = (policy.threads > 0) ? policy.threads : DefaultConversionThreads();
+	// bands are converted as separate images, which is only exact if chroma is not resampled vertically:
+	// otherwise the chroma filter would treat the edge of every band as the edge of the image
+	if (threads > 1 && src_desc->log2_chroma_h != dst_desc->log2_chroma_h) {
+		LOG->info(
+			"conversion from {} to {} resamples chroma vertically, converting in a single band",
+			src_desc->name, dst_desc->name);
+		threads = 1;
+	}
+	int align = 1 << src_desc->log2_chroma_h;
+	int nb_bands = std::max(1, std::min(threads, height / align));
+	int nb_rows = height / align;
+	for (int i = 0; i < nb_bands; i++)
+		band_y.push_back(align * ((nb_rows * i) / nb_bands));
+	band_y.push_back(height);
+	for (int i = 0; i < nb_bands; i++)
+		sws.push_back(CreateSwsContext(
+			width, band_y[i + 1] - band_y[i], src_pix_fmt,
+			width, band_y[i + 1] - band_y[i], dst_pix_fmt,
+			SWS_BICUBIC));
+	if (nb_bands > 1)
+		pool = std::make_unique<ThreadPool>(nb_bands, policy);
+	LOG->debug("converting {} to {} in {} bands", src_desc->name, dst_desc->name, nb_bands);
+	LOG_EXIT_METHOD;
+}
+
+void Converter::ConvertBand(int band, const AVFrame& src_frame, AVFrame& dst_frame)
+{
+	auto src_desc = av_pix_fmt_desc_get(src_pix_fmt);
+	auto dst_desc = av_pix_fmt_desc_get(dst_pix_fmt);
+	const uint8_t* src_data[4]{ nullptr };
+	uint8_t* dst_data[4]{ nullptr };
+	int y = band_y[band];
+	for (int i = 0; i < 4; i++) {
+		if (src_frame.data[i])
+			src_data[i] = src_frame.data[i] + (y >> GetPlaneShift(*src_desc, i)) * src_frame.linesize[i];
+		if (dst_frame.data[i])
+			dst_data[i] = dst_frame.data[i] + (y >> GetPlaneShift(*dst_desc, i)) * dst_frame.linesize[i];
+	}
+	sws_scale(
+		sws[band].get(),
+		src_data, src_frame.linesize, 0, band_y[band + 1] - y,
+		dst_data, dst_frame.linesize);
+}
+
+void Converter::Convert(const AVFrame& src_frame, AVFrame& dst_frame)
+{
+	LOG_ENTER_METHOD;
+	if (src_frame.width != width || src_frame.height != height || src_frame.format != src_pix_fmt)
+		throw std::invalid_argument("source frame does not match conversion format");
+	if (dst_frame.width != width || dst_frame.height != height || dst_frame.format != dst_pix_fmt)
+		throw std::invalid_argument("destination frame does not match conversion format");
+	if (pool)
+		pool->Run(NumBands(), [&](int band) { ConvertBand(band, src_frame, dst_frame); });
+	else
+		ConvertBand(0, src_frame, dst_frame);
+	LOG_EXIT_METHOD;
+}
+
+int Converter::NumBands() const
+{
+	return static_cast<int>(sws.size());
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "avcreate.h"
+#include "threadpool.h"
+
+#include <vector>
+
+// Pixel format conversion, split into horizontal bands that are converted concurrently.
+// Each band has its own conversion context, as these cannot be shared between threads.
+// Bands are aligned to the vertical chroma subsampling of both formats.
+// Conversions that resample chroma vertically run in a single band, so that the result never depends on the banding.
+class Converter {
+private:
+	const int width;
+	const int height;
+	const AVPixelFormat src_pix_fmt;
+	const AVPixelFormat dst_pix_fmt;
+
+	// first row of each band, with an extra entry for the end of the last band
+	std::vector<int> band_y;
+
+	// conversion context for each band
+	std::vector<SwsContextPtr> sws;
+
+	// pool for running the bands, nullptr if there is only one band
+	std::unique_ptr<ThreadPool> pool;
+
+	// convert a single band
+	void ConvertBand(int band, const AVFrame& src_frame, AVFrame& dst_frame);
+
+public:
+	// set up conversion contexts for the number of threads of the policy (0 = automatic)
+	Converter(int width, int height, AVPixelFormat src_pix_fmt, AVPixelFormat dst_pix_fmt, const ThreadPolicy& policy);
+
+	// convert src_frame into the buffer of dst_frame
+	void Convert(const AVFrame& src_frame, AVFrame& dst_frame);
+
+	// number of bands that are converted concurrently
+	int NumBands() const;
+};
+
+// number of conversion threads to use when none are specified
+// this leaves most cores to the game
+int DefaultConversionThreads();
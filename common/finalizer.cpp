@@ -0,0 +1,88 @@
+#include "finalizer.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <thread>
+
+Finalizer::Finalizer()
+	: state{ std::make_shared<FinalizerState>() }
+{
+	LOG_ENTER_METHOD;
+	LOG_EXIT_METHOD;
+}
+
+Finalizer::~Finalizer()
+{
+	LOG_ENTER_METHOD;
+	if (state) {
+		std::unique_lock<std::mutex> lock(state->mutex);
+		state->cond.wait(lock, [this] { return state->pending.empty(); });
+	}
+	LOG_EXIT_METHOD;
+}
+
+void Finalizer::Start(std::unique_ptr<Format> format, std::function<void()> then)
+{
+	LOG_ENTER_METHOD;
+	if (!state)
+		throw std::runtime_error("finalizer abandoned");
+	if (!format)
+		throw std::invalid_argument("no format to finalize");
+	auto filename{ format->filename };
+	{
+		std::lock_guard<std::mutex> lock(state->mutex);
+		state->pending.push_back(filename);
+	}
+	LOG->info("finalizing {} in background", filename.string());
+	try {
+		std::thread([state = state, format = std::move(format), filename, then = std::move(then)]() mutable {
+			ApplyThreadPolicy(format->options.threads.finalize);
+			LOG->info("finalizing {} started", filename.string());
+			auto start = std::chrono::steady_clock::now();
+			try {
+				format->Flush();
+				format = nullptr;
+				std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+				LOG->info("finalizing {} finished in {:.2f} seconds", filename.string(), elapsed.count());
+				if (then)
+					then();
+			}
+			LOG_CATCH;
+			format = nullptr;
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				state->pending.erase(std::find(state->pending.begin(), state->pending.end(), filename));
+			}
+			state->cond.notify_all();
+		}).detach();
+	}
+	catch (...) {
+		{
+			std::lock_guard<std::mutex> lock(state->mutex);
+			state->pending.erase(std::find(state->pending.begin(), state->pending.end(), filename));
+		}
+		state->cond.notify_all();
+		throw;
+	}
+	LOG_EXIT_METHOD;
+}
+
+int Finalizer::Pending() const
+{
+	if (!state)
+		return 0;
+	std::lock_guard<std::mutex> lock(state->mutex);
+	return static_cast<int>(state->pending.size());
+}
+
+void Finalizer::Abandon()
+{
+	LOG_ENTER_METHOD;
+	if (state) {
+		std::lock_guard<std::mutex> lock(state->mutex);
+		for (const auto& filename : state->pending)
+			LOG->error("abandoning finalization of {}, the file may be left without trailer", filename.string());
+	}
+	state = nullptr;
+	LOG_EXIT_METHOD;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "format.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// state shared between the finalizer and its threads
+struct FinalizerState {
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::vector<std::filesystem::path> pending; // files still being finalized
+};
+
+// Finalizes exports on background threads.
+// Each thread takes ownership of a Format, flushes it, destroys it, and runs a follow up job if there is one,
+// so the caller does not have to wait for the encoders to drain and for the trailer to be written.
+class Finalizer {
+private:
+	// nullptr once abandoned
+	std::shared_ptr<FinalizerState> state;
+
+public:
+	Finalizer();
+
+	// waits for all pending finalizations, unless abandoned
+	~Finalizer();
+
+	// flush and destroy the format on a background thread
+	// then, if given, runs on the same thread once the file is complete, for instance to transcode it further
+	void Start(std::unique_ptr<Format> format, std::function<void()> then = nullptr);
+
+	// number of finalizations still running
+	int Pending() const;
+
+	// stop tracking pending finalizations, logging the files that may be left without trailer
+	// the threads keep running (unless the process is terminating) and do not touch the finalizer
+	void Abandon();
+};
@@ -1,12 +1,83 @@
 #include "format.h"
 
+#include <chrono>
+
+extern "C" {
+#include <libavutil/opt.h>
+}
+
+// muxer options for streaming output
+// fragmented mp4/mov writes an empty moov up front and a moof per fragment, so there is no moov to write at the end
+// matroska writes its cues into space reserved after the header, and closes clusters at a fixed interval
+// pipes and sockets cannot seek at all: mp4/mov is always fragmented, and matroska is written in live mode, without cues
+AVDictionaryPtr CreateMuxerOptions(const AVFormatContext& context, const AVCodec& vcodec, const StreamingOptions& streaming, const StreamOutputOptions& output)
+{
+	LOG_ENTER;
+	AVDictionaryPtr options{ nullptr };
+	if (streaming.enable || output.enable) {
+		auto priv_class = context.oformat->priv_class;
+		auto fragment_us = static_cast<int64_t>(streaming.fragment_duration * AV_TIME_BASE);
+		auto dict = options.release();
+		if (priv_class && av_opt_find(&priv_class, "movflags", nullptr, 0, AV_OPT_SEARCH_FAKE_OBJ)) {
+			// with intra only codecs every frame is a keyframe, so fragment on duration alone
+			auto desc = avcodec_descriptor_get(vcodec.id);
+			auto intra_only = desc && (desc->props & AV_CODEC_PROP_INTRA_ONLY);
+			av_dict_set(&dict, "movflags", intra_only ? "+empty_moov+default_base_moof" : "+frag_keyframe+empty_moov+default_base_moof", 0);
+			av_dict_set_int(&dict, "frag_duration", fragment_us, 0);
+		}
+		else if (priv_class && av_opt_find(&priv_class, "reserve_index_space", nullptr, 0, AV_OPT_SEARCH_FAKE_OBJ)) {
+			if (output.enable)
+				av_dict_set_int(&dict, "live", 1, 0);
+			else
+				av_dict_set_int(&dict, "reserve_index_space", streaming.index_space, 0);
+			av_dict_set_int(&dict, "cluster_time_limit", fragment_us / 1000, 0);
+		}
+		else if (!output.enable) {
+			LOG->warn("container {} has no streaming mode", context.oformat->name);
+		}
+		// hand every packet to the reader as soon as it is muxed
+		if (output.enable)
+			av_dict_set_int(&dict, "flush_packets", 1, 0);
+		options.reset(dict);
+	}
+	LOG_EXIT;
+	return options;
+}
+
+// telemetry is optional, so failing to set it up does not stop the export
+std::unique_ptr<Telemetry> CreateTelemetry(const std::string& name)
+{
+	LOG_ENTER;
+	std::unique_ptr<Telemetry> telemetry{ nullptr };
+	if (!name.empty()) {
+		try {
+			telemetry = std::make_unique<Telemetry>(name, true);
+			LOG->info("publishing progress as {}", name);
+		}
+		catch (std::exception& e) {
+			LOG->error(e.what());
+		}
+	}
+	LOG_EXIT;
+	return telemetry;
+}
+
 Format::Format(
 	const std::filesystem::path& filename,
 	const AVCodec& vcodec, AVDictionaryPtr& voptions, int width, int height, const AVRational& frame_rate, AVPixelFormat pix_fmt,
-	const AVCodec& acodec, AVDictionaryPtr& aoptions, AVSampleFormat sample_fmt, int sample_rate, uint64_t channel_layout)
-	: context{ CreateAVFormatContext(filename) }
-	, vstream{ context, vcodec, voptions, width, height, frame_rate, pix_fmt }
-	, astream{ context, acodec, aoptions, sample_fmt, sample_rate, channel_layout }
+	const AVCodec& acodec, AVDictionaryPtr& aoptions, AVSampleFormat sample_fmt, int sample_rate, uint64_t channel_layout,
+	const FormatOptions& options)
+	: filename{ filename }
+	, output{ options.output.enable ? std::make_unique<StreamOutput>(filename) : nullptr }
+	, context{ CreateAVFormatContext(filename, options.output.container) }
+	, options{ options }
+	, telemetry{ CreateTelemetry(options.telemetry) }
+	, memory{ std::make_shared<MemoryAccount>(options.memory_limit) }
+	, index{ nullptr }
+	, segmenter{ nullptr }
+	, interleaver{ nullptr }
+	, vstream{ context, vcodec, voptions, width, height, av_div_q(frame_rate, AVRational{ options.blend_frames, 1 }), pix_fmt, options.threads.codec, options.threads.conversion, memory }
+	, astream{ context, acodec, aoptions, sample_fmt, sample_rate, channel_layout, options.resampler, options.threads.codec, memory }
 {
 	LOG_ENTER_METHOD;
 	// the ffmpeg API expects a utf8 encoded const char * for the filename
@@ -16,13 +87,74 @@ Format::Format(
 	// none of the above functions should set context to null, but just in case...
 	if (!context)
 		throw std::runtime_error(fmt::format("output context lost"));
-	int ret = avio_open(&context->pb, c_filename, AVIO_FLAG_WRITE);
-	if (ret < 0 || !context->pb)
-		throw std::runtime_error(fmt::format("failed to open '{}' for writing: {}", filename.string(), AVErrorString(ret)));
-	if (!(context->oformat->flags & AVFMT_NOFILE)) {
-		ret = avformat_write_header(context.get(), NULL);
+	int ret{ 0 };
+	// a split export only uses the context as template for the segments, which have their own files
+	const bool segmented = (options.segments.duration > 0.0 || options.segments.size > 0) && !(context->oformat->flags & AVFMT_NOFILE);
+	if (segmented && output)
+		LOG->warn("cannot split stream output {} into segments", filename.string());
+	if (output) {
+		context->pb = output->Context();
+		context->flags |= AVFMT_FLAG_CUSTOM_IO;
+	}
+	else if (segmented) {
+		auto muxer_options = CreateMuxerOptions(*context, vcodec, options.streaming, options.output);
+		segmenter = std::make_unique<Segmenter>(
+			filename, context, muxer_options.get(), options.segments, vstream.stream->index, vstream.context->time_base);
+	}
+	else {
+		ret = avio_open(&context->pb, c_filename, AVIO_FLAG_WRITE);
+		if (ret < 0 || !context->pb)
+			throw std::runtime_error(fmt::format("failed to open '{}' for writing: {}", filename.string(), AVErrorString(ret)));
+	}
+	if (!segmenter && !(context->oformat->flags & AVFMT_NOFILE)) {
+		auto muxer_options = CreateMuxerOptions(*context, vcodec, options.streaming, options.output);
+		auto dict = muxer_options.release();
+		ret = avformat_write_header(context.get(), &dict);
+		muxer_options.reset(dict);
 		if (ret < 0)
 			throw std::runtime_error(fmt::format("failed to write header: {}", AVErrorString(ret)));
+		for (AVDictionaryEntry* entry = nullptr; (entry = av_dict_get(muxer_options.get(), "", entry, AV_DICT_IGNORE_SUFFIX));)
+			LOG->warn("muxer option {} not used", entry->key);
+	}
+	interleaver = std::make_shared<Interleaver>(context, options.interleave);
+	if (options.index && output) {
+		LOG->warn("no frame index for stream output {}", filename.string());
+	}
+	else if (options.index && segmenter) {
+		LOG->warn("no frame index for split export {}", filename.string());
+	}
+	else if (options.index) {
+		index = std::make_unique<FrameIndexWriter>(FrameIndexFilename(filename), *context);
+		interleaver->index = index.get();
+	}
+	if (options.blend_frames > 1)
+		vstream.blender = std::make_unique<FrameBlender>(width, height, pix_fmt, options.blend_frames, options.threads.conversion);
+	if (options.regions.enable && !vstream.direct) {
+		vstream.changes = std::make_unique<ChangeMap>(width, height, vstream.context->pix_fmt, options.regions.threshold);
+		if (CodecHonoursRegions(vcodec))
+			vstream.static_qoffset = av_d2q(options.regions.qoffset, 1000);
+		else
+			LOG->warn("codec {} ignores regions of interest, only counting static blocks", vcodec.name);
+	}
+	if (options.verify) {
+		for (Stream* stream : { static_cast<Stream*>(&vstream), static_cast<Stream*>(&astream) }) {
+			if (stream->direct)
+				LOG->info("{} bypasses the encoder, nothing to verify", stream->context->codec->name);
+			else if (!CodecIsLossless(*stream->context->codec))
+				LOG->warn("{} is not always lossless, not verifying it", stream->context->codec->name);
+			else
+				stream->verifier = std::make_unique<Verifier>(*stream->context, options.threads.verify, memory);
+		}
+	}
+	vstream.interleaver = interleaver.get();
+	astream.interleaver = interleaver.get();
+	interleaver->segmenter = segmenter.get();
+	vstream.segmenter = segmenter.get();
+	astream.segmenter = segmenter.get();
+	if (telemetry) {
+		vstream.telemetry = telemetry.get();
+		astream.telemetry = telemetry.get();
+		telemetry->SetState(TelemetryState::Exporting);
 	}
 	LOG_EXIT_METHOD;
 }
@@ -30,11 +162,111 @@ Format::Format(
 void Format::Flush()
 {
 	LOG_ENTER_METHOD;
+	Flush(TelemetryState::Finished);
+	LOG_EXIT_METHOD;
+}
+
+void Format::Flush(TelemetryState final_state)
+{
+	LOG_ENTER_METHOD;
+	if (!context)
+		throw std::runtime_error("cannot flush cancelled export");
+	SVE_TRACE(flush_start);
+	if (telemetry)
+		telemetry->SetState(TelemetryState::Finalizing);
 	vstream.Transcode(nullptr);
 	astream.Transcode(nullptr);
-	int ret = av_write_trailer(context.get());
+	for (Stream* stream : { static_cast<Stream*>(&vstream), static_cast<Stream*>(&astream) }) {
+		if (stream->verifier) {
+			stream->verifier->Finish();
+			stream->verifier->Report();
+		}
+	}
+	interleaver->Flush();
+	interleaver->Report();
+	auto start = std::chrono::steady_clock::now();
+	int ret{ 0 };
+	if (segmenter)
+		segmenter->Flush();
+	else
+		ret = av_write_trailer(context.get());
+	SVE_TRACE(flush_end, ret);
 	if (ret < 0)
 		throw std::runtime_error(fmt::format("failed to write trailer: {}", AVErrorString(ret)));
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	LOG->info("trailer written in {:.3f} seconds", elapsed.count());
+	if (index)
+		index->Close();
+	if (output)
+		output->Report();
+	if (telemetry)
+		telemetry->SetState(final_state);
+	memory->Report();
 	LOG_EXIT_METHOD;
 }
 
+void Format::Cancel()
+{
+	LOG_ENTER_METHOD;
+	if (options.cancel == CancelMode::Flush) {
+		// readers must never see the export as finished
+		Flush(TelemetryState::Cancelled);
+		LOG_EXIT_METHOD;
+		return;
+	}
+	if (!context)
+		throw std::runtime_error("export already cancelled");
+	if (segmenter) {
+		// the template context has no file, the segmenter deletes or truncates the segments
+		segmenter->Cancel(options.cancel);
+		context = nullptr;
+		if (telemetry)
+			telemetry->SetState(TelemetryState::Cancelled);
+		memory->Report();
+		LOG_EXIT_METHOD;
+		return;
+	}
+	// write out what the muxer has already handed to the file, but leave the encoders and muxer queue as they are
+	// the matroska muxer assembles each cluster in memory and only writes it out once complete,
+	// so the data written so far ends at a cluster boundary
+	int64_t size{ -1 };
+	if (context->pb) {
+		avio_flush(context->pb);
+		size = avio_tell(context->pb);
+	}
+	// free the muxer, dropping its queued packets, and close the file without writing a trailer
+	// (the streams still refer to the context, but only through a weak pointer)
+	context = nullptr;
+	if (telemetry)
+		telemetry->SetState(TelemetryState::Cancelled);
+	std::error_code ec;
+	if (output) {
+		// the reader has whatever was written so far, there is nothing to delete or truncate
+		output->Report();
+		LOG->info("closed stream output {}", filename.string());
+	}
+	else if (options.cancel == CancelMode::Delete) {
+		std::filesystem::remove(filename, ec);
+		if (ec)
+			LOG->error("failed to delete {}: {}", filename.string(), ec.message());
+		else
+			LOG->info("deleted {}", filename.string());
+		if (index) {
+			interleaver->index = nullptr;
+			index = nullptr;
+			std::filesystem::remove(FrameIndexFilename(filename), ec);
+		}
+	}
+	else if (options.cancel == CancelMode::Truncate && size >= 0) {
+		std::filesystem::resize_file(filename, size, ec);
+		if (ec)
+			LOG->error("failed to truncate {}: {}", filename.string(), ec.message());
+		else
+			LOG->info("truncated {} to {} bytes", filename.string(), size);
+		// entries beyond the end of the file are harmless, readers can compare pos against the file size
+		if (index)
+			index->Close();
+	}
+	memory->Report();
+	LOG_EXIT_METHOD;
+}
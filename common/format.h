@@ -3,22 +3,47 @@
 #include "logger.h"
 #include "videostream.h"
 #include "audiostream.h"
+#include "interleaver.h"
+#include "options.h"
+#include "segmenter.h"
+#include "streamoutput.h"
+#include "telemetry.h"
 
 class Format
 {
+public:
+	const std::filesystem::path filename;
+
 private:
+	std::unique_ptr<StreamOutput> output; // nullptr if writing to a file, must outlive the context
 	std::shared_ptr<AVFormatContext> context;
 
+	// flush streams and write the footer, and publish the given final state
+	void Flush(TelemetryState final_state);
+
 public:
+	const FormatOptions options;
+	const std::unique_ptr<Telemetry> telemetry; // nullptr if disabled
+	const std::shared_ptr<MemoryAccount> memory;
+	std::unique_ptr<FrameIndexWriter> index; // nullptr if disabled
+	std::unique_ptr<Segmenter> segmenter; // nullptr unless the export is split into files
+	std::shared_ptr<Interleaver> interleaver; // producers should call interleaver->Wait before transcoding
 	VideoStream vstream;
 	AudioStream astream;
 
 	Format(
 		const std::filesystem::path& filename,
 		const AVCodec& vcodec, AVDictionaryPtr& voptions, int width, int height, const AVRational& frame_rate, AVPixelFormat pix_fmt,
-		const AVCodec& acodec, AVDictionaryPtr& aoptions, AVSampleFormat sample_fmt, int sample_rate, uint64_t channel_layout);
+		const AVCodec& acodec, AVDictionaryPtr& aoptions, AVSampleFormat sample_fmt, int sample_rate, uint64_t channel_layout,
+		const FormatOptions& options);
 
 	// flush streams and write the footer
+	// memory use is reported afterwards
 	void Flush();
+
+	// stop the export without draining the encoders, and delete or truncate the file according to the cancel option
+	// (or the segments, for a split export)
+	// the format cannot be used anymore afterwards, except to destroy it
+	void Cancel();
 };
 
@@ -0,0 +1,119 @@
+#include "frameindex.h"
+
+#include <cstring>
+
+const char frame_index_magic[8] = { 'S', 'V', 'E', 'I', 'D', 'X', '0', '1' };
+
+template <typename T>
+void WriteValue(std::ostream& os, T value)
+{
+	os.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+T ReadValue(std::istream& is)
+{
+	T value{ };
+	is.read(reinterpret_cast<char*>(&value), sizeof(value));
+	return value;
+}
+
+std::filesystem::path FrameIndexFilename(const std::filesystem::path& filename)
+{
+	auto index_filename{ filename };
+	index_filename += ".sveidx";
+	return index_filename;
+}
+
+FrameIndexWriter::FrameIndexWriter(const std::filesystem::path& filename, const AVFormatContext& format_context)
+	: os{ filename, std::ios::binary }
+	, filename{ filename }
+{
+	LOG_ENTER_METHOD;
+	if (os.fail())
+		throw std::runtime_error(fmt::format("failed to open index \"{}\"", filename.string()));
+	os.write(frame_index_magic, sizeof(frame_index_magic));
+	WriteValue<uint32_t>(os, format_context.nb_streams);
+	for (unsigned int i = 0; i < format_context.nb_streams; i++) {
+		auto stream = format_context.streams[i];
+		WriteValue<int32_t>(os, stream->codecpar->codec_type);
+		WriteValue<int32_t>(os, stream->time_base.num);
+		WriteValue<int32_t>(os, stream->time_base.den);
+	}
+	LOG_EXIT_METHOD;
+}
+
+void FrameIndexWriter::Add(const AVPacket& pkt, int64_t pos)
+{
+	WriteValue<uint8_t>(os, static_cast<uint8_t>(pkt.stream_index));
+	WriteValue<uint8_t>(os, (pkt.flags & AV_PKT_FLAG_KEY) ? 1 : 0);
+	WriteValue<int32_t>(os, pkt.size);
+	WriteValue<int64_t>(os, pkt.pts);
+	WriteValue<int64_t>(os, pkt.dts);
+	WriteValue<int64_t>(os, pos);
+}
+
+void FrameIndexWriter::Close()
+{
+	LOG_ENTER_METHOD;
+	os.close();
+	if (os.fail())
+		LOG->error("failed to write index \"{}\"", filename.string());
+	else
+		LOG->info("index written to \"{}\"", filename.string());
+	LOG_EXIT_METHOD;
+}
+
+std::vector<size_t> FrameIndexReader::IndexedStream::KeyFrames() const
+{
+	std::vector<size_t> keyframes;
+	for (size_t i = 0; i < entries.size(); i++)
+		if (entries[i].key)
+			keyframes.push_back(i);
+	return keyframes;
+}
+
+FrameIndexReader::FrameIndexReader(const std::filesystem::path& filename)
+	: filename{ filename }
+	, streams{ }
+{
+	LOG_ENTER_METHOD;
+	std::ifstream is{ filename, std::ios::binary };
+	if (is.fail())
+		throw std::runtime_error(fmt::format("failed to open index \"{}\"", filename.string()));
+	char magic[sizeof(frame_index_magic)] = { 0 };
+	is.read(magic, sizeof(magic));
+	if (is.fail() || std::memcmp(magic, frame_index_magic, sizeof(magic)) != 0)
+		throw std::runtime_error(fmt::format("\"{}\" is not an index", filename.string()));
+	streams.resize(ReadValue<uint32_t>(is));
+	for (auto& stream : streams) {
+		stream.type = static_cast<AVMediaType>(ReadValue<int32_t>(is));
+		stream.time_base.num = ReadValue<int32_t>(is);
+		stream.time_base.den = ReadValue<int32_t>(is);
+	}
+	while (true) {
+		auto stream_index = ReadValue<uint8_t>(is);
+		if (is.eof())
+			break;
+		FrameIndexEntry entry{ };
+		entry.key = ReadValue<uint8_t>(is) != 0;
+		entry.size = ReadValue<int32_t>(is);
+		entry.pts = ReadValue<int64_t>(is);
+		entry.dts = ReadValue<int64_t>(is);
+		entry.pos = ReadValue<int64_t>(is);
+		if (is.fail())
+			throw std::runtime_error(fmt::format("index \"{}\" is truncated", filename.string()));
+		if (stream_index >= streams.size())
+			throw std::runtime_error(fmt::format("index \"{}\" refers to stream {} which does not exist", filename.string(), stream_index));
+		streams[stream_index].entries.push_back(entry);
+	}
+	LOG_EXIT_METHOD;
+}
+
+int FrameIndexReader::FindStream(AVMediaType type) const
+{
+	for (size_t i = 0; i < streams.size(); i++)
+		if (streams[i].type == type)
+			return static_cast<int>(i);
+	return -1;
+}
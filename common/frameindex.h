@@ -0,0 +1,67 @@
+#pragma once
+
+#include "logger.h"
+
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+// One entry per packet of a stream, in the order in which the packets were written,
+// so the position of an entry within its stream is the frame (packet) number.
+struct FrameIndexEntry {
+	int64_t pts;  // in the stream time base
+	int64_t dts;  // in the stream time base
+	int64_t pos;  // byte offset at or before the packet data, from which a demuxer reaches the packet
+	              // (the start of the cluster or fragment for muxers that buffer them, such as mkv and fragmented mp4)
+	int32_t size; // bytes of packet data
+	bool key;     // keyframe
+};
+
+// Writes a sidecar index of all packets that are handed to the muxer.
+// The file starts with a magic string and the number of streams,
+// followed by the media type and time base of every stream,
+// followed by a 30 byte record (stream, flags, size, pts, dts, pos) per packet.
+class FrameIndexWriter {
+private:
+	std::ofstream os;
+
+public:
+	const std::filesystem::path filename;
+
+	// write the header, the stream time bases must be final (i.e. after the format header is written)
+	FrameIndexWriter(const std::filesystem::path& filename, const AVFormatContext& format_context);
+
+	// add the packet, pos is the output position before the packet is handed to the muxer
+	void Add(const AVPacket& pkt, int64_t pos);
+
+	// flush the index to disk
+	void Close();
+};
+
+// Reads a sidecar index written by FrameIndexWriter.
+class FrameIndexReader {
+public:
+	struct IndexedStream {
+		AVMediaType type{ AVMEDIA_TYPE_UNKNOWN };
+		AVRational time_base{ 0, 1 };
+		std::vector<FrameIndexEntry> entries{ };
+
+		// frame numbers of all keyframes
+		std::vector<size_t> KeyFrames() const;
+	};
+
+	const std::filesystem::path filename;
+	std::vector<IndexedStream> streams;
+
+	FrameIndexReader(const std::filesystem::path& filename);
+
+	// index of the first stream of the given type, or -1 if there is none
+	int FindStream(AVMediaType type) const;
+};
+
+// the sidecar index belonging to an export
+std::filesystem::path FrameIndexFilename(const std::filesystem::path& filename);
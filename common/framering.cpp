@@ -0,0 +1,377 @@
+#include "framering.h"
+#include "logger.h"
+#include "settings.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <signal.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+}
+
+#include "audiostream.h"
+#include "videostream.h"
+
+namespace {
+
+constexpr uint64_t ring_alignment = 64;
+
+constexpr uint64_t Align(uint64_t size)
+{
+	return (size + ring_alignment - 1) / ring_alignment * ring_alignment;
+}
+
+constexpr uint64_t HeaderSize()
+{
+	return Align(sizeof(FrameRingHeader));
+}
+
+constexpr uint64_t SlotStride(uint64_t slot_size)
+{
+	return Align(sizeof(FrameRingSlot)) + Align(slot_size);
+}
+
+#ifdef _WIN32
+void* CreateRingEvent(const std::string& name, const char* suffix)
+{
+	// auto reset, and shared with the other process by name
+	auto event_name = "Local\\" + name + suffix;
+	auto event = CreateEventA(nullptr, FALSE, FALSE, event_name.c_str());
+	if (!event)
+		throw std::runtime_error(fmt::format("failed to create event {}: {}", event_name, std::system_category().message(GetLastError())));
+	return event;
+}
+#endif
+
+}
+
+FrameRing::FrameRing(const std::string& name, const FrameRingFormat& format, uint32_t nb_slots, std::chrono::milliseconds timeout)
+	: memory{ nullptr }
+	, header{ nullptr }
+	, data_event{ nullptr }
+	, space_event{ nullptr }
+	, producer{ true }
+	, name{ name }
+	, timeout{ timeout }
+	, blocked{ 0 }
+	, nb_frames{ 0 }
+	, nb_bytes{ 0 }
+{
+	LOG_ENTER_METHOD;
+	if (nb_slots == 0)
+		throw std::invalid_argument("frame ring needs at least one slot");
+	auto video_size = av_image_get_buffer_size(format.pix_fmt, format.width, format.height, 1);
+	if (video_size < 0)
+		throw std::runtime_error(fmt::format("failed to get frame size: {}", AVErrorString(video_size)));
+	// audio arrives in small chunks, but make sure that a reasonable chunk always fits
+	auto audio_size = av_samples_get_buffer_size(
+		nullptr, av_get_channel_layout_nb_channels(format.channel_layout), 4096, format.sample_fmt, 1);
+	uint64_t slot_size = std::max<int64_t>(video_size, audio_size);
+	memory = std::make_unique<SharedMemory>(name, HeaderSize() + nb_slots * SlotStride(slot_size), true, true);
+	static_cast<FrameRingHeader*>(memory->Data())->magic.store(0);
+	header = new (memory->Data()) FrameRingHeader{};
+	header->format = format;
+	header->nb_slots = nb_slots;
+	header->slot_size = slot_size;
+	header->producer_pid.store(CurrentProcessId());
+#ifdef _WIN32
+	data_event = CreateRingEvent(name, "-data");
+	space_event = CreateRingEvent(name, "-space");
+#endif
+	header->magic.store(FrameRingHeader::magic_value, std::memory_order_release);
+	LOG->info("frame ring {}: {} slots of {:.1f} MB", name, nb_slots, slot_size / 1e6);
+	LOG_EXIT_METHOD;
+}
+
+FrameRing::FrameRing(const std::string& name, std::chrono::milliseconds timeout)
+	: memory{ nullptr }
+	, header{ nullptr }
+	, data_event{ nullptr }
+	, space_event{ nullptr }
+	, producer{ false }
+	, name{ name }
+	, timeout{ timeout }
+	, blocked{ 0 }
+	, nb_frames{ 0 }
+	, nb_bytes{ 0 }
+{
+	LOG_ENTER_METHOD;
+	// map the header first, to find out how large the whole ring is
+	uint64_t size{ 0 };
+	{
+		SharedMemory header_memory{ name, HeaderSize(), false, false };
+		auto ring_header = static_cast<const FrameRingHeader*>(header_memory.Data());
+		if (ring_header->magic.load(std::memory_order_acquire) != FrameRingHeader::magic_value || ring_header->version != FrameRingHeader::version_value)
+			throw std::runtime_error(fmt::format("frame ring {} is not initialized or has a different version", name));
+		size = HeaderSize() + ring_header->nb_slots * SlotStride(ring_header->slot_size);
+	}
+	memory = std::make_unique<SharedMemory>(name, size, false, true);
+	header = static_cast<FrameRingHeader*>(memory->Data());
+	// the name is no longer needed once both sides have the ring mapped
+	memory->Unlink();
+#ifdef _WIN32
+	data_event = CreateRingEvent(name, "-data");
+	space_event = CreateRingEvent(name, "-space");
+#endif
+	header->consumer_pid.store(CurrentProcessId());
+	LOG_EXIT_METHOD;
+}
+
+FrameRing::~FrameRing()
+{
+	LOG_ENTER_METHOD;
+	if (producer) {
+		try {
+			if (State() == FrameRingState::Open)
+				Close(FrameRingState::Cancelled);
+		}
+		LOG_CATCH;
+		// nobody will ever open it
+		if (header->consumer_pid.load() == 0)
+			memory->Unlink();
+	}
+#ifdef _WIN32
+	CloseHandle(data_event);
+	CloseHandle(space_event);
+#endif
+	LOG_EXIT_METHOD;
+}
+
+const FrameRingFormat& FrameRing::Format() const
+{
+	return header->format;
+}
+
+FrameRingState FrameRing::State() const
+{
+	return header->state.load(std::memory_order_acquire);
+}
+
+FrameRingSlot& FrameRing::Slot(uint64_t index) const
+{
+	auto offset = HeaderSize() + (index % header->nb_slots) * SlotStride(header->slot_size);
+	return *reinterpret_cast<FrameRingSlot*>(static_cast<uint8_t*>(memory->Data()) + offset);
+}
+
+uint8_t* FrameRing::SlotData(uint64_t index) const
+{
+	return reinterpret_cast<uint8_t*>(&Slot(index)) + Align(sizeof(FrameRingSlot));
+}
+
+void FrameRing::Notify(std::atomic<uint32_t>& seq, void* event)
+{
+	seq.fetch_add(1, std::memory_order_release);
+#ifdef _WIN32
+	SetEvent(event);
+#elif defined(__linux__)
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(&seq), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+}
+
+bool FrameRing::Wait(std::atomic<uint32_t>& seq, uint32_t old, void* event, std::chrono::milliseconds wait_timeout)
+{
+	if (seq.load(std::memory_order_acquire) != old)
+		return true;
+#ifdef _WIN32
+	// a notification between the check above and the wait leaves the event set, so it is not lost
+	WaitForSingleObject(event, static_cast<DWORD>(wait_timeout.count()));
+#elif defined(__linux__)
+	timespec ts{ };
+	ts.tv_sec = wait_timeout.count() / 1000;
+	ts.tv_nsec = (wait_timeout.count() % 1000) * 1000000;
+	// returns immediately if seq no longer holds old
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(&seq), FUTEX_WAIT, old, &ts, nullptr, 0);
+#else
+	std::this_thread::sleep_for(std::chrono::milliseconds(1));
+#endif
+	return seq.load(std::memory_order_acquire) != old;
+}
+
+FrameRingSlot& FrameRing::Reserve()
+{
+	auto head = header->head.load(std::memory_order_relaxed);
+	if (head - header->tail.load(std::memory_order_acquire) < header->nb_slots)
+		return Slot(head);
+	auto start = std::chrono::steady_clock::now();
+	while (true) {
+		auto seq = header->space_seq.load(std::memory_order_acquire);
+		if (head - header->tail.load(std::memory_order_acquire) < header->nb_slots)
+			break;
+		if (!Wait(header->space_seq, seq, space_event, timeout)) {
+			auto consumer_pid = header->consumer_pid.load();
+			if (consumer_pid != 0 && !ProcessAlive(consumer_pid))
+				throw FrameRingError(fmt::format("frame ring {}: consumer is gone", name));
+			if (consumer_pid == 0 && std::chrono::steady_clock::now() - start > 10 * timeout)
+				throw FrameRingError(fmt::format("frame ring {}: consumer did not start", name));
+		}
+	}
+	blocked += std::chrono::steady_clock::now() - start;
+	return Slot(head);
+}
+
+void FrameRing::Publish()
+{
+	header->head.fetch_add(1, std::memory_order_release);
+	Notify(header->data_seq, data_event);
+}
+
+void FrameRing::WriteVideo(const AVFrame& frame)
+{
+	LOG_ENTER_METHOD;
+	const auto& format = header->format;
+	if (frame.width != format.width || frame.height != format.height || frame.format != format.pix_fmt)
+		throw std::invalid_argument("video frame does not match frame ring format");
+	auto& slot = Reserve();
+	auto data = SlotData(header->head.load(std::memory_order_relaxed));
+	uint8_t* dst_data[4]{ };
+	int dst_linesize[4]{ };
+	auto size = av_image_fill_arrays(dst_data, dst_linesize, data, format.pix_fmt, format.width, format.height, 1);
+	if (size < 0)
+		throw std::runtime_error(fmt::format("failed to fill frame ring planes: {}", AVErrorString(size)));
+	auto desc = av_pix_fmt_desc_get(format.pix_fmt);
+	for (int i = 0; i < 4 && dst_data[i]; i++) {
+		int height = (i == 1 || i == 2) ? AV_CEIL_RSHIFT(format.height, desc->log2_chroma_h) : format.height;
+		// frames from the game have no padding, so every plane is a single copy
+		if (frame.linesize[i] == dst_linesize[i])
+			std::memcpy(dst_data[i], frame.data[i], size_t(height) * dst_linesize[i]);
+		else
+			av_image_copy_plane(dst_data[i], dst_linesize[i], frame.data[i], frame.linesize[i], dst_linesize[i], height);
+	}
+	slot.type = AVMEDIA_TYPE_VIDEO;
+	slot.nb_samples = 0;
+	slot.size = size;
+	Publish();
+	nb_frames++;
+	nb_bytes += size;
+	LOG_EXIT_METHOD;
+}
+
+void FrameRing::WriteAudio(const AVFrame& frame)
+{
+	LOG_ENTER_METHOD;
+	const auto& format = header->format;
+	if (frame.format != format.sample_fmt || frame.sample_rate != format.sample_rate || frame.channel_layout != format.channel_layout)
+		throw std::invalid_argument("audio frame does not match frame ring format");
+	auto channels = av_get_channel_layout_nb_channels(format.channel_layout);
+	auto planar = av_sample_fmt_is_planar(format.sample_fmt);
+	auto bytes_per_sample = av_get_bytes_per_sample(format.sample_fmt);
+	int max_samples = static_cast<int>(header->slot_size / (int64_t{ channels } * bytes_per_sample));
+	for (int offset = 0; offset < frame.nb_samples; offset += max_samples) {
+		int nb_samples = std::min(max_samples, frame.nb_samples - offset);
+		auto& slot = Reserve();
+		auto data = SlotData(header->head.load(std::memory_order_relaxed));
+		if (planar) {
+			auto plane_size = size_t(nb_samples) * bytes_per_sample;
+			for (int c = 0; c < channels; c++)
+				std::memcpy(data + c * plane_size, frame.extended_data[c] + size_t(offset) * bytes_per_sample, plane_size);
+		}
+		else {
+			std::memcpy(data, frame.data[0] + size_t(offset) * channels * bytes_per_sample, size_t(nb_samples) * channels * bytes_per_sample);
+		}
+		slot.type = AVMEDIA_TYPE_AUDIO;
+		slot.nb_samples = nb_samples;
+		slot.size = uint64_t{ size_t(nb_samples) } * channels * bytes_per_sample;
+		Publish();
+		nb_bytes += slot.size;
+	}
+	LOG_EXIT_METHOD;
+}
+
+void FrameRing::Close(FrameRingState state)
+{
+	LOG_ENTER_METHOD;
+	if (state == FrameRingState::Finished) {
+		auto start = std::chrono::steady_clock::now();
+		while (header->consumer_pid.load() == 0 && std::chrono::steady_clock::now() - start < 10 * timeout)
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		if (header->consumer_pid.load() == 0)
+			LOG->error("frame ring {}: consumer did not start, export is lost", name);
+	}
+	header->state.store(state, std::memory_order_release);
+	Notify(header->data_seq, data_event);
+	LOG->info(
+		"frame ring {} closed: {} frames, {:.1f} MB, producer blocked for {:.3f} seconds",
+		name, nb_frames, nb_bytes / 1e6, std::chrono::duration<double>(blocked).count());
+	LOG_EXIT_METHOD;
+}
+
+AVFramePtr FrameRing::Front(AVMediaType& type)
+{
+	auto tail = header->tail.load(std::memory_order_relaxed);
+	auto seq = header->data_seq.load(std::memory_order_acquire);
+	if (tail == header->head.load(std::memory_order_acquire)) {
+		if (State() != FrameRingState::Open) {
+			// the producer publishes its last frames before it closes the ring,
+			// so once the state is seen, so are they, but the head read above may predate them
+			if (tail == header->head.load(std::memory_order_acquire))
+				return nullptr;
+		}
+		else {
+			Wait(header->data_seq, seq, data_event, timeout);
+			if (tail == header->head.load(std::memory_order_acquire))
+				return nullptr;
+		}
+	}
+	const auto& format = header->format;
+	const auto& slot = Slot(tail);
+	type = slot.type;
+	if (slot.type == AVMEDIA_TYPE_VIDEO)
+		return CreateVideoFrame(format.width, format.height, format.pix_fmt, SlotData(tail));
+	return CreateAudioFrame(format.sample_fmt, format.sample_rate, format.channel_layout, slot.nb_samples, SlotData(tail));
+}
+
+void FrameRing::Pop()
+{
+	header->tail.fetch_add(1, std::memory_order_release);
+	Notify(header->space_seq, space_event);
+}
+
+bool FrameRing::ProducerAlive() const
+{
+	return ProcessAlive(header->producer_pid.load());
+}
+
+std::string FrameRingName()
+{
+	static std::atomic<int> counter{ 0 };
+	return fmt::format("{}-ring-{}-{}", SCRIPT_NAME, CurrentProcessId(), counter++);
+}
+
+int64_t CurrentProcessId()
+{
+#ifdef _WIN32
+	return GetCurrentProcessId();
+#else
+	return getpid();
+#endif
+}
+
+bool ProcessAlive(int64_t pid)
+{
+#ifdef _WIN32
+	auto process = OpenProcess(SYNCHRONIZE, FALSE, static_cast<DWORD>(pid));
+	if (!process)
+		return false;
+	auto alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+	CloseHandle(process);
+	return alive;
+#else
+	return kill(static_cast<pid_t>(pid), 0) == 0 || errno == EPERM;
+#endif
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "avcreate.h"
+#include "sharedmemory.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+#include <libavutil/samplefmt.h>
+}
+
+// thrown when the other side of the ring is gone
+class FrameRingError : public std::runtime_error {
+public:
+	using std::runtime_error::runtime_error;
+};
+
+enum class FrameRingState : uint32_t {
+	Open,      // producer is still writing frames
+	Finished,  // all frames are written, the export should be finalized
+	Cancelled, // the export should be cancelled
+};
+
+// parameters of the export, set by the producer when the ring is created
+struct FrameRingFormat {
+	int32_t width{ 0 };
+	int32_t height{ 0 };
+	AVPixelFormat pix_fmt{ AV_PIX_FMT_NONE };
+	AVRational frame_rate{ 0, 1 };
+	AVSampleFormat sample_fmt{ AV_SAMPLE_FMT_NONE };
+	int32_t sample_rate{ 0 };
+	uint64_t channel_layout{ 0 };
+	char filename[1024]{ }; // utf-8, zero terminated
+};
+
+// header of every slot, followed by the frame data, planes packed without padding
+struct FrameRingSlot {
+	AVMediaType type{ AVMEDIA_TYPE_UNKNOWN };
+	int32_t nb_samples{ 0 }; // audio only
+	uint64_t size{ 0 };      // bytes of frame data
+};
+
+// layout of the start of the shared memory block, the slots follow
+struct FrameRingHeader {
+	static constexpr uint32_t magic_value = 0x52455653; // "SVER"
+	static constexpr uint32_t version_value = 1;
+	std::atomic<uint32_t> magic{ 0 }; // set last, once the header is initialized
+	uint32_t version{ version_value };
+	FrameRingFormat format{ };
+	uint32_t nb_slots{ 0 };
+	uint64_t slot_size{ 0 };                // bytes of frame data that fit in a slot
+	std::atomic<uint64_t> head{ 0 };        // slots published by the producer
+	std::atomic<uint64_t> tail{ 0 };        // slots released by the consumer
+	std::atomic<uint32_t> data_seq{ 0 };    // bumped on every publish and state change, the consumer waits on it
+	std::atomic<uint32_t> space_seq{ 0 };   // bumped on every release, the producer waits on it
+	std::atomic<FrameRingState> state{ FrameRingState::Open };
+	std::atomic<int64_t> producer_pid{ 0 };
+	std::atomic<int64_t> consumer_pid{ 0 }; // 0 until the consumer has opened the ring
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "frame ring requires lock free 32 bit atomics");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "frame ring requires lock free 64 bit atomics");
+
+// A single producer, single consumer ring of raw frames in shared memory,
+// for handing frames from the game to an encoder in another process.
+// The producer copies every frame into a slot with one memcpy per plane, and the consumer
+// wraps the slot in a frame without copying. Waiting uses a futex on the sequence counters
+// on linux, and a pair of named events on windows, so neither side spins.
+// If a side has to wait for longer than its timeout, it checks whether the other process is still alive.
+class FrameRing {
+private:
+	std::unique_ptr<SharedMemory> memory;
+	FrameRingHeader* header;
+	void* data_event;  // windows only, nullptr elsewhere
+	void* space_event; // windows only, nullptr elsewhere
+	const bool producer;
+
+	FrameRingSlot& Slot(uint64_t index) const;
+	uint8_t* SlotData(uint64_t index) const;
+
+	// increment the sequence and wake the other side
+	void Notify(std::atomic<uint32_t>& seq, void* event);
+
+	// wait until the sequence differs from old, returns false on timeout
+	bool Wait(std::atomic<uint32_t>& seq, uint32_t old, void* event, std::chrono::milliseconds timeout);
+
+	// wait for a free slot, throws if the consumer is gone or never showed up
+	FrameRingSlot& Reserve();
+
+	// make the reserved slot visible to the consumer
+	void Publish();
+
+public:
+	const std::string name;
+	const std::chrono::milliseconds timeout;
+
+	// producer statistics
+	std::chrono::nanoseconds blocked; // time spent waiting for a free slot
+	int64_t nb_frames;                // frames written
+	int64_t nb_bytes;                 // bytes written
+
+	// create the ring, with slots large enough for a video frame of the format
+	FrameRing(const std::string& name, const FrameRingFormat& format, uint32_t nb_slots, std::chrono::milliseconds timeout);
+
+	// open an existing ring as consumer
+	FrameRing(const std::string& name, std::chrono::milliseconds timeout);
+
+	// the producer cancels the ring if it was not closed
+	~FrameRing();
+	FrameRing(const FrameRing&) = delete;
+	FrameRing& operator=(const FrameRing&) = delete;
+
+	const FrameRingFormat& Format() const;
+	FrameRingState State() const;
+
+	// producer side
+	void WriteVideo(const AVFrame& frame);
+	void WriteAudio(const AVFrame& frame); // split over several slots if needed
+	// on Finished, wait (up to ten times the timeout) for a consumer to have opened the ring, so no frames are lost
+	void Close(FrameRingState state);
+
+	// consumer side
+	// frame wrapping the oldest slot, or nullptr if none arrived within the timeout
+	// the frame is valid until Pop
+	AVFramePtr Front(AVMediaType& type);
+	void Pop();
+	bool ProducerAlive() const;
+};
+
+// unique name for a new ring of this process
+std::string FrameRingName();
+
+int64_t CurrentProcessId();
+
+// whether the process with the given id is still running
+bool ProcessAlive(int64_t pid);
@@ -0,0 +1,161 @@
+#include "interleaver.h"
+
+#include <algorithm>
+#include <limits>
+
+Interleaver::Interleaver(std::shared_ptr<AVFormatContext>& format_context, const InterleaveOptions& options)
+	: mutex{ }
+	, cond{ }
+	, owner{ format_context }
+	, queues(format_context->nb_streams)
+	, last_dts(format_context->nb_streams, std::numeric_limits<int64_t>::min())
+	, blocked(format_context->nb_streams)
+	, bytes{ 0 }
+	, max_bytes_seen{ 0 }
+	, max_skew_seen{ 0.0 }
+	, options{ options }
+	, index{ nullptr }
+	, segmenter{ nullptr }
+{
+	LOG_ENTER_METHOD;
+	LOG_EXIT_METHOD;
+}
+
+double Interleaver::Ahead(size_t index) const
+{
+	// streams without packets count as being at the start
+	auto dts = std::max<int64_t>(last_dts[index], 0);
+	auto slowest = dts;
+	for (auto other : last_dts)
+		slowest = std::min(slowest, std::max<int64_t>(other, 0));
+	return (dts - slowest) / static_cast<double>(AV_TIME_BASE);
+}
+
+bool Interleaver::MustWait(size_t index) const
+{
+	auto ahead = Ahead(index);
+	return ahead > 0.0 && (ahead > options.max_skew || (options.max_memory > 0 && bytes > options.max_memory));
+}
+
+void Interleaver::Release(bool flush)
+{
+	LOG_ENTER_METHOD;
+	auto format_context = owner.lock();
+	if (!format_context)
+		throw std::runtime_error("failed to lock format context");
+	auto safe_dts = *std::min_element(last_dts.begin(), last_dts.end());
+	while (true) {
+		// queue whose first packet has the smallest dts
+		std::deque<Queued>* next = nullptr;
+		for (auto& queue : queues)
+			if (!queue.empty() && (!next || queue.front().dts < next->front().dts))
+				next = &queue;
+		if (!next || (!flush && next->front().dts > safe_dts))
+			break;
+		auto pkt = std::move(next->front().pkt);
+		next->pop_front();
+		bytes -= pkt->size;
+		Mux(*format_context, *pkt);
+	}
+	cond.notify_all();
+	LOG_EXIT_METHOD;
+}
+
+void Interleaver::Mux(AVFormatContext& format_context, AVPacket& pkt)
+{
+	LOG_ENTER_METHOD;
+	if (segmenter) {
+		segmenter->Write(pkt);
+		LOG_EXIT_METHOD;
+		return;
+	}
+	// nothing of this packet can be in the file before the current position,
+	// as the packets are already in order, and so go straight to the muxer without being queued in it
+	if (index)
+		index->Add(pkt, format_context.pb ? avio_tell(format_context.pb) : -1);
+	int ret = av_write_frame(&format_context, &pkt);
+	if (ret < 0)
+		throw std::runtime_error(fmt::format("failed to write packet to stream: {}", AVErrorString(ret)));
+	LOG_EXIT_METHOD;
+}
+
+void Interleaver::Write(AVPacket& pkt)
+{
+	LOG_ENTER_METHOD;
+	std::lock_guard<std::mutex> lock(mutex);
+	auto format_context = owner.lock();
+	if (!format_context)
+		throw std::runtime_error("failed to lock format context");
+	auto index = static_cast<size_t>(pkt.stream_index);
+	if (index >= queues.size())
+		throw std::invalid_argument(fmt::format("stream index {} out of range", pkt.stream_index));
+	auto dts = (pkt.dts != AV_NOPTS_VALUE) ? pkt.dts : pkt.pts;
+	if (dts == AV_NOPTS_VALUE) {
+		// nothing to interleave by, leave it to the muxer
+		Mux(*format_context, pkt);
+		LOG_EXIT_METHOD;
+		return;
+	}
+	dts = av_rescale_q(dts, format_context->streams[index]->time_base, AV_TIME_BASE_Q);
+	auto queued = CreateAVPacket();
+	av_packet_move_ref(queued.get(), &pkt);
+	bytes += queued->size;
+	max_bytes_seen = std::max(max_bytes_seen, bytes);
+	queues[index].push_back({ std::move(queued), dts });
+	last_dts[index] = std::max(last_dts[index], dts);
+	max_skew_seen = std::max(max_skew_seen, Ahead(index));
+	Release(false);
+	LOG_EXIT_METHOD;
+}
+
+void Interleaver::Wait(int stream_index)
+{
+	LOG_ENTER_METHOD;
+	std::unique_lock<std::mutex> lock(mutex);
+	auto index = static_cast<size_t>(stream_index);
+	if (index < queues.size() && MustWait(index)) {
+		auto start = std::chrono::steady_clock::now();
+		cond.wait_for(lock, options.max_wait, [&] { return !MustWait(index); });
+		blocked[index] += std::chrono::steady_clock::now() - start;
+	}
+	LOG_EXIT_METHOD;
+}
+
+void Interleaver::Flush()
+{
+	LOG_ENTER_METHOD;
+	std::lock_guard<std::mutex> lock(mutex);
+	Release(true);
+	LOG_EXIT_METHOD;
+}
+
+double Interleaver::Skew() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto skew{ 0.0 };
+	for (size_t i = 0; i < last_dts.size(); i++)
+		skew = std::max(skew, Ahead(i));
+	return skew;
+}
+
+double Interleaver::MaxSkew() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return max_skew_seen;
+}
+
+int64_t Interleaver::MaxBytes() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return max_bytes_seen;
+}
+
+void Interleaver::Report() const
+{
+	LOG_ENTER_METHOD;
+	std::lock_guard<std::mutex> lock(mutex);
+	LOG->info("interleaver: maximum skew {:.3f} seconds, maximum queue {:.1f} MB", max_skew_seen, max_bytes_seen / 1e6);
+	for (size_t i = 0; i < blocked.size(); i++)
+		LOG->info("interleaver: stream {} held back for {:.3f} seconds", i, blocked[i].count());
+	LOG_EXIT_METHOD;
+}
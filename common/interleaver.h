@@ -0,0 +1,79 @@
+#pragma once
+
+#include "logger.h"
+#include "avcreate.h"
+#include "frameindex.h"
+#include "options.h"
+#include "segmenter.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// Interleaves the packets of all streams in dts order before they reach the muxer,
+// so the muxer itself never has to buffer more than a packet per stream.
+// A packet is released once every other stream has reached its dts.
+// The queue does not block writers, as they hold the format lock;
+// instead, producers call Wait before taking that lock, which holds back a stream
+// that runs too far ahead of the others, or that keeps too much memory queued.
+// Usage:
+// * Create the interleaver after all streams have been added to the format context.
+// * Write packets (with timestamps in the stream time base).
+// * Call Flush before writing the trailer.
+class Interleaver {
+private:
+	struct Queued {
+		AVPacketPtr pkt;
+		int64_t dts; // in AV_TIME_BASE units
+	};
+
+	mutable std::mutex mutex;
+	std::condition_variable cond;
+	std::weak_ptr<AVFormatContext> owner;
+	std::vector<std::deque<Queued>> queues;
+	std::vector<int64_t> last_dts; // latest dts of each stream, INT64_MIN if none yet
+	std::vector<std::chrono::duration<double>> blocked; // time each stream was held back
+	int64_t bytes;
+	int64_t max_bytes_seen;
+	double max_skew_seen;
+
+	// write all packets that are safe to write, or all packets if flushing
+	void Release(bool flush);
+
+	// hand the packet to the muxer
+	void Mux(AVFormatContext& format_context, AVPacket& pkt);
+
+	// seconds that the stream is ahead of the slowest stream
+	double Ahead(size_t index) const;
+
+	bool MustWait(size_t index) const;
+
+public:
+	const InterleaveOptions options;
+	FrameIndexWriter* index; // sidecar index of all packets, or nullptr
+	Segmenter* segmenter;    // splits the export into files, or nullptr to write to the format context
+
+	Interleaver(std::shared_ptr<AVFormatContext>& format_context, const InterleaveOptions& options);
+
+	// queue the packet (taking over its reference) and write out all packets that are safe to write
+	void Write(AVPacket& pkt);
+
+	// hold back the producer of the stream while it is too far ahead, for at most options.max_wait
+	// must not be called while holding a lock that other producers need
+	void Wait(int stream_index);
+
+	// write all queued packets
+	void Flush();
+
+	// seconds between the fastest and the slowest stream
+	double Skew() const;
+
+	// largest skew, in seconds, and largest queue, in bytes, so far
+	double MaxSkew() const;
+	int64_t MaxBytes() const;
+
+	// log skew, queue size, and blocked time
+	void Report() const;
+};
@@ -0,0 +1,127 @@
+#include "memory.h"
+#include "logger.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <fstream>
+#include <string>
+#endif
+
+const char* MemoryStageName(MemoryStage stage)
+{
+	switch (stage) {
+	case MemoryStage::Frames:
+		return "frames";
+	case MemoryStage::Fifo:
+		return "fifo";
+	case MemoryStage::Encoder:
+		return "encoder";
+	case MemoryStage::Muxer:
+		return "muxer";
+	case MemoryStage::Verifier:
+		return "verifier";
+	default:
+		return "unknown";
+	}
+}
+
+MemoryAccount::MemoryAccount(int64_t limit)
+	: current{ }
+	, peak{ }
+	, total{ 0 }
+	, total_peak{ 0 }
+	, limit{ limit }
+{
+	for (size_t i = 0; i < nb_memory_stages; i++) {
+		current[i] = 0;
+		peak[i] = 0;
+	}
+}
+
+void MemoryAccount::UpdatePeak(std::atomic<int64_t>& value_peak, int64_t value)
+{
+	auto old_peak = value_peak.load(std::memory_order_relaxed);
+	while (value > old_peak && !value_peak.compare_exchange_weak(old_peak, value, std::memory_order_relaxed));
+}
+
+void MemoryAccount::Add(MemoryStage stage, int64_t bytes)
+{
+	auto i = static_cast<size_t>(stage);
+	UpdatePeak(peak[i], current[i].fetch_add(bytes, std::memory_order_relaxed) + bytes);
+	UpdatePeak(total_peak, total.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+}
+
+void MemoryAccount::Set(MemoryStage stage, int64_t bytes)
+{
+	auto i = static_cast<size_t>(stage);
+	Add(stage, bytes - current[i].load(std::memory_order_relaxed));
+}
+
+int64_t MemoryAccount::Current(MemoryStage stage) const
+{
+	return current[static_cast<size_t>(stage)].load(std::memory_order_relaxed);
+}
+
+int64_t MemoryAccount::Peak(MemoryStage stage) const
+{
+	return peak[static_cast<size_t>(stage)].load(std::memory_order_relaxed);
+}
+
+int64_t MemoryAccount::Total() const
+{
+	return total.load(std::memory_order_relaxed);
+}
+
+int64_t MemoryAccount::TotalPeak() const
+{
+	return total_peak.load(std::memory_order_relaxed);
+}
+
+void MemoryAccount::Check() const
+{
+	auto bytes = Total();
+	if (limit > 0 && bytes > limit)
+		throw MemoryLimitError(fmt::format(
+			"export uses {:.1f} MB, more than the limit of {:.1f} MB", bytes / 1e6, limit / 1e6));
+}
+
+void MemoryAccount::Report() const
+{
+	LOG_ENTER_METHOD;
+	for (size_t i = 0; i < nb_memory_stages; i++) {
+		auto stage = static_cast<MemoryStage>(i);
+		LOG->info("memory {}: {:.1f} MB (peak {:.1f} MB)", MemoryStageName(stage), Current(stage) / 1e6, Peak(stage) / 1e6);
+	}
+	LOG->info("memory total: {:.1f} MB (peak {:.1f} MB)", Total() / 1e6, TotalPeak() / 1e6);
+	auto process = GetProcessMemory();
+	LOG->info("memory process: {:.1f} MB (peak {:.1f} MB)", process.current / 1e6, process.peak / 1e6);
+	LOG_EXIT_METHOD;
+}
+
+ProcessMemory GetProcessMemory()
+{
+	ProcessMemory memory{ };
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS_EX counters{ };
+	if (GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&counters), sizeof(counters))) {
+		memory.current = counters.PrivateUsage;
+		memory.peak = counters.PeakPagefileUsage;
+	}
+#else
+	// values are in kB
+	std::ifstream is{ "/proc/self/status" };
+	std::string key;
+	int64_t value{ 0 };
+	std::string unit;
+	while (is >> key) {
+		if (key == "VmRSS:" && is >> value >> unit)
+			memory.current = value * 1024;
+		else if (key == "VmHWM:" && is >> value >> unit)
+			memory.peak = value * 1024;
+	}
+#endif
+	return memory;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+
+// parts of the export pipeline to which memory is attributed
+enum class MemoryStage {
+	Frames,  // frame buffers owned by the streams
+	Fifo,    // audio fifo, measured from its allocated size
+	Encoder, // frames queued in the encoder (lookahead and delay), estimated from the frame size
+	Muxer,   // packets handed to the muxer and not yet released by it
+	Verifier, // packets waiting for, or held by, the decoders that verify the export
+};
+
+constexpr size_t nb_memory_stages = 5;
+
+const char* MemoryStageName(MemoryStage stage);
+
+// thrown when an export exceeds its memory limit
+class MemoryLimitError : public std::runtime_error {
+public:
+	using std::runtime_error::runtime_error;
+};
+
+// Current and peak memory use of an export, per stage.
+// Updates are lock free, so the account can be shared by the streams and by buffers that outlive them.
+class MemoryAccount {
+private:
+	std::array<std::atomic<int64_t>, nb_memory_stages> current;
+	std::array<std::atomic<int64_t>, nb_memory_stages> peak;
+	std::atomic<int64_t> total;
+	std::atomic<int64_t> total_peak;
+
+	void UpdatePeak(std::atomic<int64_t>& value_peak, int64_t value);
+
+public:
+	const int64_t limit; // bytes, 0 means no limit
+
+	MemoryAccount(int64_t limit);
+
+	// add bytes (or release them, if negative) to the stage
+	void Add(MemoryStage stage, int64_t bytes);
+
+	// set the bytes of a stage that is measured rather than counted
+	void Set(MemoryStage stage, int64_t bytes);
+
+	int64_t Current(MemoryStage stage) const;
+	int64_t Peak(MemoryStage stage) const;
+	int64_t Total() const;
+	int64_t TotalPeak() const;
+
+	// throw MemoryLimitError if the total exceeds the limit
+	void Check() const;
+
+	// log current and peak use of all stages, and of the process
+	void Report() const;
+};
+
+// memory of the whole process: private bytes on windows, resident set on linux
+struct ProcessMemory {
+	int64_t current{ 0 };
+	int64_t peak{ 0 };
+};
+
+ProcessMemory GetProcessMemory();
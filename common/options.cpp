@@ -0,0 +1,62 @@
+#include "options.h"
+
+#include <string>
+
+std::istream& operator >> (std::istream& is, CancelMode& value)
+{
+	std::string value_str;
+	is >> value_str;
+	if (value_str == "flush") {
+		value = CancelMode::Flush;
+	}
+	else if (value_str == "delete") {
+		value = CancelMode::Delete;
+	}
+	else if (value_str == "truncate") {
+		value = CancelMode::Truncate;
+	}
+	else {
+		is.setstate(std::ios::failbit);
+	}
+	return is;
+}
+
+std::istream& operator >> (std::istream& is, ResamplerEngine& value)
+{
+	std::string value_str;
+	is >> value_str;
+	if (value_str == "swr") {
+		value = ResamplerEngine::Swr;
+	}
+	else if (value_str == "soxr") {
+		value = ResamplerEngine::Soxr;
+	}
+	else {
+		is.setstate(std::ios::failbit);
+	}
+	return is;
+}
+
+bool SetResamplerTier(const std::string& tier, ResamplerOptions& options)
+{
+	if (tier == "fast") {
+		options.engine = ResamplerEngine::Swr;
+		options.filter_size = 8;
+	}
+	else if (tier == "default") {
+		options.engine = ResamplerEngine::Swr;
+		options.filter_size = 32;
+	}
+	else if (tier == "high") {
+		options.engine = ResamplerEngine::Soxr;
+		options.precision = 20;
+	}
+	else if (tier == "best") {
+		options.engine = ResamplerEngine::Soxr;
+		options.precision = 28;
+	}
+	else {
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "threadpolicy.h"
+
+#include <chrono>
+#include <istream>
+#include <string>
+
+// what to do with the output file when an export is cancelled
+enum class CancelMode {
+	Flush,    // drain the encoders and write the trailer, as for a finished export
+	Delete,   // abandon the encoders and delete the file
+	Truncate, // abandon the encoders and keep what has been written so far
+};
+
+// parse CancelMode
+std::istream& operator >> (std::istream& is, CancelMode& value);
+
+// engine that converts the sample rate
+enum class ResamplerEngine {
+	Swr,  // polyphase filter of libswresample
+	Soxr, // libsoxr, only if ffmpeg was built with it (falls back on swr otherwise)
+};
+
+// parse ResamplerEngine
+std::istream& operator >> (std::istream& is, ResamplerEngine& value);
+
+// audio resampling (set per preset)
+// the filter settings only matter if the sample rate changes, the dither also if the bit depth is reduced
+struct ResamplerOptions {
+	ResamplerEngine engine{ ResamplerEngine::Swr };
+	int filter_size{ 32 };        // swr: filter length, longer is slower but has less aliasing
+	int precision{ 20 };          // soxr: bits of precision, from 15 to 33
+	std::string dither{ "none" }; // dither method, such as triangular or shibata, or none
+};
+
+// set engine, filter size, and precision for a quality tier: fast, default, high, or best
+// returns false if the tier is unknown
+bool SetResamplerTier(const std::string& tier, ResamplerOptions& options);
+
+// regions of interest for the parts of the frame that do not change
+struct StaticRegionOptions {
+	bool enable{ false };
+	int threshold{ 2 };     // mean absolute difference per pixel above which a 16x16 block has changed
+	double qoffset{ 0.2 };  // quantizer offset of static blocks, from -1 to 1, positive means fewer bits
+};
+
+// split the export into files of a fixed duration or size, 0 means no limit
+struct SegmentOptions {
+	double duration{ 0.0 }; // seconds
+	int64_t size{ 0 };      // bytes
+};
+
+// limits of the interleaving queue in front of the muxer
+struct InterleaveOptions {
+	double max_skew{ 2.0 };          // seconds that a stream may run ahead of the slowest stream
+	int64_t max_memory{ 256000000 }; // bytes of queued packets, 0 means no limit
+	std::chrono::milliseconds max_wait{ 100 }; // longest time a producer is held back per frame
+};
+
+// streaming output, written so the file is readable at any time and needs little work at the end
+struct StreamingOptions {
+	bool enable{ false };
+	double fragment_duration{ 2.0 }; // seconds per mp4 fragment or mkv cluster
+	int64_t index_space{ 1000000 };  // bytes reserved for the mkv index at the start of the file
+};
+
+// output to a pipe or socket rather than to a file
+struct StreamOutputOptions {
+	bool enable{ false };
+	std::string container{ }; // muxer name, as it cannot be guessed from the destination
+};
+
+// export options which do not depend on the codecs
+struct FormatOptions {
+	// placement, priority, and number of threads
+	ThreadPolicies threads{};
+	// what to do when the export is cancelled
+	CancelMode cancel{ CancelMode::Delete };
+	// name of the shared memory block where progress is published, empty to disable
+	std::string telemetry{ };
+	// bytes the export may use before it fails, 0 means no limit
+	int64_t memory_limit{ 0 };
+	// interleaving of the streams before they reach the muxer
+	InterleaveOptions interleave{ };
+	// container layout (set per preset)
+	StreamingOptions streaming{ };
+	// audio resampling (set per preset)
+	ResamplerOptions resampler{ };
+	// quantizer hints for static blocks (set per preset)
+	StaticRegionOptions regions{ };
+	// write a sidecar index of all packets next to the export
+	bool index{ false };
+	// the filename is a pipe or socket
+	StreamOutputOptions output{ };
+	// number of consecutive frames averaged into one exported frame, 1 disables blending
+	int blend_frames{ 1 };
+	// split the export into files
+	SegmentOptions segments{ };
+	// decode every packet again while exporting, and compare it with the frame sent to the encoder
+	bool verify{ false };
+};
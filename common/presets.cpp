@@ -0,0 +1,263 @@
+#include "presets.h"
+#include "codecprobe.h"
+#include "settings.h"
+
+#include <fstream>
+#include <sstream>
+
+extern "C" {
+#include <libavutil/opt.h>
+}
+
+namespace {
+
+void ParseCodecNameOptions(const std::string& value, const AVCodecID codec_fallback, AVCodecPtr& codec, AVDictionaryPtr& options) {
+	LOG_ENTER;
+	std::string name{ };
+	auto pos = value.find_first_of(' ');
+	if (pos == std::string::npos) {
+		name = value;
+		options = nullptr;
+		LOG->debug("codec name is {}", name);
+	}
+	else {
+		name = value.substr(0, pos);
+		std::string options_string{ value.substr(pos + 1) };
+		options = CreateAVDictionary(options_string, ":", ",");
+		LOG->debug("codec name is {}", name);
+		LOG->debug("codec options are {}", options_string);
+	}
+	codec = CreateAVCodec(name, codec_fallback);
+	LOG_EXIT;
+}
+
+// set every option on a scratch context, the same way avcodec_open2 will, so bad values show up now rather than mid export
+void ValidateCodecOptions(const std::string& preset, const AVCodec& codec, AVDictionaryPtr& options, std::vector<std::string>& errors) {
+	LOG_ENTER;
+	auto context = CreateAVCodecContext(codec);
+	AVDictionary* valid{ nullptr };
+	for (AVDictionaryEntry* entry = nullptr; (entry = av_dict_get(options.get(), "", entry, AV_DICT_IGNORE_SUFFIX));) {
+		if (!av_opt_find(context.get(), entry->key, nullptr, 0, AV_OPT_SEARCH_CHILDREN)) {
+			// a misspelled option would otherwise export with the default of the codec
+			errors.push_back(fmt::format("codec {} has no option {}", codec.name, entry->key));
+			LOG->error("preset {}: {}", preset, errors.back());
+			continue;
+		}
+		int ret = av_opt_set(context.get(), entry->key, entry->value, AV_OPT_SEARCH_CHILDREN);
+		if (ret < 0) {
+			errors.push_back(fmt::format("codec {} rejects {}={}: {}", codec.name, entry->key, entry->value, AVErrorString(ret)));
+			LOG->error("preset {}: {}", preset, errors.back());
+			continue;
+		}
+		av_dict_set(&valid, entry->key, entry->value, 0);
+	}
+	options.reset(valid);
+	LOG_EXIT;
+}
+
+// check the resampler options against their ranges, and the dither method on a scratch context
+void ValidateResamplerOptions(const std::string& preset, const ResamplerOptions& options, std::vector<std::string>& errors) {
+	LOG_ENTER;
+	if (options.filter_size < 1 || options.filter_size > 1024) {
+		errors.push_back(fmt::format("resampler filter size {} is not between 1 and 1024", options.filter_size));
+		LOG->error("preset {}: {}", preset, errors.back());
+	}
+	if (options.precision < 15 || options.precision > 33) {
+		errors.push_back(fmt::format("resampler precision {} is not between 15 and 33", options.precision));
+		LOG->error("preset {}: {}", preset, errors.back());
+	}
+	if (!options.dither.empty() && options.dither != "none") {
+		SwrContextPtr swr{ swr_alloc() };
+		if (!swr)
+			throw std::runtime_error("failed to allocate resampling context");
+		int ret = av_opt_set(swr.get(), "dither_method", options.dither.c_str(), 0);
+		if (ret < 0) {
+			errors.push_back(fmt::format("resampler rejects dither {}: {}", options.dither, AVErrorString(ret)));
+			LOG->error("preset {}: {}", preset, errors.back());
+		}
+	}
+	LOG_EXIT;
+}
+
+// presets to fall back on, as a space separated list
+void GetFallbacks(const inipp::Ini<char>::Section& sec, std::vector<std::string>& fallbacks) {
+	LOG_ENTER;
+	if (sec.count("fallback")) {
+		std::string fallback{ };
+		GetVar(sec, "fallback", fallback);
+		std::istringstream iss{ fallback };
+		for (std::string fallback_name; iss >> fallback_name;)
+			fallbacks.push_back(fallback_name);
+	}
+	LOG_EXIT;
+}
+
+std::shared_ptr<const PresetSnapshot> CreatePresetSnapshot(const std::filesystem::path& ini_filename) {
+	LOG_ENTER;
+	auto snapshot = std::make_shared<PresetSnapshot>();
+	std::error_code ec;
+	snapshot->mtime = std::filesystem::last_write_time(ini_filename, ec);
+	snapshot->size = std::filesystem::file_size(ini_filename, ec);
+	inipp::Ini<char> ini;
+	std::ifstream is(ini_filename);
+	if (is.fail()) {
+		LOG->error("failed to open \"{}\"", ini_filename.string());
+	}
+	else {
+		ini.parse(is);
+		for (const auto& error : ini.errors)
+			LOG->error("failed to parse \"{}\"", error);
+	}
+	snapshot->sections = ini.sections;
+	// presets do not depend on the builtin variables, so interpolating without them is enough
+	ini.interpolate();
+	for (const auto& [name, sec] : ini.sections) {
+		if (!sec.count("videocodec"))
+			continue;
+		// a broken preset is kept, but unusable, so its fallbacks still apply and the other presets still work
+		try {
+			snapshot->presets[name] = CreatePreset(name, sec);
+		}
+		catch (std::exception& e) {
+			LOG->error("preset {} cannot be compiled: {}", name, e.what());
+			auto preset = std::make_shared<Preset>();
+			preset->name = name;
+			preset->errors.push_back(e.what());
+			GetFallbacks(sec, preset->fallbacks);
+			snapshot->presets[name] = preset;
+		}
+	}
+	LOG->info("compiled {} presets from {}", snapshot->presets.size(), ini_filename.string());
+	LOG_EXIT;
+	return snapshot;
+}
+
+}
+
+std::shared_ptr<const Preset> CreatePreset(const std::string& name, const inipp::Ini<char>::Section& sec) {
+	LOG_ENTER;
+	auto preset = std::make_shared<Preset>();
+	preset->name = name;
+	preset->container = "mkv";
+	GetVar(sec, "container", preset->container);
+	auto dummy_filename = "dummy." + preset->container;
+	preset->oformat = av_guess_format(nullptr, dummy_filename.c_str(), nullptr);
+	if (!preset->oformat) {
+		LOG->error("container format {} not supported, falling back to mkv", preset->container);
+		preset->container = "mkv";
+		preset->oformat = av_guess_format(nullptr, "dummy.mkv", nullptr);
+		if (!preset->oformat)
+			throw std::runtime_error("mkv container format not supported");
+	}
+	// set up valid video codec
+	std::string videocodec_value{ };
+	GetVar(sec, "videocodec", videocodec_value);
+	ParseCodecNameOptions(videocodec_value, preset->oformat->video_codec, preset->video_codec, preset->video_codec_options);
+	ValidateCodecOptions(name, *preset->video_codec, preset->video_codec_options, preset->errors);
+	// set up valid audio codec
+	std::string audiocodec_value{ };
+	GetVar(sec, "audiocodec", audiocodec_value);
+	ParseCodecNameOptions(audiocodec_value, preset->oformat->audio_codec, preset->audio_codec, preset->audio_codec_options);
+	ValidateCodecOptions(name, *preset->audio_codec, preset->audio_codec_options, preset->errors);
+	// audio resampling, a tier first, which the other keys can then adjust
+	auto& resampler = preset->resampler;
+	if (sec.count("resampler")) {
+		std::string tier{ };
+		GetVar(sec, "resampler", tier);
+		if (!SetResamplerTier(tier, resampler))
+			LOG->error("preset {}: unknown resampler tier {}, using default", name, tier);
+	}
+	if (sec.count("resampler_engine"))
+		GetVar(sec, "resampler_engine", resampler.engine);
+	if (sec.count("resampler_filter_size"))
+		GetVar(sec, "resampler_filter_size", resampler.filter_size);
+	if (sec.count("resampler_precision"))
+		GetVar(sec, "resampler_precision", resampler.precision);
+	if (sec.count("resampler_dither"))
+		GetVar(sec, "resampler_dither", resampler.dither);
+	ValidateResamplerOptions(name, resampler, preset->errors);
+	// quantizer hints for static blocks
+	auto& regions = preset->regions;
+	if (sec.count("static_regions")) {
+		GetVar(sec, "static_regions", regions.enable);
+		if (sec.count("static_threshold"))
+			GetVar(sec, "static_threshold", regions.threshold);
+		if (sec.count("static_qoffset"))
+			GetVar(sec, "static_qoffset", regions.qoffset);
+		if (regions.threshold < 0 || regions.threshold > 255) {
+			LOG->error("preset {}: static_threshold must be between 0 and 255, using 2", name);
+			regions.threshold = 2;
+		}
+		if (regions.qoffset < -1.0 || regions.qoffset > 1.0) {
+			LOG->error("preset {}: static_qoffset must be between -1 and 1, using 0.2", name);
+			regions.qoffset = 0.2;
+		}
+	}
+	// round trip verification
+	if (sec.count("verify"))
+		GetVar(sec, "verify", preset->verify);
+	// presets to fall back on
+	GetFallbacks(sec, preset->fallbacks);
+	// two stage export
+	if (sec.count("intermediate"))
+		GetVar(sec, "intermediate", preset->intermediate);
+	// set up container layout
+	auto& streaming = preset->streaming;
+	auto index_space{ 1000 };
+	if (sec.count("streaming")) {
+		GetVar(sec, "streaming", streaming.enable);
+		GetVar(sec, "fragment_duration", streaming.fragment_duration);
+		GetVar(sec, "index_space", index_space);
+		streaming.index_space = int64_t{ index_space } * 1000;
+	}
+	LOG_EXIT;
+	return preset;
+}
+
+std::string CheckPreset(const Preset& preset) {
+	LOG_ENTER;
+	if (!preset.errors.empty()) {
+		LOG_EXIT;
+		return preset.errors.front();
+	}
+	for (auto [codec, options] : { std::make_pair(preset.video_codec, preset.video_codec_options.get()), std::make_pair(preset.audio_codec, preset.audio_codec_options.get()) }) {
+		auto probe = GetCodecProbeCache().Probe(*codec, options);
+		if (!probe.ok) {
+			LOG_EXIT;
+			return fmt::format("encoder {} does not work on this machine: {}", codec->name, probe.error);
+		}
+	}
+	LOG_EXIT;
+	return std::string{ };
+}
+
+PresetRegistry::PresetRegistry(const std::filesystem::path& ini_filename)
+	: mutex{ }, snapshot{ nullptr }, ini_filename{ ini_filename }
+{
+}
+
+std::shared_ptr<const PresetSnapshot> PresetRegistry::Snapshot() const
+{
+	return std::atomic_load(&snapshot);
+}
+
+std::shared_ptr<const PresetSnapshot> PresetRegistry::Refresh()
+{
+	LOG_ENTER_METHOD;
+	std::error_code ec;
+	auto mtime = std::filesystem::last_write_time(ini_filename, ec);
+	auto size = std::filesystem::file_size(ini_filename, ec);
+	auto current = Snapshot();
+	if (!current || current->mtime != mtime || current->size != size) {
+		std::lock_guard<std::mutex> lock(mutex);
+		// another thread may have rebuilt it while we were waiting
+		current = Snapshot();
+		if (!current || current->mtime != mtime || current->size != size) {
+			LOG->info("{} changed, compiling presets", ini_filename.string());
+			current = CreatePresetSnapshot(ini_filename);
+			std::atomic_store(&snapshot, current);
+		}
+	}
+	LOG_EXIT_METHOD;
+	return current;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "avcreate.h"
+#include "options.h"
+
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "..\inipp\inipp\inipp.h"
+
+// a preset section, compiled into everything an export takes from it
+// presets are never changed once created, so they can be shared between threads
+struct Preset {
+	std::string name{ };
+	std::string container{ };                       // extension of the export, mkv if the preset's container is not supported
+	const AVOutputFormat* oformat{ nullptr };
+	AVCodecPtr video_codec{ nullptr };
+	AVDictionaryPtr video_codec_options{ nullptr }; // copy before passing it to a stream, avcodec_open2 consumes it
+	AVCodecPtr audio_codec{ nullptr };
+	AVDictionaryPtr audio_codec_options{ nullptr };
+	StreamingOptions streaming{ };
+	ResamplerOptions resampler{ };
+	StaticRegionOptions regions{ };
+	bool verify{ false };                           // decode the export again while exporting, for lossless codecs
+	std::vector<std::string> errors{ };             // codec or resampler options that are unknown or rejected, the preset is unusable if not empty
+	std::vector<std::string> fallbacks{ };          // presets to use instead, in order, if this one cannot be used
+	std::string intermediate{ };                    // preset to capture with before transcoding to this one, empty to export directly
+};
+
+// resolve container and codecs of the preset section, and check its codec options against the codecs:
+// unknown options and invalid values are added to the errors
+std::shared_ptr<const Preset> CreatePreset(const std::string& name, const inipp::Ini<char>::Section& sec);
+
+// empty if the preset can be used, that is, its codec options are valid and both its encoders work on this machine,
+// otherwise the reason why not (encoders are probed through the codec probe cache)
+std::string CheckPreset(const Preset& preset);
+
+// all presets of the ini file as they were at the given modification time
+struct PresetSnapshot {
+	std::filesystem::file_time_type mtime{ };
+	uintmax_t size{ 0 };
+	inipp::Ini<char>::Sections sections{ };                    // as parsed, not yet interpolated
+	std::map<std::string, std::shared_ptr<const Preset>> presets{ }; // every section with a videocodec
+};
+
+// Compiles the presets of the ini file once, and again only when the file changes.
+// Snapshots are replaced atomically, so readers never wait for a rebuild, and
+// exports keep the snapshot that they started with.
+class PresetRegistry {
+private:
+	std::mutex mutex; // serializes rebuilds
+	std::shared_ptr<const PresetSnapshot> snapshot;
+
+public:
+	const std::filesystem::path ini_filename;
+
+	explicit PresetRegistry(const std::filesystem::path& ini_filename);
+
+	// latest snapshot, nullptr before the first refresh
+	std::shared_ptr<const PresetSnapshot> Snapshot() const;
+
+	// rebuild the snapshot if the modification time or size of the ini file changed, and return it
+	std::shared_ptr<const PresetSnapshot> Refresh();
+};
@@ -0,0 +1,132 @@
+#include "quality.h"
+
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SVE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// sums over an 8x8 block, from which its ssim follows
+struct BlockSums {
+	int64_t a{ 0 };  // sum of a
+	int64_t b{ 0 };  // sum of b
+	int64_t ss{ 0 }; // sum of a * a + b * b
+	int64_t ab{ 0 }; // sum of a * b
+};
+
+int64_t RowSSE(const uint8_t* a, const uint8_t* b, int width)
+{
+	int64_t sse{ 0 };
+	int x{ 0 };
+#ifdef SVE_SSE2
+	// 16 samples per step, the 32 bit lanes cannot overflow within a row of up to 16k samples
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc = _mm_setzero_si128();
+	for (; x + 16 <= width; x += 16) {
+		__m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x));
+		__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x));
+		__m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+		__m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(lo, lo));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(hi, hi));
+	}
+	alignas(16) uint32_t lanes[4];
+	_mm_store_si128(reinterpret_cast<__m128i*>(lanes), acc);
+	sse = int64_t{ lanes[0] } + lanes[1] + lanes[2] + lanes[3];
+#endif
+	for (; x < width; x++) {
+		int d = int{ a[x] } - int{ b[x] };
+		sse += d * d;
+	}
+	return sse;
+}
+
+BlockSums Block8x8(const uint8_t* a, int a_linesize, const uint8_t* b, int b_linesize)
+{
+	BlockSums sums{ };
+#ifdef SVE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	__m128i sad = _mm_setzero_si128();
+	__m128i ss = _mm_setzero_si128();
+	__m128i ab = _mm_setzero_si128();
+	for (int y = 0; y < 8; y++) {
+		// a in the low half, b in the high half, so one sad gives both sums
+		__m128i va8 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(a + y * a_linesize));
+		__m128i vb8 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + y * b_linesize));
+		sad = _mm_add_epi64(sad, _mm_sad_epu8(_mm_unpacklo_epi64(va8, vb8), zero));
+		__m128i va = _mm_unpacklo_epi8(va8, zero);
+		__m128i vb = _mm_unpacklo_epi8(vb8, zero);
+		ss = _mm_add_epi32(ss, _mm_add_epi32(_mm_madd_epi16(va, va), _mm_madd_epi16(vb, vb)));
+		ab = _mm_add_epi32(ab, _mm_madd_epi16(va, vb));
+	}
+	alignas(16) uint64_t sad_lanes[2];
+	alignas(16) uint32_t ss_lanes[4];
+	alignas(16) uint32_t ab_lanes[4];
+	_mm_store_si128(reinterpret_cast<__m128i*>(sad_lanes), sad);
+	_mm_store_si128(reinterpret_cast<__m128i*>(ss_lanes), ss);
+	_mm_store_si128(reinterpret_cast<__m128i*>(ab_lanes), ab);
+	sums.a = sad_lanes[0];
+	sums.b = sad_lanes[1];
+	sums.ss = int64_t{ ss_lanes[0] } + ss_lanes[1] + ss_lanes[2] + ss_lanes[3];
+	sums.ab = int64_t{ ab_lanes[0] } + ab_lanes[1] + ab_lanes[2] + ab_lanes[3];
+#else
+	for (int y = 0; y < 8; y++) {
+		for (int x = 0; x < 8; x++) {
+			int va = a[y * a_linesize + x];
+			int vb = b[y * b_linesize + x];
+			sums.a += va;
+			sums.b += vb;
+			sums.ss += va * va + vb * vb;
+			sums.ab += va * vb;
+		}
+	}
+#endif
+	return sums;
+}
+
+double BlockSSIM(const BlockSums& sums)
+{
+	// constants from the original ssim paper, for 8 bit samples
+	const double c1 = (0.01 * 255) * (0.01 * 255);
+	const double c2 = (0.03 * 255) * (0.03 * 255);
+	const double n = 64.0;
+	double mu_a = sums.a / n;
+	double mu_b = sums.b / n;
+	double var_sum = sums.ss / n - mu_a * mu_a - mu_b * mu_b;
+	double cov = sums.ab / n - mu_a * mu_b;
+	return ((2 * mu_a * mu_b + c1) * (2 * cov + c2)) / ((mu_a * mu_a + mu_b * mu_b + c1) * (var_sum + c2));
+}
+
+}
+
+int64_t PlaneSSE(const uint8_t* a, int a_linesize, const uint8_t* b, int b_linesize, int width, int height)
+{
+	int64_t sse{ 0 };
+	for (int y = 0; y < height; y++)
+		sse += RowSSE(a + y * a_linesize, b + y * b_linesize, width);
+	return sse;
+}
+
+double PlaneSSIM(const uint8_t* a, int a_linesize, const uint8_t* b, int b_linesize, int width, int height)
+{
+	double total{ 0.0 };
+	int64_t blocks{ 0 };
+	for (int y = 0; y + 8 <= height; y += 8) {
+		for (int x = 0; x + 8 <= width; x += 8) {
+			total += BlockSSIM(Block8x8(a + y * a_linesize + x, a_linesize, b + y * b_linesize + x, b_linesize));
+			blocks++;
+		}
+	}
+	return (blocks > 0) ? total / blocks : 1.0;
+}
+
+double PSNR(int64_t sse, int64_t count)
+{
+	if (sse == 0 || count == 0)
+		return std::numeric_limits<double>::infinity();
+	return 10.0 * std::log10(255.0 * 255.0 * count / sse);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+
+// Objective quality of 8 bit sample planes, for comparing an export against its source.
+// The kernels use SSE2 where available, and fall back on plain loops otherwise.
+
+// sum of squared differences
+int64_t PlaneSSE(const uint8_t* a, int a_linesize, const uint8_t* b, int b_linesize, int width, int height);
+
+// mean structural similarity over non-overlapping 8x8 blocks, edges that do not fill a block are skipped
+double PlaneSSIM(const uint8_t* a, int a_linesize, const uint8_t* b, int b_linesize, int width, int height);
+
+// peak signal to noise ratio in dB from the sum of squared differences over count samples,
+// infinite if the planes are identical
+double PSNR(int64_t sse, int64_t count);
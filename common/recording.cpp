@@ -0,0 +1,90 @@
+#include "recording.h"
+
+#include <cstring>
+
+const char recording_magic[8] = { 'S', 'V', 'E', 'R', 'E', 'C', '0', '1' };
+
+Recorder::Recorder(const std::filesystem::path& filename)
+	: mutex{}
+	, os{ filename, std::ios::binary }
+	, start{ std::chrono::steady_clock::now() }
+	, filename{ filename }
+{
+	LOG_ENTER_METHOD;
+	if (os.fail())
+		throw std::runtime_error(fmt::format("failed to open recording \"{}\"", filename.string()));
+	os.write(recording_magic, sizeof(recording_magic));
+	LOG->info("recording to \"{}\"", filename.string());
+	LOG_EXIT_METHOD;
+}
+
+void Recorder::Write(RecordType type, uint32_t stream_index, const void* data, uint32_t size)
+{
+	LOG_ENTER_METHOD;
+	const int64_t time = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - start).count();
+	const auto type_value = static_cast<uint8_t>(type);
+	std::lock_guard<std::mutex> lock(mutex);
+	os.write(reinterpret_cast<const char*>(&type_value), sizeof(type_value));
+	os.write(reinterpret_cast<const char*>(&stream_index), sizeof(stream_index));
+	os.write(reinterpret_cast<const char*>(&time), sizeof(time));
+	os.write(reinterpret_cast<const char*>(&size), sizeof(size));
+	if (size)
+		os.write(reinterpret_cast<const char*>(data), size);
+	if (os.fail())
+		LOG->error("failed to write to recording \"{}\"", filename.string());
+	LOG_EXIT_METHOD;
+}
+
+void Recorder::WriteAudioType(uint32_t stream_index, AVSampleFormat sample_fmt, int sample_rate, uint64_t channel_layout)
+{
+	LOG_ENTER_METHOD;
+	RecordedAudioType info{ sample_fmt, sample_rate, channel_layout };
+	Write(RecordType::AudioType, stream_index, &info, sizeof(info));
+	LOG_EXIT_METHOD;
+}
+
+void Recorder::WriteVideoType(uint32_t stream_index, int width, int height, AVRational frame_rate, AVPixelFormat pix_fmt)
+{
+	LOG_ENTER_METHOD;
+	RecordedVideoType info{ width, height, frame_rate.num, frame_rate.den, pix_fmt };
+	Write(RecordType::VideoType, stream_index, &info, sizeof(info));
+	LOG_EXIT_METHOD;
+}
+
+RecordingReader::RecordingReader(const std::filesystem::path& filename)
+	: is{ filename, std::ios::binary }
+	, filename{ filename }
+{
+	LOG_ENTER_METHOD;
+	if (is.fail())
+		throw std::runtime_error(fmt::format("failed to open recording \"{}\"", filename.string()));
+	char magic[sizeof(recording_magic)] = { 0 };
+	is.read(magic, sizeof(magic));
+	if (is.fail() || std::memcmp(magic, recording_magic, sizeof(magic)) != 0)
+		throw std::runtime_error(fmt::format("\"{}\" is not a recording", filename.string()));
+	LOG_EXIT_METHOD;
+}
+
+bool RecordingReader::Read(Record& record)
+{
+	LOG_ENTER_METHOD;
+	uint8_t type_value{ 0 };
+	uint32_t size{ 0 };
+	is.read(reinterpret_cast<char*>(&type_value), sizeof(type_value));
+	if (is.eof()) {
+		LOG_EXIT_METHOD;
+		return false;
+	}
+	is.read(reinterpret_cast<char*>(&record.stream_index), sizeof(record.stream_index));
+	is.read(reinterpret_cast<char*>(&record.time), sizeof(record.time));
+	is.read(reinterpret_cast<char*>(&size), sizeof(size));
+	record.type = static_cast<RecordType>(type_value);
+	record.data.resize(size);
+	if (size)
+		is.read(reinterpret_cast<char*>(record.data.data()), size);
+	if (is.fail())
+		throw std::runtime_error(fmt::format("recording \"{}\" is truncated", filename.string()));
+	LOG_EXIT_METHOD;
+	return true;
+}
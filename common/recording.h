@@ -0,0 +1,80 @@
+#pragma once
+
+#include "logger.h"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+extern "C" {
+#include <libavutil/pixfmt.h>
+#include <libavutil/rational.h>
+#include <libavutil/samplefmt.h>
+}
+
+// events of the capture path, in the order in which the game calls the sink writer
+enum class RecordType : uint8_t {
+	AudioType = 1, // SinkWriterSetInputMediaType for audio, data is a RecordedAudioType
+	VideoType = 2, // SinkWriterSetInputMediaType for video, data is a RecordedVideoType
+	BeginWriting = 3,
+	Sample = 4, // SinkWriterWriteSample, data is the raw sample buffer
+	Flush = 5,
+	Finalize = 6,
+};
+
+// media types are stored as parsed by the plugin, so they can be replayed without media foundation
+struct RecordedAudioType {
+	int32_t sample_fmt;
+	int32_t sample_rate;
+	uint64_t channel_layout;
+};
+
+struct RecordedVideoType {
+	int32_t width;
+	int32_t height;
+	int32_t frame_rate_num;
+	int32_t frame_rate_den;
+	int32_t pix_fmt;
+};
+
+struct Record {
+	RecordType type{ RecordType::Sample };
+	uint32_t stream_index{ 0 };
+	int64_t time{ 0 }; // microseconds since the recording started
+	std::vector<uint8_t> data{ };
+};
+
+// Records all sink writer events, with their raw payloads and arrival times, to a file.
+// The file starts with a magic string, followed by the records,
+// each with a 17 byte header (type, stream index, time, data size) and the data.
+// Write is thread safe, as samples arrive from different threads for audio and video.
+class Recorder {
+private:
+	std::mutex mutex;
+	std::ofstream os;
+	const std::chrono::steady_clock::time_point start;
+
+public:
+	const std::filesystem::path filename;
+
+	Recorder(const std::filesystem::path& filename);
+	void Write(RecordType type, uint32_t stream_index, const void* data, uint32_t size);
+	void WriteAudioType(uint32_t stream_index, AVSampleFormat sample_fmt, int sample_rate, uint64_t channel_layout);
+	void WriteVideoType(uint32_t stream_index, int width, int height, AVRational frame_rate, AVPixelFormat pix_fmt);
+};
+
+// Reads records back from a file written by Recorder.
+class RecordingReader {
+private:
+	std::ifstream is;
+
+public:
+	const std::filesystem::path filename;
+
+	RecordingReader(const std::filesystem::path& filename);
+
+	// returns false at the end of the file
+	bool Read(Record& record);
+};
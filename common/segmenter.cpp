@@ -0,0 +1,362 @@
+#include "segmenter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+std::filesystem::path SegmentFilename(const std::filesystem::path& filename, int number)
+{
+	auto segment_filename{ filename };
+	segment_filename.replace_filename(std::filesystem::u8path(fmt::format("{}-{:03}{}", filename.stem().u8string(), number, filename.extension().u8string())));
+	return segment_filename;
+}
+
+std::filesystem::path SegmentManifestFilename(const std::filesystem::path& filename)
+{
+	auto manifest_filename{ filename };
+	manifest_filename.replace_extension(".ffconcat");
+	return manifest_filename;
+}
+
+Segmenter::Segmenter(
+	const std::filesystem::path& filename, std::shared_ptr<AVFormatContext>& format_context, const AVDictionary* muxer_options,
+	const SegmentOptions& options, int video_index, const AVRational& video_time_base)
+	: mutex{ }, owner{ format_context }, muxer_options{ CopyAVDictionary(muxer_options) }
+	, current{ nullptr }, previous{ nullptr }, next{ }, closing{ }
+	, cuts{ }, period{ 0 }, size_reached{ false }
+	, manifest_mutex{ }, finished{ }
+	, filename{ filename }, options{ options }, video_index{ video_index }, video_time_base{ video_time_base }
+{
+	LOG_ENTER_METHOD;
+	if (options.duration > 0.0)
+		LOG->info("splitting export into segments of {:.3f} seconds", options.duration);
+	if (options.size > 0)
+		LOG->info("splitting export into segments of {} MB", options.size / 1000000);
+	// segments left over from an earlier export to the same name would otherwise look like part of this one
+	std::error_code ec;
+	int nb_stale{ 0 };
+	for (int i = 0; std::filesystem::remove(SegmentFilename(filename, i), ec); i++)
+		nb_stale++;
+	std::filesystem::remove(SegmentManifestFilename(filename), ec);
+	if (nb_stale > 0)
+		LOG->info("deleted {} segments of an earlier export", nb_stale);
+	current = Open(0);
+	next = std::async(std::launch::async, [this] { return Open(1); });
+	LOG_EXIT_METHOD;
+}
+
+Segmenter::~Segmenter()
+{
+	LOG_ENTER_METHOD;
+	// only reached with open segments if the export was neither flushed nor cancelled, as after an error
+	try {
+		if (closing.valid())
+			closing.get();
+	}
+	LOG_CATCH;
+	DiscardNext();
+	previous = nullptr;
+	current = nullptr;
+	LOG_EXIT_METHOD;
+}
+
+int64_t Segmenter::Period(int64_t pts) const
+{
+	const auto duration_ms = static_cast<int64_t>(std::llround(options.duration * 1000.0));
+	return av_rescale_rnd(pts, int64_t{ video_time_base.num } * 1000, int64_t{ video_time_base.den } * duration_ms, AV_ROUND_DOWN);
+}
+
+int64_t Segmenter::PeriodStart(int64_t period) const
+{
+	const auto duration_ms = static_cast<int64_t>(std::llround(options.duration * 1000.0));
+	return av_rescale_rnd(period, duration_ms * video_time_base.den, int64_t{ video_time_base.num } * 1000, AV_ROUND_UP);
+}
+
+std::unique_ptr<Segmenter::Segment> Segmenter::Open(int number)
+{
+	LOG_ENTER_METHOD;
+	auto format_context = owner.lock();
+	if (!format_context)
+		throw std::runtime_error("failed to lock format context");
+	auto segment = std::make_unique<Segment>();
+	segment->number = number;
+	segment->filename = SegmentFilename(filename, number);
+	segment->context = CreateAVFormatContext(segment->filename, format_context->oformat->name);
+	for (unsigned int i = 0; i < format_context->nb_streams; i++) {
+		auto src = format_context->streams[i];
+		auto dst = avformat_new_stream(segment->context.get(), nullptr);
+		if (!dst)
+			throw std::runtime_error(fmt::format("failed to add stream to segment {}", number));
+		int ret = avcodec_parameters_copy(dst->codecpar, src->codecpar);
+		if (ret < 0)
+			throw std::runtime_error(fmt::format("failed to copy stream parameters to segment {}: {}", number, AVErrorString(ret)));
+		dst->time_base = src->time_base;
+	}
+	segment->offsets.resize(format_context->nb_streams, 0);
+	// the ffmpeg API expects a utf8 encoded const char * for the filename
+	auto u8_filename{ segment->filename.u8string() };
+	auto c_filename{ reinterpret_cast<const char*>(u8_filename.c_str()) };
+	int ret = avio_open(&segment->context->pb, c_filename, AVIO_FLAG_WRITE);
+	if (ret < 0 || !segment->context->pb)
+		throw std::runtime_error(fmt::format("failed to open '{}' for writing: {}", segment->filename.string(), AVErrorString(ret)));
+	auto dict = CopyAVDictionary(muxer_options.get()).release();
+	ret = avformat_write_header(segment->context.get(), &dict);
+	av_dict_free(&dict);
+	if (ret < 0)
+		throw std::runtime_error(fmt::format("failed to write header of '{}': {}", segment->filename.string(), AVErrorString(ret)));
+	LOG->debug("opened segment {}", segment->filename.string());
+	LOG_EXIT_METHOD;
+	return segment;
+}
+
+void Segmenter::Close(Segment& segment, bool trailer)
+{
+	LOG_ENTER_METHOD;
+	if (trailer) {
+		int ret = av_write_trailer(segment.context.get());
+		if (ret < 0)
+			throw std::runtime_error(fmt::format("failed to write trailer of '{}': {}", segment.filename.string(), AVErrorString(ret)));
+	}
+	else if (segment.context->pb) {
+		avio_flush(segment.context->pb);
+	}
+	segment.context = nullptr;
+	std::error_code ec;
+	auto size = std::filesystem::file_size(segment.filename, ec);
+	LOG->info(
+		"segment {} finished: {:.3f} to {:.3f} seconds, {} bytes",
+		segment.filename.string(), segment.start, segment.end, ec ? 0 : size);
+	std::lock_guard<std::mutex> lock(manifest_mutex);
+	finished.push_back(Finished{ segment.number, segment.filename, segment.start, segment.end, ec ? 0 : size });
+	std::sort(finished.begin(), finished.end(), [](const Finished& a, const Finished& b) { return a.number < b.number; });
+	WriteManifest();
+	LOG_EXIT_METHOD;
+}
+
+void Segmenter::CloseInBackground(std::unique_ptr<Segment> segment)
+{
+	LOG_ENTER_METHOD;
+	// one at a time, so the manifest lists the segments in order as they finish
+	if (closing.valid())
+		closing.get();
+	closing = std::async(std::launch::async, [this, segment = std::move(segment)] { Close(*segment, true); });
+	LOG_EXIT_METHOD;
+}
+
+void Segmenter::DiscardNext()
+{
+	LOG_ENTER_METHOD;
+	if (next.valid()) {
+		try {
+			auto segment = next.get();
+			auto unused = segment->filename;
+			segment = nullptr;
+			std::error_code ec;
+			std::filesystem::remove(unused, ec);
+		}
+		LOG_CATCH;
+	}
+	LOG_EXIT_METHOD;
+}
+
+void Segmenter::Switch(int64_t cut)
+{
+	LOG_ENTER_METHOD;
+	auto format_context = owner.lock();
+	if (!format_context)
+		throw std::runtime_error("failed to lock format context");
+	auto segment = next.get();
+	segment->cut = cut;
+	for (unsigned int i = 0; i < format_context->nb_streams; i++)
+		segment->offsets[i] = av_rescale_q_rnd(cut, video_time_base, format_context->streams[i]->time_base, AV_ROUND_DOWN);
+	segment->start = cut * av_q2d(video_time_base);
+	segment->end = segment->start;
+	// the audio never caught up with the previous cut, so it is closed now
+	if (previous)
+		CloseInBackground(std::move(previous));
+	previous = std::move(current);
+	current = std::move(segment);
+	size_reached = false;
+	next = std::async(std::launch::async, [this, number = current->number + 1] { return Open(number); });
+	LOG->info("segment {} starts at {:.3f} seconds", current->filename.string(), current->start);
+	LOG_EXIT_METHOD;
+}
+
+void Segmenter::WriteManifest()
+{
+	LOG_ENTER_METHOD;
+	auto manifest_filename = SegmentManifestFilename(filename);
+	auto tmp_filename{ manifest_filename };
+	tmp_filename += ".tmp";
+	{
+		std::ofstream os{ tmp_filename };
+		os << "ffconcat version 1.0" << std::endl;
+		for (const auto& segment : finished) {
+			// quote the name, a quote itself is written as '\''
+			std::string name{ };
+			for (auto c : segment.filename.filename().u8string()) {
+				if (c == '\'')
+					name += "'\\''";
+				else
+					name += c;
+			}
+			os << fmt::format("# segment {}: {:.6f} to {:.6f} seconds, {} bytes", segment.number, segment.start, segment.end, segment.size) << std::endl;
+			os << fmt::format("file '{}'", name) << std::endl;
+			os << fmt::format("duration {:.6f}", segment.end - segment.start) << std::endl;
+		}
+		if (os.fail()) {
+			LOG->error("failed to write {}", tmp_filename.string());
+			LOG_EXIT_METHOD;
+			return;
+		}
+	}
+	std::error_code ec;
+	std::filesystem::rename(tmp_filename, manifest_filename, ec);
+	if (ec)
+		LOG->error("failed to write {}: {}", manifest_filename.string(), ec.message());
+	LOG_EXIT_METHOD;
+}
+
+bool Segmenter::StartsSegment(int64_t pts)
+{
+	LOG_ENTER_METHOD;
+	std::lock_guard<std::mutex> lock(mutex);
+	auto starts{ false };
+	if (options.duration > 0.0) {
+		auto frame_period = Period(pts);
+		if (frame_period > period) {
+			period = frame_period;
+			starts = true;
+		}
+	}
+	if (size_reached) {
+		size_reached = false;
+		starts = true;
+	}
+	if (starts)
+		cuts.push_back(pts);
+	LOG_EXIT_METHOD;
+	return starts;
+}
+
+int Segmenter::SamplesBeforeCut(int64_t pts, int nb_samples, const AVRational& time_base)
+{
+	LOG_ENTER_METHOD;
+	std::lock_guard<std::mutex> lock(mutex);
+	int64_t samples{ nb_samples };
+	// the first sample at or after the cut goes to the next segment
+	auto limit = [&](int64_t cut) {
+		auto before = av_rescale_q_rnd(cut, video_time_base, time_base, AV_ROUND_UP) - pts;
+		if (before > 0 && before < samples)
+			samples = before;
+	};
+	for (auto cut : cuts)
+		limit(cut);
+	// the audio may be ahead of the video, so work out the cuts that are not planned yet
+	if (options.duration > 0.0) {
+		const auto duration_ms = static_cast<int64_t>(std::llround(options.duration * 1000.0));
+		auto audio_period = av_rescale_rnd(pts, int64_t{ time_base.num } * 1000, int64_t{ time_base.den } * duration_ms, AV_ROUND_DOWN);
+		for (auto p : { audio_period, audio_period + 1 })
+			if (p > period)
+				limit(PeriodStart(p));
+	}
+	LOG_EXIT_METHOD;
+	return static_cast<int>(samples);
+}
+
+void Segmenter::Write(AVPacket& pkt)
+{
+	LOG_ENTER_METHOD;
+	std::lock_guard<std::mutex> lock(mutex);
+	auto format_context = owner.lock();
+	if (!format_context)
+		throw std::runtime_error("failed to lock format context");
+	if (!current)
+		throw std::runtime_error("segments already closed");
+	const auto index = pkt.stream_index;
+	const auto time_base = format_context->streams[index]->time_base;
+	// switch at the first keyframe from the planned cut on, even if the encoder put it later
+	if (index == video_index && (pkt.flags & AV_PKT_FLAG_KEY) && pkt.pts != AV_NOPTS_VALUE && !cuts.empty()) {
+		auto video_pts = av_rescale_q(pkt.pts, time_base, video_time_base);
+		if (video_pts >= cuts.front()) {
+			while (!cuts.empty() && cuts.front() <= video_pts)
+				cuts.pop_front();
+			Switch(video_pts);
+		}
+	}
+	auto segment = current.get();
+	if (previous && pkt.pts != AV_NOPTS_VALUE) {
+		if (av_compare_ts(pkt.pts, time_base, current->cut, video_time_base) < 0)
+			segment = previous.get();
+		else if (index != video_index)
+			// the audio has caught up with the cut, nothing more goes to the previous segment
+			CloseInBackground(std::move(previous));
+	}
+	if (pkt.pts != AV_NOPTS_VALUE) {
+		segment->end = std::max(segment->end, (pkt.pts + pkt.duration) * av_q2d(time_base));
+		pkt.pts -= segment->offsets[index];
+	}
+	if (pkt.dts != AV_NOPTS_VALUE)
+		pkt.dts -= segment->offsets[index];
+	av_packet_rescale_ts(&pkt, time_base, segment->context->streams[index]->time_base);
+	int ret = av_interleaved_write_frame(segment->context.get(), &pkt);
+	if (ret < 0)
+		throw std::runtime_error(fmt::format("failed to write packet to '{}': {}", segment->filename.string(), AVErrorString(ret)));
+	if (options.size > 0 && segment == current.get() && cuts.empty() && avio_tell(segment->context->pb) >= options.size)
+		size_reached = true;
+	LOG_EXIT_METHOD;
+}
+
+void Segmenter::Flush()
+{
+	LOG_ENTER_METHOD;
+	std::lock_guard<std::mutex> lock(mutex);
+	if (previous)
+		CloseInBackground(std::move(previous));
+	if (closing.valid())
+		closing.get();
+	if (current) {
+		Close(*current, true);
+		current = nullptr;
+	}
+	DiscardNext();
+	LOG->info("export split into {} segments, listed in {}", finished.size(), SegmentManifestFilename(filename).string());
+	LOG_EXIT_METHOD;
+}
+
+uintmax_t Segmenter::Size()
+{
+	std::lock_guard<std::mutex> lock(manifest_mutex);
+	uintmax_t size{ 0 };
+	for (const auto& segment : finished)
+		size += segment.size;
+	return size;
+}
+
+void Segmenter::Cancel(CancelMode mode)
+{
+	LOG_ENTER_METHOD;
+	std::lock_guard<std::mutex> lock(mutex);
+	try {
+		if (closing.valid())
+			closing.get();
+	}
+	LOG_CATCH;
+	DiscardNext();
+	// what has been written so far is kept as it is, as for a truncated export
+	for (auto segment : { previous.get(), current.get() })
+		if (segment)
+			Close(*segment, false);
+	previous = nullptr;
+	current = nullptr;
+	if (mode == CancelMode::Delete) {
+		std::lock_guard<std::mutex> manifest_lock(manifest_mutex);
+		std::error_code ec;
+		for (const auto& segment : finished)
+			std::filesystem::remove(segment.filename, ec);
+		std::filesystem::remove(SegmentManifestFilename(filename), ec);
+		LOG->info("deleted {} segments", finished.size());
+		finished.clear();
+	}
+	LOG_EXIT_METHOD;
+}
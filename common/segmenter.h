@@ -0,0 +1,127 @@
+#pragma once
+
+#include "logger.h"
+#include "avcreate.h"
+#include "options.h"
+
+#include <deque>
+#include <filesystem>
+#include <future>
+#include <mutex>
+#include <vector>
+
+// name of segment number of the export, for instance export-003.mkv for export.mkv
+std::filesystem::path SegmentFilename(const std::filesystem::path& filename, int number);
+
+// name of the manifest of a segmented export, a concat script that ffmpeg can read
+std::filesystem::path SegmentManifestFilename(const std::filesystem::path& filename);
+
+// Splits an export into files of a fixed duration or size, each starting on a video keyframe,
+// with timestamps that start again at zero.
+// The format context of the export only serves as template: its streams are copied into a context for every segment.
+// The video stream calls StartsSegment before encoding each frame, and forces a keyframe if it returns true:
+// for a duration, on the first frame of every period; for a size, on the next frame after the segment grew past it.
+// The export switches to the next segment at the first video keyframe from the planned cut on;
+// audio packets from before the cut still go to the previous segment, which is closed in the background
+// once the audio has caught up. Codecs that take audio frames of any size end a frame at the cut,
+// so the audio is split at the exact sample, other codecs split at the nearest packet.
+// The next segment is opened (and its header written) in the background ahead of time,
+// so a switch does not hold up the thread that writes packets.
+// Usage:
+// * Create the segmenter, instead of opening the file and writing the header;
+//   this deletes the segments and manifest of an earlier export to the same filename.
+// * Pass every packet to Write (with timestamps in the template stream time base), in dts order.
+// * Call Flush instead of writing the trailer, or Cancel.
+class Segmenter {
+private:
+	struct Segment {
+		int number{ 0 };
+		std::filesystem::path filename{ };
+		AVFormatContextPtr context{ nullptr };
+		int64_t cut{ 0 };                // video pts at which the segment starts
+		std::vector<int64_t> offsets{ }; // the cut, in the time base of every stream
+		double start{ 0.0 };             // seconds of the export that the segment covers
+		double end{ 0.0 };
+	};
+
+	// a closed segment, as listed in the manifest
+	struct Finished {
+		int number;
+		std::filesystem::path filename;
+		double start;
+		double end;
+		uintmax_t size;
+	};
+
+	std::mutex mutex;
+	std::weak_ptr<AVFormatContext> owner; // template
+	AVDictionaryPtr muxer_options;
+	std::unique_ptr<Segment> current;
+	std::unique_ptr<Segment> previous;             // still takes the audio from before the cut, nullptr if closed
+	std::future<std::unique_ptr<Segment>> next;    // segment being opened ahead of time
+	std::future<void> closing;                     // segment being closed
+	std::deque<int64_t> cuts;                      // video pts of keyframes forced for a new segment, not yet reached
+	int64_t period;                                // duration period of the last video frame
+	bool size_reached;                             // the current segment has grown past the size, but no cut is planned yet
+	std::mutex manifest_mutex;
+	std::vector<Finished> finished;
+
+	// duration period of the video pts
+	int64_t Period(int64_t pts) const;
+
+	// video pts of the first frame of a duration period
+	int64_t PeriodStart(int64_t period) const;
+
+	// create the segment and write its header, only reads the template, so it can run on any thread
+	std::unique_ptr<Segment> Open(int number);
+
+	// write the trailer if requested, close the file, and list it in the manifest
+	void Close(Segment& segment, bool trailer);
+
+	// close the segment on a background thread, after the segment that is being closed already
+	void CloseInBackground(std::unique_ptr<Segment> segment);
+
+	// close the segment opened ahead of time, which is not needed anymore, and delete it
+	void DiscardNext();
+
+	// start the segment opened ahead of time at the cut, and open the one after it
+	void Switch(int64_t cut);
+
+	// list the finished segments, through a temporary file, so readers never see half a manifest
+	void WriteManifest();
+
+public:
+	const std::filesystem::path filename;
+	const SegmentOptions options;
+	const int video_index;
+	const AVRational video_time_base; // of the video pts passed to StartsSegment, the codec time base
+
+	// open the first segment, and the second one in the background
+	Segmenter(
+		const std::filesystem::path& filename, std::shared_ptr<AVFormatContext>& format_context, const AVDictionary* muxer_options,
+		const SegmentOptions& options, int video_index, const AVRational& video_time_base);
+
+	// waits for the background threads, segments that are still open are closed without trailer
+	~Segmenter();
+	Segmenter(const Segmenter&) = delete;
+	Segmenter& operator=(const Segmenter&) = delete;
+
+	// whether the video frame with this pts starts a new segment, and must be encoded as a keyframe
+	bool StartsSegment(int64_t pts);
+
+	// how many of the nb_samples samples from pts (in time_base) come before the next cut,
+	// or nb_samples if there is no cut among them
+	int SamplesBeforeCut(int64_t pts, int nb_samples, const AVRational& time_base);
+
+	// write the packet to the segment it belongs to, switching segments at a cut
+	void Write(AVPacket& pkt);
+
+	// write the trailers of the open segments, and the manifest
+	void Flush();
+
+	// bytes of the segments finished so far
+	uintmax_t Size();
+
+	// close the open segments without trailer, and with CancelMode::Delete, delete all segments and the manifest
+	void Cancel(CancelMode mode);
+};
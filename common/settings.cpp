@@ -1,4 +1,6 @@
 #include "settings.h"
+#include "presets.h"
+#include "telemetry.h"
 
 #include <ctime>
 #include <fstream>
@@ -48,51 +50,64 @@ std::string TimeStamp()
 	return oss.str();
 }
 
-void ParseCodecNameOptions(const std::string& value, const AVCodecID codec_fallback,  AVCodecPtr& codec, AVDictionaryPtr& options) {
+void GetThreadPolicy(const inipp::Ini<char>::Section& sec, const std::string& prefix, ThreadPolicy& policy) {
 	LOG_ENTER;
-	std::string name{ };
-	auto pos = value.find_first_of(' ');
-	if (pos == std::string::npos) {
-		name = value;
-		options = nullptr;
-		LOG->debug("codec name is {}", name);
-	}
-	else {
-		name = value.substr(0, pos);
-		std::string options_string{ value.substr(pos + 1) };
-		options = CreateAVDictionary(options_string, ":", ",");
-		LOG->debug("codec name is {}", name);
-		LOG->debug("codec options are {}", options_string);
+	std::string affinity{ };
+	if (GetVar(sec, prefix + "_affinity", affinity)) {
+		try {
+			policy.affinity = std::stoull(affinity, nullptr, 16);
+		}
+		catch (std::exception&) {
+			LOG->error("failed to parse cpu mask {}", affinity);
+		}
 	}
-	codec = CreateAVCodec(name, codec_fallback);
+	GetVar(sec, prefix + "_priority", policy.priority);
+	GetVar(sec, prefix + "_threads", policy.threads);
 	LOG_EXIT;
 }
 
 const std::filesystem::path Settings::ini_filename_ = SCRIPT_NAME ".ini";
 
 Settings::Settings()
+	: Settings(nullptr)
+{
+}
+
+Settings::Settings(const std::shared_ptr<const PresetSnapshot>& presets)
 	: video_codec{ nullptr }
 	, audio_codec{ nullptr }
+	, worker{ false }
+	, worker_slots{ 4 }
+	, worker_timeout{ 5000 }
+	, presets{ presets }
 {
 	// LOG_ENTER is deferred until the log level is set
-	LOG->debug("parsing {}", ini_filename_.string());
-	std::ifstream is(ini_filename_);
-	if (is.fail()) {
-		LOG->error("failed to open \"{}\"", ini_filename_.string());
+	if (presets) {
+		// the snapshot was parsed (and its parse errors logged) when it was compiled
+		sections = presets->sections;
 	}
 	else {
-		parse(is);
-		if (!errors.empty()) {
-			for (const auto& error : errors) {
-				LOG->error("failed to parse \"{}\"", error);
+		LOG->debug("parsing {}", ini_filename_.string());
+		std::ifstream is(ini_filename_);
+		if (is.fail()) {
+			LOG->error("failed to open \"{}\"", ini_filename_.string());
+		}
+		else {
+			parse(is);
+			if (!errors.empty()) {
+				for (const auto& error : errors) {
+					LOG->error("failed to parse \"{}\"", error);
+				}
 			}
 		}
 	}
 	auto level{ spdlog::level::info };
 	auto flush_on{ spdlog::level::off };
+	auto telemetry{ false };
 	auto sec = GetSec(sections, "log");
 	GetVar(sec, "level", level);
 	GetVar(sec, "flush_on", flush_on);
+	GetVar(sec, "telemetry", telemetry);
 	if (logger) {
 		logger->flush();
 		logger->set_level(level);
@@ -121,36 +136,164 @@ Settings::Settings()
 	auto exportsec = GetSec(sections, "export");
 	std::string folder{ "." };
 	std::string basename{ "sve-" + timestamp };
-	std::string preset{ };
+	std::string preset_name{ };
 	GetVar(exportsec, "folder", folder);
 	GetVar(exportsec, "basename", basename);
-	GetVar(exportsec, "preset", preset);
-	auto presetsec = GetSec(sections, preset);
-	std::string container{ "mkv" };
-	GetVar(presetsec, "container", container);
+	GetVar(exportsec, "preset", preset_name);
+	// the finalizer of the previous export may still be writing to its own block
+	if (telemetry)
+		format_options.telemetry = TelemetryName(basename);
+	GetVar(exportsec, "cancel", format_options.cancel);
+	GetVar(exportsec, "index", format_options.index);
+	GetVar(exportsec, "blend_frames", format_options.blend_frames);
+	if (format_options.blend_frames < 1 || format_options.blend_frames > 256) {
+		LOG->error("blend_frames must be between 1 and 256, blending disabled");
+		format_options.blend_frames = 1;
+	}
+	auto segment_size{ 0 };
+	GetVar(exportsec, "segment_duration", format_options.segments.duration);
+	GetVar(exportsec, "segment_size", segment_size);
+	if (format_options.segments.duration < 0.0 || segment_size < 0) {
+		LOG->error("segment_duration and segment_size must not be negative, not splitting the export");
+		format_options.segments = SegmentOptions{ };
+	}
+	else {
+		format_options.segments.size = int64_t{ segment_size } * 1000000;
+	}
+	auto memory_limit{ 0 };
+	GetVar(exportsec, "memory_limit", memory_limit);
+	format_options.memory_limit = int64_t{ memory_limit } * 1000000;
+	auto interleave_max_memory{ 256 };
+	auto interleave_max_wait{ 100 };
+	GetVar(exportsec, "interleave_max_skew", format_options.interleave.max_skew);
+	GetVar(exportsec, "interleave_max_memory", interleave_max_memory);
+	GetVar(exportsec, "interleave_max_wait", interleave_max_wait);
+	format_options.interleave.max_memory = int64_t{ interleave_max_memory } * 1000000;
+	format_options.interleave.max_wait = std::chrono::milliseconds(interleave_max_wait);
+	auto threadssec = GetSec(sections, "threads");
+	GetThreadPolicy(threadssec, "conversion", format_options.threads.conversion);
+	GetThreadPolicy(threadssec, "codec", format_options.threads.codec);
+	GetThreadPolicy(threadssec, "finalize", format_options.threads.finalize);
+	GetThreadPolicy(threadssec, "verify", format_options.threads.verify);
+	LoadPreset(preset_name, folder, basename);
+	std::string output{ };
+	GetVar(exportsec, "output", output);
+	// two stage export: capture with the intermediate preset, and transcode to the requested preset afterwards
+	auto loaded = FindPreset(preset);
+	if (loaded && !loaded->intermediate.empty()) {
+		if (!output.empty())
+			LOG->warn("preset {} exports directly to {}, without intermediate", preset, output);
+		else
+			LoadIntermediate(loaded->intermediate, folder, basename);
+	}
+	auto record{ false };
+	GetVar(exportsec, "record", record);
+	if (record) {
+		record_filename = export_filename;
+		record_filename.replace_extension(".sverec");
+	}
+	if (!output.empty()) {
+		// keep the container of the preset, it cannot be guessed from a pipe or socket
+		auto u8_export_filename{ export_filename.u8string() };
+		auto oformat = av_guess_format(nullptr, reinterpret_cast<const char*>(u8_export_filename.c_str()), nullptr);
+		format_options.output.enable = true;
+		format_options.output.container = oformat ? oformat->name : "matroska";
+		export_filename = std::filesystem::u8path(output);
+		LOG->info("exporting as {} to {}", format_options.output.container, output);
+	}
+	auto worker_timeout_seconds{ 5 };
+	GetVar(exportsec, "worker", worker);
+	GetVar(exportsec, "worker_slots", worker_slots);
+	GetVar(exportsec, "worker_timeout", worker_timeout_seconds);
+	worker_timeout = std::chrono::seconds(worker_timeout_seconds);
+	LOG_EXIT_METHOD;
+}
+
+void Settings::LoadIntermediate(const std::string& intermediate, const std::filesystem::path& folder, const std::string& basename)
+{
+	LOG_ENTER_METHOD;
+	auto job = std::make_unique<TranscodeJob>();
+	job->name = preset;
+	job->filename = export_filename;
+	job->video_codec = video_codec;
+	job->video_codec_options = CopyAVDictionary(video_codec_options.get());
+	job->audio_codec = audio_codec;
+	job->audio_codec_options = CopyAVDictionary(audio_codec_options.get());
+	job->streaming = format_options.streaming;
+	job->resampler = format_options.resampler;
+	job->regions = format_options.regions;
+	job->segments = format_options.segments;
+	job->verify = format_options.verify;
+	job->delete_sources = true;
+	const auto final_preset = preset;
+	try {
+		LoadPreset(intermediate, folder, basename + "-intermediate");
+		job->video = export_filename;
+		// the intermediate is captured in one piece, only the final export is split
+		format_options.segments = SegmentOptions{ };
+		LOG->info(
+			"capturing {} with preset {}, to be transcoded to {} with preset {}",
+			job->video.string(), preset, job->filename.string(), final_preset);
+		transcode = std::move(job);
+	}
+	catch (std::exception& e) {
+		LOG->error("intermediate preset {} cannot be used, exporting directly: {}", intermediate, e.what());
+		LoadPreset(final_preset, folder, basename);
+	}
+	LOG_EXIT_METHOD;
+}
+
+std::shared_ptr<const Preset> Settings::FindPreset(const std::string& name)
+{
+	LOG_ENTER_METHOD;
+	std::shared_ptr<const Preset> compiled{ nullptr };
+	if (presets && presets->presets.count(name))
+		compiled = presets->presets.at(name);
+	else if (sections.count(name))
+		compiled = CreatePreset(name, sections.at(name));
+	LOG_EXIT_METHOD;
+	return compiled;
+}
+
+void Settings::LoadPreset(const std::string& preset_name, const std::filesystem::path& folder, const std::string& basename)
+{
+	LOG_ENTER_METHOD;
+	// an unknown preset still gives the default codecs, as before
+	auto requested = FindPreset(preset_name);
+	if (!requested)
+		requested = CreatePreset(preset_name, GetSec(sections, preset_name));
+	std::shared_ptr<const Preset> compiled{ nullptr };
+	std::string reason{ };
+	for (size_t i = 0; !compiled && i <= requested->fallbacks.size(); i++) {
+		auto candidate = (i == 0) ? requested : FindPreset(requested->fallbacks[i - 1]);
+		if (!candidate) {
+			LOG->error("fallback preset {} not found", requested->fallbacks[i - 1]);
+			continue;
+		}
+		auto problem = CheckPreset(*candidate);
+		if (problem.empty())
+			compiled = candidate;
+		else
+			LOG->warn("preset {} cannot be used: {}", candidate->name, problem);
+		if (i == 0)
+			reason = problem;
+	}
+	if (!compiled)
+		throw std::runtime_error(fmt::format("preset {} cannot be used: {}", preset_name, reason));
+	if (compiled != requested)
+		LOG->info("falling back on preset {}", compiled->name);
+	preset = compiled->name;
 	export_filename = folder;
-	export_filename /= basename + "." + container;
-	auto u8_export_filename{ export_filename.u8string() };
-	auto c_export_filename{ reinterpret_cast<const char*>(u8_export_filename.c_str()) };
-	auto oformat = av_guess_format(nullptr, c_export_filename, nullptr);
-	if (!oformat) {
-		LOG->error("container format {} not supported, falling back to mkv", container);
-		export_filename = folder;
-		export_filename /= basename + ".mkv";
-		u8_export_filename = export_filename.u8string();
-		c_export_filename = reinterpret_cast<const char*>(u8_export_filename.c_str());
-		oformat = av_guess_format(nullptr, c_export_filename, nullptr);
-		if (!oformat)
-			throw std::runtime_error("mkv container format not supported");
-	}
-	// set up valid video codec
-	std::string videocodec_value{ };
-	GetVar(presetsec, "videocodec", videocodec_value);
-	ParseCodecNameOptions(videocodec_value, oformat->video_codec, video_codec, video_codec_options);
-	// set up valid audio codec
-	std::string audiocodec_value{ };
-	GetVar(presetsec, "audiocodec", audiocodec_value);
-	ParseCodecNameOptions(audiocodec_value, oformat->audio_codec, audio_codec, audio_codec_options);
+	export_filename /= basename + "." + compiled->container;
+	format_options.output = StreamOutputOptions{ };
+	video_codec = compiled->video_codec;
+	video_codec_options = CopyAVDictionary(compiled->video_codec_options.get());
+	audio_codec = compiled->audio_codec;
+	audio_codec_options = CopyAVDictionary(compiled->audio_codec_options.get());
+	format_options.streaming = compiled->streaming;
+	format_options.resampler = compiled->resampler;
+	format_options.regions = compiled->regions;
+	format_options.verify = compiled->verify;
 	LOG_EXIT_METHOD;
 }
 
@@ -2,6 +2,8 @@
 
 #include "avcreate.h"
 #include "logger.h"
+#include "options.h"
+#include "transcode.h"
 #include <filesystem>
 #include "..\inipp\inipp\inipp.h"
 
@@ -11,6 +13,10 @@ extern "C" {
 
 #define SCRIPT_NAME "SimpleVideoExport"
 
+// presets.cpp reads its sections with GetVar, so presets.h must not include this header back
+struct Preset;
+struct PresetSnapshot;
+
 const inipp::Ini<char>::Section& GetSec(const inipp::Ini<char>::Sections& sections, const std::string& sec_name);
 
 template <typename T>
@@ -34,6 +40,13 @@ bool GetVar(const inipp::Ini<char>::Section& sec, const std::basic_string<char>&
 
 class Settings : public inipp::Ini<char>
 {
+private:
+	// compiled preset, nullptr if there is no such section
+	std::shared_ptr<const Preset> FindPreset(const std::string& name);
+
+	// switch the export over to the intermediate preset, and set up the transcode to the loaded preset
+	void LoadIntermediate(const std::string& intermediate, const std::filesystem::path& folder, const std::string& basename);
+
 public:
 	static const std::filesystem::path ini_filename_;
 	std::filesystem::path export_filename;
@@ -41,8 +54,26 @@ public:
 	AVDictionaryPtr video_codec_options;
 	AVCodecPtr audio_codec;
 	AVDictionaryPtr audio_codec_options;
+	FormatOptions format_options;
+	std::filesystem::path record_filename; // empty if recording is disabled
+	bool worker;                           // encode in SimpleVideoExportWorker rather than in the game process
+	uint32_t worker_slots;                 // frames that the game may run ahead of the worker
+	std::chrono::milliseconds worker_timeout;
 
+	std::shared_ptr<const PresetSnapshot> presets; // nullptr if presets are compiled as they are loaded
+	std::string preset;                            // preset loaded last, after falling back if needed
+	std::unique_ptr<TranscodeJob> transcode;       // second stage of a two stage export, nullptr if exporting directly
+
+	// parse the ini file
 	Settings();
+
+	// take the ini file and its compiled presets from the snapshot, without reading the file again
+	explicit Settings(const std::shared_ptr<const PresetSnapshot>& presets);
+
+	// set export_filename and codecs from the given preset section
+	// if the preset cannot be used (invalid codec options, or an encoder that does not work on this machine),
+	// its fallbacks are tried in order, and if none can be used either, this throws
+	void LoadPreset(const std::string& preset_name, const std::filesystem::path& folder, const std::string& basename);
 };
 
 /* declaration resides in dllmain.cpp */
@@ -0,0 +1,77 @@
+#include "sharedmemory.h"
+#include "logger.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+SharedMemory::SharedMemory(const std::string& name, size_t size, bool create, bool writable)
+	: ptr{ nullptr }
+#ifdef _WIN32
+	, handle{ nullptr }
+#endif
+	, name{ name }
+	, size{ size }
+{
+	LOG_ENTER_METHOD;
+	writable = writable || create;
+#ifdef _WIN32
+	auto mapping_name = "Local\\" + name;
+	if (create)
+		handle = CreateFileMappingA(
+			INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+			static_cast<DWORD>(uint64_t{ size } >> 32), static_cast<DWORD>(size & 0xffffffff), mapping_name.c_str());
+	else
+		handle = OpenFileMappingA(writable ? FILE_MAP_WRITE : FILE_MAP_READ, FALSE, mapping_name.c_str());
+	if (!handle)
+		throw std::runtime_error(fmt::format("failed to open shared memory {}: {}", name, std::system_category().message(GetLastError())));
+	ptr = MapViewOfFile(handle, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size);
+	if (!ptr) {
+		CloseHandle(handle);
+		throw std::runtime_error(fmt::format("failed to map shared memory {}: {}", name, std::system_category().message(GetLastError())));
+	}
+#else
+	auto shm_name = "/" + name;
+	int fd = shm_open(shm_name.c_str(), create ? (O_CREAT | O_RDWR) : (writable ? O_RDWR : O_RDONLY), 0644);
+	if (fd < 0)
+		throw std::runtime_error(fmt::format("failed to open shared memory {}: {}", name, std::system_category().message(errno)));
+	if (create && ftruncate(fd, size) != 0) {
+		close(fd);
+		throw std::runtime_error(fmt::format("failed to size shared memory {}: {}", name, std::system_category().message(errno)));
+	}
+	ptr = mmap(nullptr, size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED)
+		throw std::runtime_error(fmt::format("failed to map shared memory {}: {}", name, std::system_category().message(errno)));
+#endif
+	LOG_EXIT_METHOD;
+}
+
+SharedMemory::~SharedMemory()
+{
+	LOG_ENTER_METHOD;
+#ifdef _WIN32
+	UnmapViewOfFile(ptr);
+	CloseHandle(handle);
+#else
+	munmap(ptr, size);
+#endif
+	LOG_EXIT_METHOD;
+}
+
+void* SharedMemory::Data() const
+{
+	return ptr;
+}
+
+void SharedMemory::Unlink()
+{
+#ifndef _WIN32
+	auto shm_name = "/" + name;
+	shm_unlink(shm_name.c_str());
+#endif
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// A named block of memory shared between processes
+// (POSIX shared memory on linux, a named file mapping on windows).
+// The block is unmapped on destruction, but stays around as long as another process has it mapped,
+// and on linux until it is removed explicitly.
+class SharedMemory {
+private:
+	void* ptr;
+#ifdef _WIN32
+	void* handle;
+#endif
+
+public:
+	const std::string name;
+	const size_t size;
+
+	// create (and size) the block, or open an existing block read only or writable
+	SharedMemory(const std::string& name, size_t size, bool create, bool writable);
+	~SharedMemory();
+	SharedMemory(const SharedMemory&) = delete;
+	SharedMemory& operator=(const SharedMemory&) = delete;
+
+	void* Data() const;
+
+	// remove the name, so the block is freed once it is no longer mapped (no-op on windows)
+	void Unlink();
+};
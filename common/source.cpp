@@ -0,0 +1,157 @@
+#include "source.h"
+
+Source::Source(const std::filesystem::path& filename)
+	: context{ CreateAVInputFormatContext(filename) }
+	, video{}, audio{}
+	, eof{ false }
+	, filename{ filename }
+{
+	LOG_ENTER_METHOD;
+	OpenInput(video, AVMEDIA_TYPE_VIDEO);
+	OpenInput(audio, AVMEDIA_TYPE_AUDIO);
+	if (!HasVideo() && !HasAudio())
+		throw std::runtime_error(fmt::format("no audio or video stream in '{}'", filename.string()));
+	LOG_EXIT_METHOD;
+}
+
+Source::Input& Source::GetInput(AVMediaType type)
+{
+	if (type == AVMEDIA_TYPE_VIDEO)
+		return video;
+	if (type == AVMEDIA_TYPE_AUDIO)
+		return audio;
+	throw std::invalid_argument("source only provides audio and video");
+}
+
+void Source::OpenInput(Input& input, AVMediaType type)
+{
+	LOG_ENTER_METHOD;
+	input.index = av_find_best_stream(context.get(), type, -1, -1, nullptr, 0);
+	AVCodecPtr codec = (input.index >= 0) ? avcodec_find_decoder(context->streams[input.index]->codecpar->codec_id) : nullptr;
+	if (!codec) {
+		input.index = -1;
+		input.eof = true;
+		LOG->debug("no {} stream in '{}'", av_get_media_type_string(type), filename.string());
+		LOG_EXIT_METHOD;
+		return;
+	}
+	input.decoder = CreateAVCodecContext(*codec);
+	auto ret = avcodec_parameters_to_context(input.decoder.get(), context->streams[input.index]->codecpar);
+	if (ret < 0)
+		throw std::runtime_error(fmt::format("failed to set up {} decoder: {}", codec->name, AVErrorString(ret)));
+	input.decoder->pkt_timebase = context->streams[input.index]->time_base;
+	ret = avcodec_open2(input.decoder.get(), codec, nullptr);
+	if (ret < 0)
+		throw std::runtime_error(fmt::format("failed to open {} decoder: {}", codec->name, AVErrorString(ret)));
+	// wav files often do not specify a channel layout
+	if (type == AVMEDIA_TYPE_AUDIO && !input.decoder->channel_layout)
+		input.decoder->channel_layout = av_get_default_channel_layout(input.decoder->channels);
+	LOG->info("reading {} stream {} from '{}' with {} decoder", av_get_media_type_string(type), input.index, filename.string(), codec->name);
+	LOG_EXIT_METHOD;
+}
+
+void Source::Receive(Input& input)
+{
+	LOG_ENTER_METHOD;
+	while (true) {
+		auto frame = CreateAVFrame();
+		auto ret = avcodec_receive_frame(input.decoder.get(), frame.get());
+		if (ret == AVERROR(EAGAIN))
+			break;
+		if (ret == AVERROR_EOF) {
+			input.eof = true;
+			break;
+		}
+		if (ret < 0)
+			throw std::runtime_error(fmt::format("failed to decode frame: {}", AVErrorString(ret)));
+		if (input.decoder->codec_type == AVMEDIA_TYPE_AUDIO && !frame->channel_layout)
+			frame->channel_layout = input.decoder->channel_layout;
+		input.frames.push_back(std::move(frame));
+	}
+	LOG_EXIT_METHOD;
+}
+
+bool Source::HasVideo() const
+{
+	return video.index >= 0;
+}
+
+bool Source::HasAudio() const
+{
+	return audio.index >= 0;
+}
+
+const AVCodecContext& Source::VideoDecoder() const
+{
+	if (!video.decoder)
+		throw std::runtime_error(fmt::format("no video stream in '{}'", filename.string()));
+	return *video.decoder;
+}
+
+const AVCodecContext& Source::AudioDecoder() const
+{
+	if (!audio.decoder)
+		throw std::runtime_error(fmt::format("no audio stream in '{}'", filename.string()));
+	return *audio.decoder;
+}
+
+AVRational Source::VideoFrameRate() const
+{
+	if (!HasVideo())
+		throw std::runtime_error(fmt::format("no video stream in '{}'", filename.string()));
+	return av_guess_frame_rate(context.get(), context->streams[video.index], nullptr);
+}
+
+int64_t Source::VideoFrameCount() const
+{
+	if (!HasVideo())
+		throw std::runtime_error(fmt::format("no video stream in '{}'", filename.string()));
+	auto stream = context->streams[video.index];
+	if (stream->nb_frames > 0)
+		return stream->nb_frames;
+	// y4m and friends do not store the number of frames, but the duration can be guessed from the file size
+	if (context->duration > 0)
+		return av_rescale_q(context->duration, AV_TIME_BASE_Q, av_inv_q(VideoFrameRate()));
+	return 0;
+}
+
+AVFramePtr Source::ReadFrame(AVMediaType type)
+{
+	LOG_ENTER_METHOD;
+	auto& input = GetInput(type);
+	auto pkt = CreateAVPacket();
+	while (input.frames.empty() && !input.eof) {
+		if (eof) {
+			// drain the decoder
+			auto ret = avcodec_send_packet(input.decoder.get(), nullptr);
+			if (ret < 0 && ret != AVERROR_EOF)
+				throw std::runtime_error(fmt::format("failed to flush decoder: {}", AVErrorString(ret)));
+			Receive(input);
+			input.eof = true;
+			break;
+		}
+		auto ret = av_read_frame(context.get(), pkt.get());
+		if (ret == AVERROR_EOF) {
+			eof = true;
+			continue;
+		}
+		if (ret < 0)
+			throw std::runtime_error(fmt::format("failed to read packet from '{}': {}", filename.string(), AVErrorString(ret)));
+		for (auto other : { &video, &audio }) {
+			if (other->index == pkt->stream_index && !other->eof) {
+				ret = avcodec_send_packet(other->decoder.get(), pkt.get());
+				if (ret < 0)
+					throw std::runtime_error(fmt::format("failed to send packet to decoder: {}", AVErrorString(ret)));
+				Receive(*other);
+			}
+		}
+		av_packet_unref(pkt.get());
+	}
+	AVFramePtr frame{ nullptr };
+	if (!input.frames.empty()) {
+		frame = std::move(input.frames.front());
+		input.frames.pop_front();
+	}
+	LOG_EXIT_METHOD;
+	return frame;
+}
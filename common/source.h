@@ -0,0 +1,59 @@
+#pragma once
+
+#include "logger.h"
+#include "avcreate.h"
+
+#include <deque>
+
+// A class for reading decoded frames from a media file, such as y4m, wav, or nut with rawvideo and pcm.
+// Usage:
+// * Create a Source object from the filename.
+// * Check which streams are present with HasVideo and HasAudio,
+//   and get their parameters from VideoDecoder and AudioDecoder.
+// * Call ReadFrame(AVMEDIA_TYPE_VIDEO) or ReadFrame(AVMEDIA_TYPE_AUDIO) for the next frame of that type,
+//   until it returns nullptr.
+// Frames of the other type that are read along the way are queued,
+// so reading both types in an order that follows the file keeps the queues short.
+class Source {
+private:
+	struct Input {
+		int index{ -1 };
+		AVCodecContextPtr decoder{ nullptr };
+		std::deque<AVFramePtr> frames{};
+		bool eof{ false };
+	};
+
+	AVInputFormatContextPtr context;
+	Input video;
+	Input audio;
+	bool eof; // no more packets in the file
+
+	Input& GetInput(AVMediaType type);
+
+	// set up decoder for the best stream of the given type
+	void OpenInput(Input& input, AVMediaType type);
+
+	// receive all frames that the decoder has ready
+	void Receive(Input& input);
+
+public:
+	const std::filesystem::path filename;
+
+	Source(const std::filesystem::path& filename);
+
+	bool HasVideo() const;
+	bool HasAudio() const;
+
+	// decoder contexts, these describe the decoded frames
+	const AVCodecContext& VideoDecoder() const;
+	const AVCodecContext& AudioDecoder() const;
+
+	// frame rate of the video stream
+	AVRational VideoFrameRate() const;
+
+	// number of video frames in the file, or 0 if unknown
+	int64_t VideoFrameCount() const;
+
+	// next frame of the given type, or nullptr if there are none left
+	AVFramePtr ReadFrame(AVMediaType type);
+};
@@ -1,5 +1,7 @@
 #include "stream.h"
 
+#include <algorithm>
+
 extern "C" {
 #include <libavutil/timestamp.h>
 }
@@ -16,10 +18,19 @@ auto AVTsTimeString(uint64_t ts, AVRational* tb) {
 	return std::string(buffer);
 }
 
-Stream::Stream(std::shared_ptr<AVFormatContext>& format_context, const AVCodec& codec)
+Stream::Stream(std::shared_ptr<AVFormatContext>& format_context, const AVCodec& codec, const std::shared_ptr<MemoryAccount>& memory)
 	: owner{ format_context }
 	, stream{ CreateAVStream(*format_context, codec) }
+	, codec_pool{ nullptr }
 	, context{ CreateAVCodecContext(codec) }
+	, direct{ false }
+	, telemetry{ nullptr }
+	, interleaver{ nullptr }
+	, segmenter{ nullptr }
+	, memory{ memory }
+	, nb_encoder_frames{ 0 }
+	, encoder_bytes{ 0 }
+	, verifier{ nullptr }
 {
 	LOG_ENTER_METHOD;
 	if (format_context->oformat->flags & AVFMT_GLOBALHEADER)
@@ -27,6 +38,50 @@ Stream::Stream(std::shared_ptr<AVFormatContext>& format_context, const AVCodec&
 	LOG_EXIT_METHOD;
 }
 
+// run the slices of a codec on the thread pool stored in its opaque field
+int CodecExecute(AVCodecContext* c, int (*func)(AVCodecContext* c2, void* arg), void* arg, int* ret, int count, int size)
+{
+	auto pool = static_cast<ThreadPool*>(c->opaque);
+	pool->Run(count, [&](int i) {
+		int r = func(c, static_cast<uint8_t*>(arg) + static_cast<size_t>(i) * size);
+		if (ret)
+			ret[i] = r;
+	});
+	return 0;
+}
+
+int Stream::Open(AVDictionaryPtr& options, const ThreadPolicy& policy)
+{
+	LOG_ENTER_METHOD;
+	auto capabilities = context->codec->capabilities;
+	if (policy.threads > 1 && (capabilities & AV_CODEC_CAP_SLICE_THREADS) && !(capabilities & AV_CODEC_CAP_FRAME_THREADS)) {
+		// libavcodec does not start threads of its own with a single thread, so all slices go through execute
+		LOG->debug("running {} codec slices on {} threads", context->codec->name, policy.threads);
+		codec_pool = std::make_unique<ThreadPool>(policy.threads, policy);
+		context->thread_count = 1;
+		context->opaque = codec_pool.get();
+		context->execute = CodecExecute;
+		// a threads option would be applied on opening, and start threads of the codec next to the pool
+		if (auto entry = av_dict_get(options.get(), "threads", nullptr, 0)) {
+			LOG->info("ignoring threads={} of the {} codec options, its slices run on {} threads of our own", entry->value, context->codec->name, policy.threads);
+			auto dict = options.release();
+			av_dict_set(&dict, "threads", nullptr, 0);
+			options.reset(dict);
+		}
+	}
+	else if (policy.threads > 0) {
+		context->thread_count = policy.threads;
+	}
+	// threads started by the codec on opening inherit the policy (on linux)
+	auto dict = options.release();
+	auto ret = RunWithThreadPolicy(policy, [&] { return avcodec_open2(context.get(), nullptr, &dict); });
+	options.reset(dict);
+	if (ret >= 0)
+		LOG->debug("{} codec opened with {} threads{}", context->codec->name, context->thread_count, codec_pool ? " and a pool for its slices" : "");
+	LOG_EXIT_METHOD;
+	return ret;
+}
+
 // encode and write the given frame to the stream
 // to flush the encoder, send a nullptr as frame
 void Stream::Encode(const AVFramePtr& frame)
@@ -34,32 +89,36 @@ void Stream::Encode(const AVFramePtr& frame)
 	LOG_ENTER_METHOD;
 	auto pkt = CreateAVPacket();
 	// send frame for encoding
+	const int64_t frame_pts = frame ? frame->pts : -1;
+	SVE_TRACE(send_frame, stream->index, frame_pts);
+	if (verifier && frame)
+		verifier->Sent(*frame);
 	int ret_frame = avcodec_send_frame(context.get(), frame.get());
+	SVE_TRACE(send_frame_return, stream->index, frame_pts, ret_frame);
 	if (ret_frame < 0)
 		throw std::runtime_error(fmt::format("failed to send frame to encoder: {}", AVErrorString(ret_frame)));
-	// lock the format context (we will need it to write the packets)
-	auto format_context = owner.lock();
-	if (!format_context)
-		throw std::runtime_error("failed to lock format context");
+	// the encoder keeps (a copy of) the frame until it comes out as a packet
+	int64_t frame_size{ 0 };
+	if (frame) {
+		nb_encoder_frames++;
+		for (auto buf : frame->buf)
+			if (buf)
+				frame_size += buf->size;
+	}
 	// get next packet from encoder
+	int nb_packets = 0;
 	int ret_packet = avcodec_receive_packet(context.get(), pkt.get());
 	// ret_packet == 0 denotes success, keep writing as long as we have success
 	while (!ret_packet) {
-		// we have to set the correct stream index
-		pkt->stream_index = stream->index;
-		// we need to rescale the packet timestamps from the context time base to the stream time base
-		av_packet_rescale_ts(pkt.get(), context->time_base, stream->time_base);
-		// process the frame
-		AVRational* time_base = &stream->time_base;
-		LOG->debug(
-			"pts:{} pts_time:{} dts:{} dts_time:{} duration:{} duration_time:{} stream_index:{}",
-			AVTsString(pkt->pts), AVTsTimeString(pkt->pts, time_base),
-			AVTsString(pkt->dts), AVTsTimeString(pkt->dts, time_base),
-			AVTsString(pkt->duration), AVTsTimeString(pkt->duration, time_base),
-			pkt->stream_index);
-		int ret_write = av_interleaved_write_frame(format_context.get(), pkt.get());
-		if (ret_write < 0)
-			throw std::runtime_error(fmt::format("failed to write packet to stream: {}", AVErrorString(ret_write)));
+		SVE_TRACE(packet, stream->index, pkt->size, pkt->pts, (pkt->flags & AV_PKT_FLAG_KEY) ? 1 : 0);
+		// before writing, which rescales the timestamps, and before counting, so the reference of
+		// the verifier is charged to its own stage rather than to the muxer
+		if (verifier)
+			verifier->Received(*pkt);
+		CountAVBuffer(pkt->buf, memory, MemoryStage::Muxer);
+		Write(*pkt);
+		nb_packets++;
+		nb_encoder_frames = std::max(nb_encoder_frames - 1, int64_t{ 0 });
 		// clean up reference
 		av_packet_unref(pkt.get());
 		// get next packet from encoder
@@ -67,5 +126,57 @@ void Stream::Encode(const AVFramePtr& frame)
 	}
 	if (ret_packet != AVERROR(EAGAIN) && (ret_packet != AVERROR_EOF))
 		throw std::runtime_error(fmt::format("failed to receive packet from encoder: {}", AVErrorString(ret_packet)));
+	if (!frame)
+		nb_encoder_frames = 0;
+	if (memory && (frame_size || !frame)) {
+		memory->Add(MemoryStage::Encoder, nb_encoder_frames * frame_size - encoder_bytes);
+		encoder_bytes = nb_encoder_frames * frame_size;
+	}
+	if (!frame)
+		LOG->info("flushed {} delayed packets from {} encoder", nb_packets, context->codec->name);
+	LOG_EXIT_METHOD;
+}
+
+void Stream::Write(AVPacket& pkt)
+{
+	LOG_ENTER_METHOD;
+	// lock the format context (we will need it to write the packets)
+	auto format_context = owner.lock();
+	if (!format_context)
+		throw std::runtime_error("failed to lock format context");
+	// we have to set the correct stream index
+	pkt.stream_index = stream->index;
+	// progress is counted in frames for video and in samples for audio
+	const auto units = (context->codec_type == AVMEDIA_TYPE_VIDEO) ? 1 : pkt.duration;
+	const auto size = pkt.size;
+	const auto pts = pkt.pts;
+	SVE_TRACE(mux_write, stream->index, size, pts);
+	// we need to rescale the packet timestamps from the context time base to the stream time base
+	av_packet_rescale_ts(&pkt, context->time_base, stream->time_base);
+	// process the frame
+	AVRational* time_base = &stream->time_base;
+	LOG->debug(
+		"pts:{} pts_time:{} dts:{} dts_time:{} duration:{} duration_time:{} stream_index:{}",
+		AVTsString(pkt.pts), AVTsTimeString(pkt.pts, time_base),
+		AVTsString(pkt.dts), AVTsTimeString(pkt.dts, time_base),
+		AVTsString(pkt.duration), AVTsTimeString(pkt.duration, time_base),
+		pkt.stream_index);
+	if (interleaver) {
+		interleaver->Write(pkt);
+	}
+	else if (segmenter) {
+		segmenter->Write(pkt);
+	}
+	else {
+		int ret_write = av_interleaved_write_frame(format_context.get(), &pkt);
+		if (ret_write < 0)
+			throw std::runtime_error(fmt::format("failed to write packet to stream: {}", AVErrorString(ret_write)));
+	}
+	SVE_TRACE(mux_write_return, stream->index, pts);
+	if (telemetry) {
+		telemetry->Written(context->codec_type, units, size, context->time_base, format_context->pb ? avio_tell(format_context->pb) : -1);
+		if (interleaver)
+			telemetry->SetSkew(interleaver->Skew());
+	}
 	LOG_EXIT_METHOD;
 }
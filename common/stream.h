@@ -2,6 +2,11 @@
 
 #include "logger.h"
 #include "avcreate.h"
+#include "interleaver.h"
+#include "telemetry.h"
+#include "threadpool.h"
+#include "tracepoints.h"
+#include "verifier.h"
 
 extern "C" {
 #include <libavformat/avformat.h>
@@ -23,13 +28,31 @@ class Stream {
 public:
 	std::weak_ptr<AVFormatContext> owner; // context which owns this stream
 	AVStreamPtr stream;           // the stream
+	std::unique_ptr<ThreadPool> codec_pool; // pool running codec slices (must outlive the codec context)
 	AVCodecContextPtr context;    // codec context for this stream
+	bool direct;                  // codec output is a byte-identical copy of the frame data, so bypass the encoder
+	Telemetry* telemetry;         // progress counters, or nullptr
+	Interleaver* interleaver;     // queue in front of the muxer, or nullptr to write to the muxer directly
+	Segmenter* segmenter;         // splits the export into files, or nullptr
+	std::shared_ptr<MemoryAccount> memory; // memory use of the export
+	int64_t nb_encoder_frames;    // frames sent to the encoder that did not come out as packets yet
+	int64_t encoder_bytes;        // memory held by those frames, as accounted
+	std::unique_ptr<Verifier> verifier; // decodes every packet again and compares it with the frame sent, or nullptr
 
 	// add stream to the given format context, and initialize codec context and frame
 	// note: frame buffer is not allocated (we do not know the stream format yet at this point)
 	// note: frame->pts is set to zero
-	Stream(std::shared_ptr<AVFormatContext>& format_context, const AVCodec& codec);
+	Stream(std::shared_ptr<AVFormatContext>& format_context, const AVCodec& codec, const std::shared_ptr<MemoryAccount>& memory);
+
+	// open the codec, applying the thread policy to the codec threads
+	// slice threaded codecs run their slices on codec_pool, other codecs get policy.threads threads
+	// returns the result of avcodec_open2
+	int Open(AVDictionaryPtr& options, const ThreadPolicy& policy);
 
 	// send frame to the encoder
 	void Encode(const AVFramePtr& avframe);
+
+	// write an encoded packet to the format context
+	// packet timestamps must be in the codec context time base
+	void Write(AVPacket& pkt);
 };
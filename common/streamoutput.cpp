@@ -0,0 +1,80 @@
+#include "streamoutput.h"
+#include "logger.h"
+
+namespace {
+
+constexpr int stream_buffer_size = 1 << 16;
+
+}
+
+StreamOutput::StreamOutput(const std::filesystem::path& url)
+	: destination{ nullptr }
+	, buffer{ nullptr }
+	, start{ std::chrono::steady_clock::now() }
+	, blocked{ 0 }
+	, bytes{ 0 }
+	, url{ url }
+{
+	LOG_ENTER_METHOD;
+	auto u8_url{ url.u8string() };
+	auto c_url{ reinterpret_cast<const char*>(u8_url.c_str()) };
+	int ret = avio_open(&destination, c_url, AVIO_FLAG_WRITE);
+	if (ret < 0 || !destination)
+		throw std::runtime_error(fmt::format("failed to open '{}' for writing: {}", url.string(), AVErrorString(ret)));
+	if (destination->seekable)
+		LOG->warn("'{}' is seekable, it will be written as a stream all the same", url.string());
+	auto data = static_cast<unsigned char*>(av_malloc(stream_buffer_size));
+	if (data)
+		buffer = avio_alloc_context(data, stream_buffer_size, 1, this, nullptr, &StreamOutput::WritePacket, nullptr);
+	if (!buffer) {
+		av_free(data);
+		avio_closep(&destination);
+		throw std::runtime_error(fmt::format("failed to allocate output buffer for '{}'", url.string()));
+	}
+	// the muxer must not try to seek back, as in a file
+	buffer->seekable = 0;
+	LOG_EXIT_METHOD;
+}
+
+StreamOutput::~StreamOutput()
+{
+	LOG_ENTER_METHOD;
+	if (buffer) {
+		avio_flush(buffer);
+		av_freep(&buffer->buffer);
+		avio_context_free(&buffer);
+	}
+	avio_closep(&destination);
+	LOG_EXIT_METHOD;
+}
+
+int StreamOutput::WritePacket(void* opaque, uint8_t* buf, int buf_size)
+{
+	auto output = static_cast<StreamOutput*>(opaque);
+	auto write_start = std::chrono::steady_clock::now();
+	avio_write(output->destination, buf, buf_size);
+	// pass it on right away, so the reader gets the data as soon as the muxer lets go of it
+	avio_flush(output->destination);
+	output->blocked += std::chrono::steady_clock::now() - write_start;
+	if (output->destination->error < 0)
+		return output->destination->error;
+	output->bytes += buf_size;
+	return buf_size;
+}
+
+AVIOContext* StreamOutput::Context() const
+{
+	return buffer;
+}
+
+void StreamOutput::Report() const
+{
+	LOG_ENTER_METHOD;
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	auto blocked_seconds = std::chrono::duration<double>(blocked).count();
+	LOG->info(
+		"stream output {}: {:.1f} MB in {:.3f} seconds ({:.2f} MB/s), blocked on the reader for {:.3f} seconds ({:.1f}%)",
+		url.string(), bytes / 1e6, elapsed.count(), (elapsed.count() > 0) ? bytes / 1e6 / elapsed.count() : 0.0,
+		blocked_seconds, (elapsed.count() > 0) ? 100.0 * blocked_seconds / elapsed.count() : 0.0);
+	LOG_EXIT_METHOD;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "avcreate.h"
+
+#include <chrono>
+#include <filesystem>
+
+// Output to a pipe or socket, for handing an export straight to another process.
+// The muxer writes into a small buffer whose contents are passed on to the destination on every flush,
+// so the time spent waiting for the reader at the other end can be measured.
+class StreamOutput {
+private:
+	AVIOContext* destination; // the pipe or socket
+	AVIOContext* buffer;      // what the muxer writes to
+	std::chrono::steady_clock::time_point start;
+	std::chrono::nanoseconds blocked; // time spent writing to the destination
+	int64_t bytes;
+
+	static int WritePacket(void* opaque, uint8_t* buf, int buf_size);
+
+public:
+	const std::filesystem::path url;
+
+	// open the destination: pipe:, a fifo or named pipe, or a socket url such as unix:/path
+	StreamOutput(const std::filesystem::path& url);
+	~StreamOutput();
+	StreamOutput(const StreamOutput&) = delete;
+	StreamOutput& operator=(const StreamOutput&) = delete;
+
+	// context for the muxer, which must be set up with AVFMT_FLAG_CUSTOM_IO
+	AVIOContext* Context() const;
+
+	// log throughput, and time spent blocked on the reader
+	void Report() const;
+};
@@ -0,0 +1,119 @@
+#include "telemetry.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <new>
+
+auto TelemetryNow()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+std::string TelemetryName(const std::string& basename)
+{
+	// neither shared memory names on windows nor those on posix may contain a slash
+	std::string name{ SCRIPT_NAME "-" + basename };
+	std::replace(name.begin(), name.end(), '/', '_');
+	std::replace(name.begin(), name.end(), '\\', '_');
+	return name;
+}
+
+Telemetry::Telemetry(const std::string& name, bool create)
+	: memory{ name, sizeof(TelemetryBlock), create, false }
+	, block{ nullptr }
+	, writer{ create }
+	, video_window{ std::chrono::steady_clock::now(), 0 }
+	, audio_window{ std::chrono::steady_clock::now(), 0 }
+	, name{ name }
+{
+	LOG_ENTER_METHOD;
+	void* ptr = memory.Data();
+	if (create) {
+		// a previous export may have left its values behind
+		static_cast<TelemetryBlock*>(ptr)->magic.store(0);
+		block = new (ptr) TelemetryBlock{};
+		block->start_time.store(TelemetryNow(), std::memory_order_relaxed);
+		block->update_time.store(TelemetryNow(), std::memory_order_relaxed);
+		block->magic.store(TelemetryBlock::magic_value, std::memory_order_release);
+	}
+	else {
+		block = static_cast<TelemetryBlock*>(ptr);
+		if (block->magic.load(std::memory_order_acquire) != TelemetryBlock::magic_value || block->version != TelemetryBlock::version_value)
+			LOG->warn("telemetry {} is not initialized or has a different version", name);
+	}
+	LOG_EXIT_METHOD;
+}
+
+Telemetry::~Telemetry()
+{
+	LOG_ENTER_METHOD;
+	if (writer)
+		memory.Unlink();
+	LOG_EXIT_METHOD;
+}
+
+const TelemetryBlock& Telemetry::Block() const
+{
+	return *block;
+}
+
+TelemetryStreamBlock& Telemetry::StreamBlock(AVMediaType type)
+{
+	return (type == AVMEDIA_TYPE_VIDEO) ? block->video : block->audio;
+}
+
+Telemetry::RateWindow& Telemetry::Window(AVMediaType type)
+{
+	return (type == AVMEDIA_TYPE_VIDEO) ? video_window : audio_window;
+}
+
+void Telemetry::SetState(TelemetryState state)
+{
+	block->state.store(state, std::memory_order_relaxed);
+	block->update_time.store(TelemetryNow(), std::memory_order_relaxed);
+}
+
+void Telemetry::Expect(AVMediaType type, int64_t units)
+{
+	StreamBlock(type).expected.store(units, std::memory_order_relaxed);
+}
+
+void Telemetry::Received(AVMediaType type, int64_t units)
+{
+	auto& stream = StreamBlock(type);
+	auto received = stream.received.load(std::memory_order_relaxed) + units;
+	stream.received.store(received, std::memory_order_relaxed);
+	// update rate and eta about twice per second
+	auto& window = Window(type);
+	auto now = std::chrono::steady_clock::now();
+	std::chrono::duration<double> elapsed = now - window.time;
+	if (elapsed.count() >= 0.5) {
+		auto rate = (received - window.received) / elapsed.count();
+		stream.rate.store(rate, std::memory_order_relaxed);
+		auto expected = stream.expected.load(std::memory_order_relaxed);
+		stream.eta.store((expected > 0 && rate > 0) ? std::max(expected - received, int64_t{ 0 }) / rate : -1.0, std::memory_order_relaxed);
+		window.time = now;
+		window.received = received;
+		block->update_time.store(TelemetryNow(), std::memory_order_relaxed);
+	}
+}
+
+void Telemetry::Written(AVMediaType type, int64_t units, int64_t bytes, const AVRational& time_base, int64_t file_size)
+{
+	auto& stream = StreamBlock(type);
+	auto written = stream.written.load(std::memory_order_relaxed) + units;
+	auto total_bytes = stream.bytes.load(std::memory_order_relaxed) + bytes;
+	stream.written.store(written, std::memory_order_relaxed);
+	stream.packets.store(stream.packets.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	stream.bytes.store(total_bytes, std::memory_order_relaxed);
+	if (written > 0)
+		stream.bitrate.store(8.0 * total_bytes / (written * av_q2d(time_base)), std::memory_order_relaxed);
+	if (file_size >= 0)
+		block->file_size.store(file_size, std::memory_order_relaxed);
+}
+
+void Telemetry::SetSkew(double skew)
+{
+	block->skew.store(skew, std::memory_order_relaxed);
+}
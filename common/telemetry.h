@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "sharedmemory.h"
+
+extern "C" {
+#include <libavutil/avutil.h>
+}
+
+static_assert(std::atomic<int64_t>::is_always_lock_free, "telemetry requires lock free 64 bit atomics");
+static_assert(std::atomic<double>::is_always_lock_free, "telemetry requires lock free double atomics");
+
+enum class TelemetryState : int32_t {
+	Idle,
+	Exporting,
+	Finalizing,
+	Finished,
+	Cancelled,
+};
+
+// progress of a single stream
+// units are video frames, or audio samples at the sample rate of the encoder
+struct TelemetryStreamBlock {
+	std::atomic<int64_t> received{ 0 }; // units received from the game
+	std::atomic<int64_t> written{ 0 };  // units written to the muxer (received - written is the queue depth)
+	std::atomic<int64_t> packets{ 0 };  // packets written to the muxer
+	std::atomic<int64_t> bytes{ 0 };    // bytes of the packets written to the muxer
+	std::atomic<int64_t> expected{ 0 }; // units expected in total, 0 if unknown
+	std::atomic<double> rate{ 0.0 };    // recent units received per second
+	std::atomic<double> bitrate{ 0.0 }; // bits per second of written media
+	std::atomic<double> eta{ -1.0 };    // seconds until all expected units are received, negative if unknown
+};
+
+// layout of the shared memory block
+// only the process running the export writes to it, readers must not assume that fields are consistent with each other
+struct TelemetryBlock {
+	static constexpr uint32_t magic_value = 0x54455653; // "SVET"
+	static constexpr uint32_t version_value = 2;
+	std::atomic<uint32_t> magic{ 0 };   // set last, once the block is initialized
+	uint32_t version{ version_value };
+	std::atomic<TelemetryState> state{ TelemetryState::Idle };
+	std::atomic<int64_t> start_time{ 0 };  // microseconds since the unix epoch
+	std::atomic<int64_t> update_time{ 0 }; // microseconds since the unix epoch
+	std::atomic<int64_t> file_size{ 0 };   // bytes written to the output file
+	std::atomic<double> skew{ 0.0 };       // seconds between the fastest and the slowest stream in the interleaver
+	TelemetryStreamBlock video;
+	TelemetryStreamBlock audio;
+};
+
+// name of the shared memory block of the export with this basename, so every export has its own block
+std::string TelemetryName(const std::string& basename);
+
+// Publishes the progress of an export in a named shared memory block,
+// so external tools can follow the export without touching the log.
+// All updates are relaxed atomic stores, they never block the export.
+class Telemetry {
+private:
+	// writer side bookkeeping for the rate of a stream
+	struct RateWindow {
+		std::chrono::steady_clock::time_point time{ };
+		int64_t received{ 0 };
+	};
+
+	// the writer unlinks the block when the export is destroyed: readers that have it open still see how it ended
+	// (on linux the block lives on until they unmap it, on windows until they close it), later readers find nothing
+	SharedMemory memory;
+	TelemetryBlock* block;
+	bool writer;
+	RateWindow video_window;
+	RateWindow audio_window;
+
+	TelemetryStreamBlock& StreamBlock(AVMediaType type);
+	RateWindow& Window(AVMediaType type);
+
+public:
+	const std::string name;
+
+	// create (writable) or open (read only) the shared memory block with the given name
+	Telemetry(const std::string& name, bool create);
+
+	// the writer removes the name of the block, so no block is left behind once all readers are gone
+	~Telemetry();
+	Telemetry(const Telemetry&) = delete;
+	Telemetry& operator=(const Telemetry&) = delete;
+
+	const TelemetryBlock& Block() const;
+
+	// writer side updates
+	void SetState(TelemetryState state);
+	void Expect(AVMediaType type, int64_t units);
+	void Received(AVMediaType type, int64_t units);
+	void Written(AVMediaType type, int64_t units, int64_t bytes, const AVRational& time_base, int64_t file_size);
+	void SetSkew(double skew);
+};
@@ -0,0 +1,127 @@
+#include "threadpolicy.h"
+#include "logger.h"
+
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+std::istream& operator >> (std::istream& is, ThreadPriority& value)
+{
+	std::string value_str;
+	is >> value_str;
+	if (value_str == "normal") {
+		value = ThreadPriority::Normal;
+	}
+	else if (value_str == "below_normal") {
+		value = ThreadPriority::BelowNormal;
+	}
+	else if (value_str == "lowest") {
+		value = ThreadPriority::Lowest;
+	}
+	else if (value_str == "idle") {
+		value = ThreadPriority::Idle;
+	}
+	else {
+		is.setstate(std::ios::failbit);
+	}
+	return is;
+}
+
+#ifdef _WIN32
+auto GetWindowsPriority(ThreadPriority priority) {
+	switch (priority) {
+	case ThreadPriority::BelowNormal:
+		return THREAD_PRIORITY_BELOW_NORMAL;
+	case ThreadPriority::Lowest:
+		return THREAD_PRIORITY_LOWEST;
+	case ThreadPriority::Idle:
+		return THREAD_PRIORITY_IDLE;
+	default:
+		return THREAD_PRIORITY_NORMAL;
+	}
+}
+#else
+auto GetNiceLevel(ThreadPriority priority) {
+	switch (priority) {
+	case ThreadPriority::BelowNormal:
+		return 5;
+	case ThreadPriority::Lowest:
+		return 10;
+	case ThreadPriority::Idle:
+		return 19;
+	default:
+		return 0;
+	}
+}
+#endif
+
+void ApplyThreadPolicy(const ThreadPolicy& policy)
+{
+	LOG_ENTER;
+#ifdef _WIN32
+	if (policy.affinity && !SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(policy.affinity)))
+		LOG->warn("failed to set thread affinity mask {:x}", policy.affinity);
+	if (policy.priority != ThreadPriority::Normal && !SetThreadPriority(GetCurrentThread(), GetWindowsPriority(policy.priority)))
+		LOG->warn("failed to set thread priority");
+#else
+	if (policy.affinity) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		for (int i = 0; i < 64 && i < CPU_SETSIZE; i++)
+			if (policy.affinity & (uint64_t{ 1 } << i))
+				CPU_SET(i, &cpus);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus))
+			LOG->warn("failed to set thread affinity mask {:x}", policy.affinity);
+	}
+	if (policy.priority == ThreadPriority::Idle) {
+		sched_param param{ 0 };
+		if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param))
+			LOG->warn("failed to set idle scheduling policy");
+	}
+	// on linux, the nice level is a per thread attribute
+	auto nice_level = GetNiceLevel(policy.priority);
+	if (nice_level && setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), nice_level))
+		LOG->warn("failed to set thread nice level {}", nice_level);
+#endif
+	LOG_EXIT;
+}
+
+int RunWithThreadPolicy(const ThreadPolicy& policy, const std::function<int()>& func)
+{
+	LOG_ENTER;
+	int ret{ 0 };
+#ifdef _WIN32
+	// windows threads do not inherit priority nor affinity from the thread that creates them
+	ret = func();
+#else
+	if (!policy.affinity && policy.priority == ThreadPriority::Normal) {
+		ret = func();
+	}
+	else {
+		std::exception_ptr error{ nullptr };
+		std::thread thread{ [&] {
+			try {
+				ApplyThreadPolicy(policy);
+				ret = func();
+			}
+			catch (...) {
+				error = std::current_exception();
+			}
+		} };
+		thread.join();
+		if (error)
+			std::rethrow_exception(error);
+	}
+#endif
+	LOG_EXIT;
+	return ret;
+}
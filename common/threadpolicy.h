@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <istream>
+
+// scheduling priority of a thread, relative to normal threads of the game
+enum class ThreadPriority {
+	Normal,
+	BelowNormal,
+	Lowest,
+	Idle, // SCHED_IDLE on linux: only runs when a core has nothing else to do
+};
+
+// parse ThreadPriority
+std::istream& operator >> (std::istream& is, ThreadPriority& value);
+
+// placement and priority for a class of threads
+struct ThreadPolicy {
+	// cpu mask (bit i set means the thread may run on cpu i), 0 = all cpus
+	uint64_t affinity{ 0 };
+	ThreadPriority priority{ ThreadPriority::Normal };
+	// maximum number of threads, 0 = automatic
+	int threads{ 0 };
+};
+
+// policies for every class of thread used during an export
+struct ThreadPolicies {
+	ThreadPolicy conversion{ 0, ThreadPriority::Normal, 0 };     // pixel format conversion pool
+	ThreadPolicy codec{ 0, ThreadPriority::BelowNormal, 0 };     // encoder threads
+	ThreadPolicy finalize{ 0, ThreadPriority::BelowNormal, 0 };  // background finalization
+	ThreadPolicy verify{ 0, ThreadPriority::BelowNormal, 0 };    // decoders that verify lossless exports
+};
+
+// apply affinity and priority of the policy to the calling thread
+void ApplyThreadPolicy(const ThreadPolicy& policy);
+
+// run func on a new thread with the policy applied, and wait for it
+// threads created by func inherit the policy on linux (but not on windows)
+int RunWithThreadPolicy(const ThreadPolicy& policy, const std::function<int()>& func);
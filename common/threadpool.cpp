@@ -0,0 +1,106 @@
+#include "threadpool.h"
+#include "logger.h"
+
+ThreadPool::ThreadPool(int size, const ThreadPolicy& policy)
+	: threads{}
+	, job{ nullptr }
+	, next{ 0 }, total{ 0 }, pending{ 0 }
+	, generation{ 0 }
+	, stop{ false }
+	, error{ nullptr }
+	, policy{ policy }
+{
+	LOG_ENTER_METHOD;
+	for (int i = 1; i < size; i++)
+		threads.emplace_back(&ThreadPool::Worker, this);
+	LOG->debug("thread pool started with {} worker threads", threads.size());
+	LOG_EXIT_METHOD;
+}
+
+ThreadPool::~ThreadPool()
+{
+	LOG_ENTER_METHOD;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	work_cond.notify_all();
+	for (auto& thread : threads)
+		thread.join();
+	LOG_EXIT_METHOD;
+}
+
+void ThreadPool::Work()
+{
+	while (true) {
+		const std::function<void(int)>* func{ nullptr };
+		int i{ 0 };
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!job || next >= total)
+				return;
+			func = job;
+			i = next++;
+		}
+		try {
+			(*func)(i);
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!error)
+				error = std::current_exception();
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--pending == 0)
+				done_cond.notify_all();
+		}
+	}
+}
+
+void ThreadPool::Worker()
+{
+	ApplyThreadPolicy(policy);
+	unsigned int seen{ 0 };
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			work_cond.wait(lock, [&] { return stop || generation != seen; });
+			if (stop)
+				return;
+			seen = generation;
+		}
+		Work();
+	}
+}
+
+void ThreadPool::Run(int nb_jobs, const std::function<void(int)>& func)
+{
+	LOG_ENTER_METHOD;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job = &func;
+		next = 0;
+		total = nb_jobs;
+		pending = nb_jobs;
+		error = nullptr;
+		generation++;
+	}
+	work_cond.notify_all();
+	Work();
+	std::exception_ptr job_error{ nullptr };
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		done_cond.wait(lock, [&] { return pending == 0; });
+		job = nullptr;
+		job_error = error;
+	}
+	if (job_error)
+		std::rethrow_exception(job_error);
+	LOG_EXIT_METHOD;
+}
+
+int ThreadPool::Size() const
+{
+	return static_cast<int>(threads.size()) + 1;
+}
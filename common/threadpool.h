@@ -0,0 +1,48 @@
+#pragma once
+
+#include "threadpolicy.h"
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A small pool of worker threads for splitting work into independent jobs.
+// The calling thread participates in the work, so a pool of size n
+// creates n - 1 worker threads.
+class ThreadPool {
+private:
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable work_cond;
+	std::condition_variable done_cond;
+	const std::function<void(int)>* job;
+	int next;                 // index of next job to start
+	int total;                // total number of jobs
+	int pending;              // number of jobs not yet finished
+	unsigned int generation;  // incremented on every run, so workers know there is new work
+	bool stop;
+	std::exception_ptr error; // first exception thrown by a job
+	const ThreadPolicy policy; // applied to the worker threads
+
+	// process jobs until none are left
+	void Work();
+
+	// main loop of the worker threads
+	void Worker();
+
+public:
+	// set up pool with the given number of threads (including the calling thread)
+	// the policy is applied to the worker threads only, the calling thread is left as it is
+	ThreadPool(int size, const ThreadPolicy& policy);
+	~ThreadPool();
+
+	// call job(i) for i = 0, ..., nb_jobs - 1 concurrently
+	// returns when all jobs are finished, and rethrows the first exception thrown by any job
+	void Run(int nb_jobs, const std::function<void(int)>& job);
+
+	// number of threads (including the calling thread)
+	int Size() const;
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+// Static tracepoints on the encoding path, for profiling release builds with bpftrace or perf.
+// On linux, with <sys/sdt.h> available (systemtap-sdt-dev or systemtap-sdt-devel), these are USDT probes of provider sve:
+// a single nop each until a tracer attaches. Elsewhere, or with SVE_NO_TRACEPOINTS defined, they compile to nothing.
+// Arguments are integers; stream is the index of the stream in the export, and pts is in the codec time base
+// (frames for video, samples for audio), so that the probes of one frame can be matched across stages.
+//
+// frame_ingest(stream, units)              frame received from the game (units: 1 for video, samples for audio)
+// convert_start(stream, pts)               pixel format conversion or resampling starts
+// convert_end(stream, pts)                 and ends
+// send_frame(stream, pts)                  avcodec_send_frame is called (pts -1 when flushing)
+// send_frame_return(stream, pts, ret)      and returns
+// packet(stream, size, pts, keyframe)      packet received from the encoder
+// mux_write(stream, size, pts)             packet handed to the interleaver or muxer
+// mux_write_return(stream, pts)            and back (including muxing the packets that the interleaver releases)
+// flush_start()                            Format::Flush starts draining the encoders
+// flush_end(ret)                           trailer written, with the result of av_write_trailer
+//
+// Direct streams (rawvideo, pcm) bypass the encoder, so they fire no send_frame and packet probes.
+// Time that Interleaver::Wait holds a thread back is spent before its frame reaches the stream, so no probe covers it.
+// See tools/bpftrace for example scripts.
+
+#if defined(__linux__) && defined(__has_include) && !defined(SVE_NO_TRACEPOINTS)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SVE_TRACEPOINTS
+#endif
+#endif
+
+#ifdef SVE_TRACEPOINTS
+#define SVE_TRACE(...) STAP_PROBEV(sve, __VA_ARGS__)
+#else
+#define SVE_TRACE(...) ((void)0)
+#endif
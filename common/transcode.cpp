@@ -0,0 +1,125 @@
+#include "transcode.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+namespace {
+
+void Transcode(TranscodeJob& job, FormatOptions& options)
+{
+	LOG_ENTER;
+	LOG->info("job {} started", job.name);
+	auto start = std::chrono::steady_clock::now();
+	Source vsource{ job.video };
+	std::unique_ptr<Source> asource_ptr{ job.audio.empty() ? nullptr : std::make_unique<Source>(job.audio) };
+	auto& asource = asource_ptr ? *asource_ptr : vsource;
+	auto& vdec = vsource.VideoDecoder();
+	auto frame_rate = vsource.VideoFrameRate();
+	auto silence = !asource.HasAudio();
+	if (silence)
+		LOG->warn("job {} has no audio, using silence", job.name);
+	auto sample_fmt = silence ? AV_SAMPLE_FMT_S16 : asource.AudioDecoder().sample_fmt;
+	auto sample_rate = silence ? 44100 : asource.AudioDecoder().sample_rate;
+	auto channel_layout = silence ? AV_CH_LAYOUT_STEREO : asource.AudioDecoder().channel_layout;
+	options.streaming = job.streaming;
+	options.resampler = job.resampler;
+	options.regions = job.regions;
+	options.segments = job.segments;
+	options.verify = job.verify;
+	// every job publishes its progress under its own name
+	if (!options.telemetry.empty())
+		options.telemetry += "-" + job.name;
+	Format format{
+		job.filename,
+		*job.video_codec, job.video_codec_options, vdec.width, vdec.height, frame_rate, vdec.pix_fmt,
+		*job.audio_codec, job.audio_codec_options, sample_fmt, sample_rate, channel_layout,
+		options };
+	if (format.telemetry)
+		format.telemetry->Expect(AVMEDIA_TYPE_VIDEO, vsource.VideoFrameCount());
+	const auto atb = AVRational{ 1, sample_rate };
+	const auto vtb = av_inv_q(frame_rate);
+	auto video_done = false;
+	auto audio_done = false;
+	// feed audio and video in presentation order, as the game does
+	while (!video_done) {
+		if (!audio_done && av_compare_ts(job.nb_samples, atb, job.nb_frames, vtb) <= 0) {
+			if (silence) {
+				const auto nb_samples = 1024;
+				auto aframe = CreateAudioFrame(sample_fmt, sample_rate, channel_layout, nb_samples);
+				av_samples_set_silence(aframe->data, 0, nb_samples, aframe->channels, sample_fmt);
+				format.astream.Transcode(aframe);
+				job.nb_samples += nb_samples;
+			}
+			else if (auto aframe = asource.ReadFrame(AVMEDIA_TYPE_AUDIO)) {
+				format.astream.Transcode(aframe);
+				job.nb_samples += aframe->nb_samples;
+			}
+			else {
+				audio_done = true;
+			}
+		}
+		else if (auto vframe = vsource.ReadFrame(AVMEDIA_TYPE_VIDEO)) {
+			format.vstream.Transcode(vframe);
+			job.nb_frames++;
+		}
+		else {
+			video_done = true;
+		}
+	}
+	while (!silence && !audio_done) {
+		if (auto aframe = asource.ReadFrame(AVMEDIA_TYPE_AUDIO)) {
+			format.astream.Transcode(aframe);
+			job.nb_samples += aframe->nb_samples;
+		}
+		else {
+			audio_done = true;
+		}
+	}
+	format.Flush();
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	job.seconds = elapsed.count();
+	std::error_code ec;
+	if (format.segmenter)
+		job.size = format.segmenter->Size();
+	else
+		job.size = std::filesystem::file_size(job.filename, ec);
+	job.finished = true;
+	LOG->info(
+		"job {} finished in {:.2f} seconds: {} video frames, {} audio samples, {:.1f} fps",
+		job.name, job.seconds, job.nb_frames, job.nb_samples, job.nb_frames / job.seconds);
+	LOG_EXIT;
+}
+
+}
+
+void RunTranscodeJob(TranscodeJob& job, FormatOptions options)
+{
+	LOG_ENTER;
+	// the sources are closed once Transcode returns, so they can be deleted
+	Transcode(job, options);
+	if (job.delete_sources) {
+		for (const auto& source_filename : { job.video, job.audio }) {
+			if (source_filename.empty())
+				continue;
+			std::error_code ec;
+			if (std::filesystem::remove(source_filename, ec))
+				LOG->info("job {} deleted {}", job.name, source_filename.string());
+			else
+				LOG->error("job {} failed to delete {}", job.name, source_filename.string());
+		}
+	}
+	LOG_EXIT;
+}
+
+FormatOptions BackgroundTranscodeOptions(FormatOptions options)
+{
+	LOG_ENTER;
+	options.threads.codec.threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	options.threads.codec.priority = ThreadPriority::Lowest;
+	options.threads.conversion.priority = ThreadPriority::Lowest;
+	options.blend_frames = 1;
+	options.output = StreamOutputOptions{ };
+	LOG_EXIT;
+	return options;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "format.h"
+#include "source.h"
+
+// export of a video file (and possibly a separate audio file) with the given codecs,
+// as run by SimpleVideoExportBatch, and by the plugin for the second stage of a two stage export
+struct TranscodeJob {
+	std::string name;
+	std::filesystem::path video;
+	std::filesystem::path audio;
+	std::filesystem::path filename;
+	AVCodecPtr video_codec{ nullptr };
+	AVDictionaryPtr video_codec_options{ nullptr };
+	AVCodecPtr audio_codec{ nullptr };
+	AVDictionaryPtr audio_codec_options{ nullptr };
+	StreamingOptions streaming{ };
+	ResamplerOptions resampler{ };
+	StaticRegionOptions regions{ };
+	SegmentOptions segments{ };
+	bool verify{ false };
+	bool delete_sources{ false }; // delete video and audio files once the export is finished
+	// results
+	bool finished{ false };
+	int64_t nb_frames{ 0 };
+	int64_t nb_samples{ 0 };
+	double seconds{ 0.0 };
+	uintmax_t size{ 0 };
+};
+
+// read the sources and export them, audio and video in presentation order, as the game sends them
+// audio is taken from the video file if there is no audio file, and is silence if neither has audio
+void RunTranscodeJob(TranscodeJob& job, FormatOptions options);
+
+// options for transcoding an intermediate in the background: all cores for the encoder, but at the lowest priority,
+// and without blending, as the intermediate already is blended
+FormatOptions BackgroundTranscodeOptions(FormatOptions options);
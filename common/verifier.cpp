@@ -0,0 +1,324 @@
+#include "verifier.h"
+
+#include <algorithm>
+
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/samplefmt.h>
+}
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SVE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// the rounds of xxhash32, on 16 lanes of 32 bits that each take every 16th word
+constexpr uint32_t prime1 = 2654435761u;
+constexpr uint32_t prime2 = 2246822519u;
+constexpr uint32_t prime3 = 3266489917u;
+constexpr uint32_t prime4 = 668265263u;
+constexpr uint32_t prime5 = 374761393u;
+constexpr size_t nb_lanes = 16;
+
+inline uint32_t Rotl(uint32_t x, int r)
+{
+	return (x << r) | (x >> (32 - r));
+}
+
+// little endian, whatever the machine
+inline uint32_t Read32(const uint8_t* p)
+{
+	return uint32_t{ p[0] } | (uint32_t{ p[1] } << 8) | (uint32_t{ p[2] } << 16) | (uint32_t{ p[3] } << 24);
+}
+
+#ifdef SVE_SSE2
+// low 32 bits of the products of the four lanes (pmulld needs sse4.1)
+inline __m128i MulLo32(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+inline __m128i Round(__m128i acc, __m128i input)
+{
+	acc = _mm_add_epi32(acc, MulLo32(input, _mm_set1_epi32(static_cast<int>(prime2))));
+	acc = _mm_or_si128(_mm_slli_epi32(acc, 13), _mm_srli_epi32(acc, 19));
+	return MulLo32(acc, _mm_set1_epi32(static_cast<int>(prime1)));
+}
+#endif
+
+// hash the stripes of 64 bytes into the lanes, returns the number of bytes consumed
+size_t HashStripes(const uint8_t* data, size_t size, uint32_t* lanes)
+{
+	size_t x{ 0 };
+#ifdef SVE_SSE2
+	// four independent accumulators, so the multiplies of one hide the latency of the others
+	// (the bytes are little endian on every x86)
+	__m128i acc[nb_lanes / 4];
+	for (size_t i = 0; i < nb_lanes / 4; i++)
+		acc[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes + 4 * i));
+	for (; x + 4 * nb_lanes <= size; x += 4 * nb_lanes)
+		for (size_t i = 0; i < nb_lanes / 4; i++)
+			acc[i] = Round(acc[i], _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + x + 16 * i)));
+	for (size_t i = 0; i < nb_lanes / 4; i++)
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes + 4 * i), acc[i]);
+#else
+	for (; x + 4 * nb_lanes <= size; x += 4 * nb_lanes)
+		for (size_t i = 0; i < nb_lanes; i++)
+			lanes[i] = Rotl(lanes[i] + Read32(data + x + 4 * i) * prime2, 13) * prime1;
+#endif
+	return x;
+}
+
+}
+
+uint32_t HashBytes(const uint8_t* data, size_t size, uint32_t seed)
+{
+	uint32_t lanes[nb_lanes];
+	for (size_t i = 0; i < nb_lanes; i++)
+		lanes[i] = seed + prime1 * static_cast<uint32_t>(i + 1);
+	auto x = HashStripes(data, size, lanes);
+	auto hash = static_cast<uint32_t>(size);
+	for (size_t i = 0; i < nb_lanes; i++)
+		hash += Rotl(lanes[i], static_cast<int>(i + 1));
+	for (; x + 4 <= size; x += 4)
+		hash = Rotl(hash + Read32(data + x) * prime3, 17) * prime4;
+	for (; x < size; x++)
+		hash = Rotl(hash + data[x] * prime5, 11) * prime1;
+	hash ^= hash >> 15;
+	hash *= prime2;
+	hash ^= hash >> 13;
+	hash *= prime3;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+uint32_t HashFrame(const AVFrame& frame, AVMediaType type)
+{
+	uint32_t hash{ 0 };
+	if (type == AVMEDIA_TYPE_VIDEO) {
+		const uint32_t header[]{ static_cast<uint32_t>(frame.format), static_cast<uint32_t>(frame.width), static_cast<uint32_t>(frame.height) };
+		hash = HashBytes(reinterpret_cast<const uint8_t*>(header), sizeof(header), hash);
+		const auto pix_fmt = static_cast<AVPixelFormat>(frame.format);
+		const auto desc = av_pix_fmt_desc_get(pix_fmt);
+		if (!desc)
+			return hash;
+		for (int i = 0; i < av_pix_fmt_count_planes(pix_fmt); i++) {
+			auto row_bytes = av_image_get_linesize(pix_fmt, frame.width, i);
+			if (row_bytes <= 0 || !frame.data[i])
+				continue;
+			auto rows = (i == 1 || i == 2) ? AV_CEIL_RSHIFT(frame.height, desc->log2_chroma_h) : frame.height;
+			for (int y = 0; y < rows; y++)
+				hash = HashBytes(frame.data[i] + static_cast<ptrdiff_t>(y) * frame.linesize[i], row_bytes, hash);
+		}
+	}
+	else {
+		const uint32_t header[]{ static_cast<uint32_t>(frame.format), static_cast<uint32_t>(frame.channels), static_cast<uint32_t>(frame.nb_samples) };
+		hash = HashBytes(reinterpret_cast<const uint8_t*>(header), sizeof(header), hash);
+		const auto sample_fmt = static_cast<AVSampleFormat>(frame.format);
+		const auto nb_planes = av_sample_fmt_is_planar(sample_fmt) ? frame.channels : 1;
+		const auto size = av_samples_get_buffer_size(nullptr, frame.channels, frame.nb_samples, sample_fmt, 1);
+		if (size <= 0 || nb_planes <= 0)
+			return hash;
+		for (int i = 0; i < nb_planes; i++)
+			hash = HashBytes(frame.extended_data[i], size / nb_planes, hash);
+	}
+	return hash;
+}
+
+bool CodecIsLossless(const AVCodec& codec)
+{
+	auto desc = avcodec_descriptor_get(codec.id);
+	return desc && (desc->props & AV_CODEC_PROP_LOSSLESS) && !(desc->props & AV_CODEC_PROP_LOSSY);
+}
+
+Verifier::Verifier(const AVCodecContext& encoder, const ThreadPolicy& policy, const std::shared_ptr<MemoryAccount>& memory)
+	: mutex{ }, cond{ }, packets{ }, expected{ }, stopping{ false }, error{ }
+	, decoder{ nullptr }, memory{ memory }, thread{ }
+	, type{ encoder.codec_type }, policy{ policy }
+	, nb_verified{ 0 }, nb_mismatches{ 0 }, nb_missing{ 0 }, nb_extra{ 0 }, first_mismatch_pts{ AV_NOPTS_VALUE }
+	, max_queue{ 0 }, total_lag{ 0.0 }, max_lag{ 0.0 }, finish_wait{ 0.0 }
+{
+	LOG_ENTER_METHOD;
+	auto codec = avcodec_find_decoder(encoder.codec_id);
+	if (!codec)
+		throw std::runtime_error(fmt::format("no decoder to verify {}", encoder.codec->name));
+	decoder = CreateAVCodecContext(*codec);
+	// the parameters carry the extradata that the encoder wrote on opening
+	auto par = avcodec_parameters_alloc();
+	if (!par)
+		throw std::runtime_error("failed to allocate codec parameters");
+	int ret = avcodec_parameters_from_context(par, &encoder);
+	if (ret >= 0)
+		ret = avcodec_parameters_to_context(decoder.get(), par);
+	avcodec_parameters_free(&par);
+	if (ret < 0)
+		throw std::runtime_error(fmt::format("failed to set up {} decoder: {}", codec->name, AVErrorString(ret)));
+	decoder->pkt_timebase = encoder.time_base;
+	decoder->thread_count = policy.threads;
+	ret = RunWithThreadPolicy(policy, [&] { return avcodec_open2(decoder.get(), codec, nullptr); });
+	if (ret < 0)
+		throw std::runtime_error(fmt::format("failed to open {} decoder: {}", codec->name, AVErrorString(ret)));
+	LOG->info("verifying {} encoder with {} decoder", encoder.codec->name, codec->name);
+	thread = std::thread([this] { Run(); });
+	LOG_EXIT_METHOD;
+}
+
+Verifier::~Verifier()
+{
+	LOG_ENTER_METHOD;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	cond.notify_all();
+	if (thread.joinable())
+		thread.join();
+	LOG_EXIT_METHOD;
+}
+
+void Verifier::Run()
+{
+	ApplyThreadPolicy(policy);
+	auto frame = CreateAVFrame();
+	try {
+		auto eof{ false };
+		while (!eof) {
+			AVPacketPtr pkt{ nullptr };
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cond.wait(lock, [this] { return stopping || !packets.empty(); });
+				if (stopping)
+					break;
+				pkt = std::move(packets.front());
+				packets.pop_front();
+			}
+			eof = !pkt;
+			int ret = avcodec_send_packet(decoder.get(), pkt.get());
+			if (ret < 0)
+				throw std::runtime_error(fmt::format("failed to send packet to decoder: {}", AVErrorString(ret)));
+			while ((ret = avcodec_receive_frame(decoder.get(), frame.get())) >= 0) {
+				Check(*frame);
+				av_frame_unref(frame.get());
+			}
+			if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF)
+				throw std::runtime_error(fmt::format("failed to decode frame: {}", AVErrorString(ret)));
+		}
+	}
+	catch (std::exception& e) {
+		// the frames that are not decoded yet count as missing
+		std::lock_guard<std::mutex> lock(mutex);
+		error = e.what();
+		packets.clear();
+		LOG->error("{} verification stopped: {}", av_get_media_type_string(type), error);
+	}
+}
+
+void Verifier::Check(const AVFrame& frame)
+{
+	// hash outside the lock, so the encoding thread is not held up
+	const auto hash = HashFrame(frame, type);
+	const auto now = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock(mutex);
+	if (expected.empty()) {
+		nb_extra++;
+		return;
+	}
+	const auto sent = expected.front();
+	expected.pop_front();
+	std::chrono::duration<double> lag = now - sent.sent;
+	total_lag += lag;
+	max_lag = std::max(max_lag, lag);
+	if (hash == sent.hash) {
+		nb_verified++;
+		return;
+	}
+	if (nb_mismatches++ == 0) {
+		first_mismatch_pts = sent.pts;
+		if (frame.format != sent.format)
+			LOG->error(
+				"{} decoder returns format {} instead of {}",
+				av_get_media_type_string(type), frame.format, sent.format);
+		LOG->error("{} frame with pts {} does not survive the round trip", av_get_media_type_string(type), sent.pts);
+	}
+}
+
+void Verifier::Sent(const AVFrame& frame)
+{
+	LOG_ENTER_METHOD;
+	const auto hash = HashFrame(frame, type);
+	std::lock_guard<std::mutex> lock(mutex);
+	expected.push_back({ hash, frame.format, frame.pts, std::chrono::steady_clock::now() });
+	LOG_EXIT_METHOD;
+}
+
+void Verifier::Received(const AVPacket& pkt)
+{
+	LOG_ENTER_METHOD;
+	auto ref = CreateAVPacket();
+	int ret = av_packet_ref(ref.get(), &pkt);
+	if (ret < 0)
+		throw std::runtime_error(fmt::format("failed to reference packet for verification: {}", AVErrorString(ret)));
+	// charged until the decoder lets go of it, so a decoder that falls behind counts towards the memory limit
+	CountAVBuffer(ref->buf, memory, MemoryStage::Verifier);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!error.empty() || stopping) {
+			LOG_EXIT_METHOD;
+			return;
+		}
+		packets.push_back(std::move(ref));
+		max_queue = std::max(max_queue, packets.size());
+	}
+	cond.notify_all();
+	LOG_EXIT_METHOD;
+}
+
+void Verifier::Finish()
+{
+	LOG_ENTER_METHOD;
+	auto start = std::chrono::steady_clock::now();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (error.empty() && !stopping)
+			packets.push_back(nullptr);
+	}
+	cond.notify_all();
+	if (thread.joinable())
+		thread.join();
+	finish_wait = std::chrono::steady_clock::now() - start;
+	std::lock_guard<std::mutex> lock(mutex);
+	nb_missing += static_cast<int64_t>(expected.size());
+	expected.clear();
+	LOG_EXIT_METHOD;
+}
+
+bool Verifier::Passed() const
+{
+	return error.empty() && nb_mismatches == 0 && nb_missing == 0 && nb_extra == 0;
+}
+
+void Verifier::Report() const
+{
+	LOG_ENTER_METHOD;
+	const auto name = av_get_media_type_string(type);
+	LOG->info(
+		"verify {}: {} frames identical, {} mismatches, {} missing, {} extra",
+		name, nb_verified, nb_mismatches, nb_missing, nb_extra);
+	LOG->info(
+		"verify {}: lag {:.3f} seconds on average, {:.3f} at most, at most {} packets queued, {:.3f} seconds waited at the end",
+		name, (nb_verified + nb_mismatches > 0) ? total_lag.count() / (nb_verified + nb_mismatches) : 0.0,
+		max_lag.count(), max_queue, finish_wait.count());
+	if (Passed())
+		LOG->info("verify {}: passed", name);
+	else
+		LOG->error(
+			"verify {}: FAILED{}{}", name,
+			(first_mismatch_pts != AV_NOPTS_VALUE) ? fmt::format(", first mismatch at pts {}", first_mismatch_pts) : std::string{ },
+			error.empty() ? std::string{ } : ", " + error);
+	LOG_EXIT_METHOD;
+}
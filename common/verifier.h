@@ -0,0 +1,96 @@
+#pragma once
+
+#include "logger.h"
+#include "avcreate.h"
+#include "threadpolicy.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// hash of the bytes, the same on every machine, but computed on 16 lanes at once with sse2 where available
+uint32_t HashBytes(const uint8_t* data, size_t size, uint32_t seed);
+
+// hash of the pixels or samples of the frame, row by row, so padding does not count
+// the format and size are hashed as well, so frames that differ in those never compare equal
+uint32_t HashFrame(const AVFrame& frame, AVMediaType type);
+
+// whether the codec is lossless by nature (ffv1, flac, ...), so decoding its packets gives back exactly the frames sent to it
+// codecs that are only lossless in some modes, such as vp9 with lossless:1, do not count
+bool CodecIsLossless(const AVCodec& codec);
+
+// Inline round trip verification of a lossless encoder.
+// Every frame sent to the encoder is hashed, every packet that comes out of it is decoded again on a background thread,
+// and the hash of every decoded frame is compared with that of the frame sent, in order.
+// Usage:
+// * Create the verifier once the encoder is open.
+// * Call Sent with every frame just before it goes to the encoder,
+//   and Received with every packet that comes out of it (with timestamps in the codec time base).
+// * Call Finish once the encoder is flushed, then Report for the results.
+class Verifier {
+private:
+	// a frame sent to the encoder
+	struct Expected {
+		uint32_t hash;
+		int format;
+		int64_t pts;
+		std::chrono::steady_clock::time_point sent;
+	};
+
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::deque<AVPacketPtr> packets; // waiting for the decoder, nullptr flushes the decoder
+	std::deque<Expected> expected;   // frames sent to the encoder that were not decoded yet
+	bool stopping;
+	std::string error;               // why the decoder stopped early, empty if it did not
+	AVCodecContextPtr decoder;
+	std::shared_ptr<MemoryAccount> memory; // memory use of the export
+	std::thread thread;
+
+	// decode the packets as they come in
+	void Run();
+
+	// compare the decoded frame with the frame sent
+	void Check(const AVFrame& frame);
+
+public:
+	const AVMediaType type;
+	const ThreadPolicy policy;
+
+	// results, complete once finished
+	int64_t nb_verified;   // decoded frames identical to the frame sent
+	int64_t nb_mismatches; // decoded frames that differ from the frame sent
+	int64_t nb_missing;    // frames sent that never came out of the decoder
+	int64_t nb_extra;      // decoded frames without a frame sent
+	int64_t first_mismatch_pts; // AV_NOPTS_VALUE if none
+	size_t max_queue;      // most packets waiting for the decoder
+	std::chrono::duration<double> total_lag;  // from sending the frame to the encoder to verifying it, over all frames
+	std::chrono::duration<double> max_lag;
+	std::chrono::duration<double> finish_wait; // time that Finish waited for the decoder
+
+	// set up a decoder for the packets of the encoder, and start the thread that runs it with the policy
+	// the packets queued for the decoder are accounted to memory
+	Verifier(const AVCodecContext& encoder, const ThreadPolicy& policy, const std::shared_ptr<MemoryAccount>& memory);
+
+	// stops the thread without verifying the packets still waiting
+	~Verifier();
+	Verifier(const Verifier&) = delete;
+	Verifier& operator=(const Verifier&) = delete;
+
+	// hash the frame that is about to be sent to the encoder
+	void Sent(const AVFrame& frame);
+
+	// queue a reference to the packet for decoding, before it is counted for the muxer
+	void Received(const AVPacket& pkt);
+
+	// decode the packets that are still waiting, and flush the decoder
+	void Finish();
+
+	// every frame sent was decoded again, and identical
+	bool Passed() const;
+
+	// log the results
+	void Report() const;
+};
@@ -34,8 +34,96 @@ AVFramePtr CreateVideoFrame(int width, int height, AVPixelFormat pix_fmt, uint8_
 	return frame;
 }
 
-VideoStream::VideoStream(std::shared_ptr<AVFormatContext>& format_context, const AVCodec& codec, AVDictionaryPtr& options, int width, int height, const AVRational& frame_rate, AVPixelFormat pix_fmt)
-	: Stream{ format_context, codec }, pix_fmt{ pix_fmt }, dst_frame{ nullptr }
+// allocate a single buffer holding all planes without padding, i.e. laid out as av_image_copy_to_buffer with align 1
+void AllocVideoFrameBuffer(AVFrame& frame) {
+	LOG_ENTER;
+	auto pix_fmt = static_cast<AVPixelFormat>(frame.format);
+	int size = av_image_get_buffer_size(pix_fmt, frame.width, frame.height, 1);
+	if (size < 0)
+		throw std::runtime_error(fmt::format("failed to get image buffer size: {}", AVErrorString(size)));
+	av_buffer_unref(&frame.buf[0]);
+	frame.buf[0] = av_buffer_alloc(size);
+	if (!frame.buf[0])
+		throw std::runtime_error("failed to allocate frame buffer");
+	int ret = av_image_fill_arrays(frame.data, frame.linesize, frame.buf[0]->data, pix_fmt, frame.width, frame.height, 1);
+	if (ret < 0)
+		throw std::runtime_error(fmt::format("failed to fill image arrays: {}", AVErrorString(ret)));
+	LOG_EXIT;
+}
+
+// check whether the frame data is a single reference counted buffer laid out as av_image_copy_to_buffer with align 1
+auto IsVideoFrameContiguous(const AVFrame& frame, int size) {
+	LOG_ENTER;
+	if (!frame.buf[0] || frame.data[0] < frame.buf[0]->data || frame.data[0] + size > frame.buf[0]->data + frame.buf[0]->size) {
+		LOG_EXIT;
+		return false;
+	}
+	auto pix_fmt = static_cast<AVPixelFormat>(frame.format);
+	int linesize[4]{ 0 };
+	uint8_t* data[4]{ nullptr };
+	if (av_image_fill_linesizes(linesize, pix_fmt, frame.width) < 0 ||
+		av_image_fill_pointers(data, pix_fmt, frame.height, frame.data[0], linesize) < 0) {
+		LOG_EXIT;
+		return false;
+	}
+	for (int i = 0; i < 4; i++) {
+		if (frame.data[i] != data[i] || (data[i] && frame.linesize[i] != linesize[i])) {
+			LOG_EXIT;
+			return false;
+		}
+	}
+	LOG_EXIT;
+	return true;
+}
+
+AVPacketPtr CreateVideoPacket(const AVFrame& frame, const std::shared_ptr<MemoryAccount>& memory) {
+	LOG_ENTER;
+	auto pkt = CreateAVPacket();
+	auto pix_fmt = static_cast<AVPixelFormat>(frame.format);
+	int size = av_image_get_buffer_size(pix_fmt, frame.width, frame.height, 1);
+	if (size < 0)
+		throw std::runtime_error(fmt::format("failed to get image buffer size: {}", AVErrorString(size)));
+	if (IsVideoFrameContiguous(frame, size)) {
+		// zero copy: the packet shares the frame buffer
+		pkt->buf = av_buffer_ref(frame.buf[0]);
+		if (!pkt->buf)
+			throw std::runtime_error("failed to reference frame buffer");
+		pkt->data = frame.data[0];
+		pkt->size = size;
+	}
+	else {
+		int ret = av_new_packet(pkt.get(), size);
+		if (ret < 0)
+			throw std::runtime_error(fmt::format("failed to allocate packet: {}", AVErrorString(ret)));
+		ret = av_image_copy_to_buffer(pkt->data, size, frame.data, frame.linesize, pix_fmt, frame.width, frame.height, 1);
+		if (ret < 0)
+			throw std::runtime_error(fmt::format("failed to copy image to packet: {}", AVErrorString(ret)));
+		CountAVBuffer(pkt->buf, memory, MemoryStage::Muxer);
+	}
+	// same timestamps and flags as the rawvideo encoder, and a duration of one frame in the codec time base
+	pkt->pts = frame.pts;
+	pkt->dts = frame.pts;
+	pkt->duration = 1;
+	pkt->flags |= AV_PKT_FLAG_KEY;
+	LOG_EXIT;
+	return pkt;
+}
+
+// rawvideo only copies the image into the packet, unless it has to flip bits for the yuv2 tag or carries a palette
+// the encoder always sets a tag for the pixel format when it opens, only yuv2 on yuyv422 changes the bytes
+auto IsVideoCodecDirect(const AVCodecContext& context) {
+	auto pix_desc = av_pix_fmt_desc_get(context.pix_fmt);
+	auto flips = context.codec_tag == MKTAG('y', 'u', 'v', '2') && context.pix_fmt == AV_PIX_FMT_YUYV422;
+	return
+		context.codec->id == AV_CODEC_ID_RAWVIDEO && !flips &&
+		pix_desc && !(pix_desc->flags & AV_PIX_FMT_FLAG_PAL);
+}
+
+VideoStream::VideoStream(
+	std::shared_ptr<AVFormatContext>& format_context, const AVCodec& codec, AVDictionaryPtr& options, int width, int height, const AVRational& frame_rate, AVPixelFormat pix_fmt,
+	const ThreadPolicy& codec_policy, const ThreadPolicy& conversion_policy, const std::shared_ptr<MemoryAccount>& memory)
+	: Stream{ format_context, codec, memory }, pix_fmt{ pix_fmt }, dst_frame{ nullptr }, converter{ nullptr }, blender{ nullptr }
+	, changes{ nullptr }, static_qoffset{ 0, 1 }
 {
 	LOG_ENTER_METHOD;
 	if (context->codec->type != AVMEDIA_TYPE_VIDEO)
@@ -63,9 +151,7 @@ VideoStream::VideoStream(std::shared_ptr<AVFormatContext>& format_context, const
 			av_get_pix_fmt_name(pix_fmt),
 			av_get_pix_fmt_name(context->pix_fmt));
 	}
-	auto dict = options.release();
-	auto ret = avcodec_open2(context.get(), nullptr, &dict);
-	options.reset(dict);
+	auto ret = Open(options, codec_policy);
 	if (ret < 0)
 		throw std::runtime_error(fmt::format("failed to open video codec: {}", AVErrorString(ret)));
 	avcodec_parameters_from_context(stream->codecpar, context.get());
@@ -73,8 +159,21 @@ VideoStream::VideoStream(std::shared_ptr<AVFormatContext>& format_context, const
 	// avformat_write_header will set the final stream time_base
 	// see https://ffmpeg.org/doxygen/trunk/structAVStream.html#a9db755451f14e2bf590d4b85d82b32e6
 	stream->time_base = context->time_base;
-	dst_frame = CreateVideoFrame(width, height, context->pix_fmt);
+	direct = IsVideoCodecDirect(*context);
+	if (direct) {
+		LOG->info("codec {} output matches its input, bypassing encoder", context->codec->name);
+		dst_frame = CreateAVFrame();
+		dst_frame->width = width;
+		dst_frame->height = height;
+		dst_frame->format = context->pix_fmt;
+		AllocVideoFrameBuffer(*dst_frame);
+	}
+	else {
+		dst_frame = CreateVideoFrame(width, height, context->pix_fmt);
+	}
+	CountAVFrame(*dst_frame, memory, MemoryStage::Frames);
 	dst_frame->pts = 0;
+	converter = std::make_unique<Converter>(width, height, pix_fmt, context->pix_fmt, conversion_policy);
 	LOG_EXIT_METHOD;
 }
 
@@ -83,22 +182,71 @@ void VideoStream::Transcode(const AVFramePtr& src_frame)
 	LOG_ENTER_METHOD;
 	// nullptr means flushing the encoder
 	if (!src_frame) {
-		Encode(nullptr);
+		// a partial group at the end still becomes a frame, averaged over fewer frames
+		if (blender && blender->Pending() > 0)
+			TranscodeFrame(blender->Blend());
+		if (changes)
+			LOG->info("{:.1f}% of the blocks were static", 100.0 * changes->StaticFraction());
+		if (!direct)
+			Encode(nullptr);
+		LOG_EXIT_METHOD;
+		return;
+	}
+	SVE_TRACE(frame_ingest, stream->index, 1);
+	if (telemetry)
+		telemetry->Received(AVMEDIA_TYPE_VIDEO, 1);
+	if (blender) {
+		if (blender->Add(*src_frame))
+			TranscodeFrame(blender->Blend());
+	}
+	else {
+		TranscodeFrame(src_frame);
+	}
+	LOG_EXIT_METHOD;
+}
+
+void VideoStream::TranscodeFrame(const AVFramePtr& src_frame)
+{
+	LOG_ENTER_METHOD;
+	if (memory)
+		memory->Check();
+	// a new segment must start with a keyframe, which direct packets always are
+	const bool key = segmenter && segmenter->StartsSegment(dst_frame->pts);
+	// without conversion, the packet can be built straight from the source frame
+	if (direct && src_frame->format == dst_frame->format) {
+		auto pkt = CreateVideoPacket(*src_frame, memory);
+		pkt->pts = dst_frame->pts;
+		pkt->dts = dst_frame->pts;
+		Write(*pkt);
+		dst_frame->pts += 1;
 		LOG_EXIT_METHOD;
 		return;
 	}
+	// the muxer may still hold a reference to the buffer of the previous direct packet
+	if (direct && !av_frame_is_writable(dst_frame.get())) {
+		AllocVideoFrameBuffer(*dst_frame);
+		CountAVFrame(*dst_frame, memory, MemoryStage::Frames);
+	}
 	// fill frame with data given in ptr
-	// we use sws_scale to do this, this will also take care of any pixel format conversions
-	auto sws = CreateSwsContext(
-		src_frame->width, src_frame->height, static_cast<AVPixelFormat>(src_frame->format),
-		dst_frame->width, dst_frame->height, static_cast<AVPixelFormat>(dst_frame->format),
-		SWS_BICUBIC);
-	sws_scale(
-		sws.get(),
-		src_frame->data, src_frame->linesize, 0, src_frame->height,
-		dst_frame->data, dst_frame->linesize);
+	// the converter uses sws_scale to do this, this will also take care of any pixel format conversions
+	SVE_TRACE(convert_start, stream->index, dst_frame->pts);
+	converter->Convert(*src_frame, *dst_frame);
+	SVE_TRACE(convert_end, stream->index, dst_frame->pts);
+	// hint the encoder at the blocks that did not change
+	if (changes && !direct) {
+		changes->Update(*dst_frame);
+		if (static_qoffset.num)
+			changes->AttachRegions(*dst_frame, static_qoffset);
+	}
 	// now encode the frame
-	Encode(dst_frame);
+	if (direct) {
+		auto pkt = CreateVideoPacket(*dst_frame, memory);
+		Write(*pkt);
+	}
+	else {
+		dst_frame->pict_type = key ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+		Encode(dst_frame);
+	}
 	// update destination frame timestamp
 	dst_frame->pts += 1;
 	LOG_EXIT_METHOD;
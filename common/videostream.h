@@ -1,6 +1,9 @@
 #pragma once
 
 #include "stream.h"
+#include "blender.h"
+#include "changemap.h"
+#include "converter.h"
 
 // create a video frame with empty buffer
 AVFramePtr CreateVideoFrame(int width, int height, AVPixelFormat pix_fmt);
@@ -18,11 +21,30 @@ private:
 	// frame for encoder (converted from the src_frame)
 	AVFramePtr dst_frame;
 
+	// conversion from pix_fmt to the codec pixel format
+	std::unique_ptr<Converter> converter;
+
+	// convert and encode a single frame
+	void TranscodeFrame(const AVFramePtr& src_frame);
+
 public:
+	// averages frames before they are encoded, nullptr if every frame is encoded as is
+	// the frame rate passed to the constructor must be the rate after blending
+	std::unique_ptr<FrameBlender> blender;
+
+	// finds the static blocks of every encoded frame, nullptr to skip this
+	std::unique_ptr<ChangeMap> changes;
+
+	// quantizer offset of the static blocks, which are attached to the frame as regions of interest if the codec honours them
+	AVRational static_qoffset;
+
 	// set up stream with the given parameters
-	VideoStream(std::shared_ptr<AVFormatContext>& format_context, const AVCodec& codec, AVDictionaryPtr& options, int width, int height, const AVRational& frame_rate, AVPixelFormat pix_fmt);
+	VideoStream(
+		std::shared_ptr<AVFormatContext>& format_context, const AVCodec& codec, AVDictionaryPtr& options, int width, int height, const AVRational& frame_rate, AVPixelFormat pix_fmt,
+		const ThreadPolicy& codec_policy, const ThreadPolicy& conversion_policy, const std::shared_ptr<MemoryAccount>& memory);
 
 	// encode the frame to a format that is compatible with the codec
 	// (needs to match width, height, and pix_fmt, as specified in constructor)
+	// with a blender, only every nb_frames-th call encodes a frame, and flushing encodes what is left
 	void Transcode(const AVFramePtr& src_frame);
 };
@@ -1,33 +1,90 @@
 /*
 Main entry point for attaching and detaching the mod.
 
-Attach:
+Attach runs under the loader lock while the game starts, so it only does the
+minimum:
 
-1. Get all settings from the ini file.
-2. Set up the logger with corresponding settings.
-3. Hook MFCreateSinkWriterFromURL.
+1. Hook MFCreateSinkWriterFromURL, keeping the reason if that fails.
+2. If warmup = true in the ini file, start a thread that initializes the rest
+   in the background, as soon as the loader lock is released.
+
+Everything else is initialized once, by Initialize, either on the warm-up
+thread or at the first export, whichever comes first:
+
+1. Set up the logger.
+2. Get all settings from the ini file, and compile its presets (this looks up
+   the codecs and checks their options).
+3. On the warm-up thread, probe the encoders of all presets, so that exports
+   find them in the codec probe cache rather than probe on the game thread.
+4. Log how long attach took, and why hooking failed if it did.
 
 Detach:
 
 1. Unhook MFCreateSinkWriterFromURL.
-2. Clean up settings
-3. Clean up logger.
+2. Abandon exports that are still being finalized, logging their files. The
+   plugin is pinned once a finalization starts, so this only happens when the
+   process terminates, after all other threads are gone.
+3. Clean up settings
+4. Flush the logger.
 */
 
 #include "sinkwriter.h"
 #include "logger.h"
 #include "settings.h"
 
+#include <chrono>
+#include <mutex>
+
 #pragma comment(lib, "common.lib")
 
 std::shared_ptr<spdlog::logger> logger = nullptr;
 std::unique_ptr<Settings> settings = nullptr;
 
-BOOL APIENTRY DllMain(HMODULE hInstance, DWORD reason, LPVOID lpReserved)
+namespace {
+
+std::once_flag initialized;
+std::chrono::steady_clock::duration attach_time{ 0 };
+bool hooked{ false };
+std::string hook_error{ }; // why hooking failed, logged once the logger is set up
+bool warmup{ false };
+
+// read the warmup flag straight from the ini file, as the settings are not loaded yet
+// GetPrivateProfileString only needs kernel32, so it is safe under the loader lock
+bool GetWarmup()
 {
-	switch (reason)
-	{
-	case DLL_PROCESS_ATTACH:
+	wchar_t value[16]{ };
+	auto ini_filename = std::filesystem::absolute(Settings::ini_filename_);
+	GetPrivateProfileStringW(L"export", L"warmup", L"false", value, 16, ini_filename.c_str());
+	return _wcsicmp(value, L"true") == 0;
+}
+
+DWORD WINAPI WarmupThread(LPVOID module)
+{
+	Initialize();
+	// release the reference taken on attach, so the plugin can unload after the thread is gone
+	FreeLibraryAndExitThread(static_cast<HMODULE>(module), 0);
+}
+
+// start the warm-up thread, which keeps a reference to the plugin while it runs
+// the thread only starts running once the loader lock is released
+void StartWarmup()
+{
+	HMODULE module = nullptr;
+	if (!GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS, reinterpret_cast<LPCWSTR>(&WarmupThread), &module))
+		return;
+	auto thread = CreateThread(nullptr, 0, &WarmupThread, module, 0, nullptr);
+	if (thread)
+		CloseHandle(thread);
+	else
+		FreeLibrary(module);
+}
+
+}
+
+void Initialize()
+{
+	std::call_once(initialized, [] {
+		auto start = std::chrono::steady_clock::now();
 		/* set up logger */
 		logger = spdlog::rotating_logger_mt(
 			SCRIPT_NAME, SCRIPT_NAME ".log", 10000000, 5);
@@ -35,23 +92,57 @@ BOOL APIENTRY DllMain(HMODULE hInstance, DWORD reason, LPVOID lpReserved)
 		AVLogSetCallback();
 		PLHLogSetCallback();
 		/* load settings */
-		settings = std::make_unique<Settings>();
+		try {
+			settings = std::make_unique<Settings>(Presets().Refresh());
+		}
+		LOG_CATCH;
+		/* probe encoders */
+		try {
+			if (warmup && settings && settings->presets)
+				for (const auto& [name, preset] : settings->presets->presets)
+					CheckPreset(*preset);
+		}
+		LOG_CATCH;
 		LOG_ENTER;
+		std::chrono::duration<double, std::milli> attach_ms = attach_time;
+		std::chrono::duration<double, std::milli> init_ms = std::chrono::steady_clock::now() - start;
+		LOG->info(
+			SCRIPT_NAME " started: attached in {:.3f} ms, initialized in {:.3f} ms {}",
+			attach_ms.count(), init_ms.count(), warmup ? "on warm-up thread" : "at first export");
+		if (!hooked)
+			LOG->critical("failed to hook MFCreateSinkWriterFromURL: {}; in-game video export will be used", hook_error);
+	});
+}
+
+BOOL APIENTRY DllMain(HMODULE hInstance, DWORD reason, LPVOID lpReserved)
+{
+	switch (reason)
+	{
+	case DLL_PROCESS_ATTACH:
+	{
+		auto start = std::chrono::steady_clock::now();
 		/* set up hooks */
-		Hook();
-		LOG->info(SCRIPT_NAME " started");
+		hooked = Hook(hook_error);
+		/* initialize the rest in the background if requested, or anyway if hooking failed, to log why */
+		warmup = GetWarmup() || !hooked;
+		if (warmup)
+			StartWarmup();
+		attach_time = std::chrono::steady_clock::now() - start;
 		break;
+	}
 	case DLL_PROCESS_DETACH:
 		/* clean up hooks */
 		Unhook();
+		/* abandon pending finalizations */
+		StopFinalizer();
 		/* clean up settings */
 		settings = nullptr;
-		/* clean up logger */
+		/* flush the logger, but keep it: threads that run plugin code may still log until they are gone */
 		LOG->info(SCRIPT_NAME " stopped");
 		LOG_EXIT;
-		logger = nullptr;
-		spdlog::drop(SCRIPT_NAME);
+		if (logger)
+			logger->flush();
 		break;
-	}		
+	}
 	return TRUE;
 }
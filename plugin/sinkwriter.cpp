@@ -1,10 +1,13 @@
 /*
 Hooks into media foundation's sink writer for intercepting video/audio data.
 
-The main entry point is CreateSinkWriterFromURL. This reloads the ini file (so
-we always have the latest settings; coincidently this also updates the
-timestamp), checks if the mod is enabled, and sets up all the required
-SinkWriter hooks.
+The main entry point is CreateSinkWriterFromURL. On the first export, this
+initializes the plugin, unless the warm-up thread already did so (see
+dllmain.cpp). It then reloads the settings (so we always have the latest
+settings; coincidently this also updates the timestamp), recompiling the
+presets only if the ini file changed, checks if the mod is enabled, and sets
+up all the required SinkWriter hooks. A preset with codec options that its
+codec rejects fails here, so the in-game export is used instead.
 
 Under normal circumstances, the game will then call SinkWriterSetInputMediaType
 twice, once for the audio, and once for the video. At this point, we intercept
@@ -24,7 +27,30 @@ format_mutex. For safety, we lock this mutex whenever we access format.
 At the end of the export process, the game calls SinkWriterFinalize if the
 export finished normally, or Flush if the export is cancelled. There we
 flush the encoder, clear the format (this will finalize the file), and unhook
-all the SinkWriter hooks.
+all the SinkWriter hooks. On SinkWriterFlush, the encoders are not drained:
+depending on the cancel setting, the partial file is deleted or kept as it is.
+On SinkWriterFinalize, the format is handed over to
+the finalizer, which flushes the encoder and writes the trailer on a
+background thread, so the game does not have to wait for it. A new export can
+start while previous exports are still being finalized.
+
+If the preset has an intermediate preset, the game exports with the
+intermediate preset instead, and once the finalizer has written the
+intermediate file, it transcodes it to the requested preset on the same
+background thread, at the lowest priority but on all cores, and deletes the
+intermediate.
+
+If recording is enabled, all of the above calls are also written, with their
+raw samples and arrival times, to a recording that SimpleVideoExportTest can
+replay without the game.
+
+If the worker is enabled, SinkWriterBeginWriting creates a frame ring in
+shared memory instead of the format, and starts SimpleVideoExportWorker, which
+creates the format in its own process. SinkWriterWriteSample then only copies
+the samples into the ring (still under format_mutex, as the ring has a single
+producer), and SinkWriterFinalize and SinkWriterFlush close the ring, after
+which the worker finalizes or cancels the export on its own. Finalize closes
+the ring on a thread of its own, as it waits for the worker to open the ring.
 */
 
 #include "sinkwriter.h"
@@ -33,8 +59,14 @@ all the SinkWriter hooks.
 #include "hook.h"
 #include "info.h"
 #include "format.h"
+#include "finalizer.h"
+#include "framering.h"
+#include "recording.h"
+#include "transcode.h"
 
+#include <chrono>
 #include <mutex>
+#include <thread>
 
 #include <winrt/base.h> // com_ptr
 
@@ -59,6 +91,32 @@ std::unique_ptr<AudioInfo> audio_info = nullptr;
 std::unique_ptr<VideoInfo> video_info = nullptr;
 std::unique_ptr<Format> format = nullptr;
 std::mutex format_mutex;
+bool format_failed = false; // format was cancelled because the export failed, drop further samples
+std::unique_ptr<Finalizer> finalizer = nullptr;
+std::unique_ptr<Recorder> recorder = nullptr;
+std::unique_ptr<FrameRing> ring = nullptr; // replaces format if the worker is enabled
+
+PresetRegistry& Presets()
+{
+	static PresetRegistry registry{ Settings::ini_filename_ };
+	return registry;
+}
+
+// background finalization runs plugin code after the game returns from Finalize,
+// so keep the plugin loaded until the process exits
+void PinModule()
+{
+	LOG_ENTER;
+	static std::once_flag pinned;
+	std::call_once(pinned, [] {
+		HMODULE module = nullptr;
+		if (!GetModuleHandleExW(
+			GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_PIN,
+			reinterpret_cast<LPCWSTR>(&PinModule), &module))
+			LOG->error("failed to pin plugin module");
+	});
+	LOG_EXIT;
+}
 
 void UnhookVFuncDetours()
 {
@@ -69,7 +127,9 @@ void UnhookVFuncDetours()
 	{
 		std::lock_guard<std::mutex> lock(format_mutex);
 		format = nullptr;
+		ring = nullptr;
 	}
+	recorder = nullptr;
 	LOG_EXIT;
 }
 
@@ -81,6 +141,68 @@ void Unhook()
 	LOG_EXIT;
 }
 
+void StopFinalizer()
+{
+	LOG_ENTER;
+	if (finalizer) {
+		// the plugin is pinned once a finalization starts, so this only runs as the process terminates,
+		// when all other threads are already gone: abandon them so destruction does not block
+		finalizer->Abandon();
+		finalizer = nullptr;
+	}
+	LOG_EXIT;
+}
+
+// start the encoder worker for the ring, from the folder of the plugin
+// the worker runs in the working directory of the game, so it reads the same ini file
+void StartWorker(const std::string& ring_name)
+{
+	LOG_ENTER;
+	HMODULE module = nullptr;
+	if (!GetModuleHandleExW(
+		GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+		reinterpret_cast<LPCWSTR>(&StartWorker), &module))
+		throw std::runtime_error("failed to get plugin module");
+	std::wstring module_path(MAX_PATH, L'\0');
+	auto length = GetModuleFileNameW(module, module_path.data(), static_cast<DWORD>(module_path.size()));
+	if (length == 0 || length == module_path.size())
+		throw std::runtime_error("failed to get plugin path");
+	module_path.resize(length);
+	std::filesystem::path worker_path{ module_path };
+	worker_path.replace_filename(SCRIPT_NAME "Worker.exe");
+	auto command_line = L"\"" + worker_path.wstring() + L"\" " + std::filesystem::path{ ring_name }.wstring();
+	STARTUPINFOW startup_info{ sizeof(startup_info) };
+	PROCESS_INFORMATION process_info{ };
+	if (!CreateProcessW(
+		worker_path.c_str(), command_line.data(), nullptr, nullptr, FALSE,
+		CREATE_NO_WINDOW, nullptr, nullptr, &startup_info, &process_info))
+		throw std::runtime_error(fmt::format("failed to start {}: {}", worker_path.string(), std::system_category().message(GetLastError())));
+	// the ring checks whether the worker is alive by its process id
+	CloseHandle(process_info.hThread);
+	CloseHandle(process_info.hProcess);
+	LOG->info("started worker {} for ring {}", process_info.dwProcessId, ring_name);
+	LOG_EXIT;
+}
+
+// hold back the calling thread while its stream runs too far ahead of the other stream
+// this waits outside format_mutex, so the other thread can catch up in the meantime
+void WaitForInterleaver(AVMediaType type)
+{
+	LOG_ENTER;
+	std::shared_ptr<Interleaver> interleaver{ nullptr };
+	int stream_index{ 0 };
+	{
+		std::lock_guard<std::mutex> lock(format_mutex);
+		if (format) {
+			interleaver = format->interleaver;
+			stream_index = (type == AVMEDIA_TYPE_VIDEO) ? format->vstream.stream->index : format->astream.stream->index;
+		}
+	}
+	if (interleaver)
+		interleaver->Wait(stream_index);
+	LOG_EXIT;
+}
+
 STDAPI SinkWriterSetInputMediaType(
 	IMFSinkWriter *pThis,
 	DWORD         dwStreamIndex,
@@ -101,9 +223,13 @@ STDAPI SinkWriterSetInputMediaType(
 		THROW_FAILED(pInputMediaType->GetMajorType(&major_type));
 		if (major_type == MFMediaType_Audio) {
 			audio_info = std::make_unique<AudioInfo>(dwStreamIndex, *pInputMediaType);
+			if (recorder)
+				recorder->WriteAudioType(dwStreamIndex, audio_info->sample_fmt, audio_info->sample_rate, audio_info->channel_layout);
 		}
 		else if (major_type == MFMediaType_Video) {
 			video_info = std::make_unique<VideoInfo>(dwStreamIndex, *pInputMediaType);
+			if (recorder)
+				recorder->WriteVideoType(dwStreamIndex, video_info->width, video_info->height, video_info->frame_rate, video_info->pix_fmt);
 		}
 		else {
 			LOG->debug("unknown stream at index {}", dwStreamIndex);
@@ -127,12 +253,29 @@ STDAPI SinkWriterBeginWriting(
 	}
 	LOG_CATCH;
 	try {
-		if (settings && audio_info && video_info) {
+		if (recorder)
+			recorder->Write(RecordType::BeginWriting, 0, nullptr, 0);
+		if (settings && audio_info && video_info && settings->worker) {
+			std::lock_guard<std::mutex> lock(format_mutex);
+			format_failed = false;
+			FrameRingFormat ring_format{
+				video_info->width, video_info->height, video_info->pix_fmt, video_info->frame_rate,
+				audio_info->sample_fmt, audio_info->sample_rate, audio_info->channel_layout };
+			auto u8_filename{ settings->export_filename.u8string() };
+			if (u8_filename.size() >= sizeof(ring_format.filename))
+				throw std::runtime_error("export filename too long for worker");
+			std::copy(u8_filename.begin(), u8_filename.end(), ring_format.filename);
+			ring = std::make_unique<FrameRing>(FrameRingName(), ring_format, settings->worker_slots, settings->worker_timeout);
+			StartWorker(ring->name);
+		}
+		else if (settings && audio_info && video_info) {
 			std::lock_guard<std::mutex> lock(format_mutex);
+			format_failed = false;
 			format = std::make_unique<Format>(
 				settings->export_filename,
 				*settings->video_codec, settings->video_codec_options, video_info->width, video_info->height, video_info->frame_rate, video_info->pix_fmt,
-				*settings->audio_codec, settings->audio_codec_options, audio_info->sample_fmt, audio_info->sample_rate, audio_info->channel_layout);
+				*settings->audio_codec, settings->audio_codec_options, audio_info->sample_fmt, audio_info->sample_rate, audio_info->channel_layout,
+				settings->format_options);
 		}
 		else {
 			throw std::runtime_error("cannot initialize format: missing settings or info structures");
@@ -151,7 +294,7 @@ STDAPI SinkWriterWriteSample(
 	LOG_ENTER;
 	try {
 		// write our audio or video sample; note: this will clear the sample as well
-		if (!format) {
+		if (!format && !ring && !format_failed) {
 			throw std::runtime_error("format not initialized");
 		}
 		winrt::com_ptr<IMFMediaBuffer> p_media_buffer = nullptr;
@@ -159,6 +302,8 @@ STDAPI SinkWriterWriteSample(
 		DWORD buffer_length = 0;
 		THROW_FAILED(pSample->ConvertToContiguousBuffer(p_media_buffer.put()));
 		THROW_FAILED(p_media_buffer->Lock(&p_buffer, NULL, &buffer_length));
+		if (recorder)
+			recorder->Write(RecordType::Sample, dwStreamIndex, p_buffer, buffer_length);
 		if (audio_info && dwStreamIndex == audio_info->stream_index) {
 			LOG->debug("transcoding {} bytes to audio stream", buffer_length);
 			int bytes_per_sample = av_get_bytes_per_sample(audio_info->sample_fmt);
@@ -171,8 +316,12 @@ STDAPI SinkWriterWriteSample(
 			else {
 				auto frame = CreateAudioFrame(
 					audio_info->sample_fmt, audio_info->sample_rate, audio_info->channel_layout, nb_samples, p_buffer);
+				WaitForInterleaver(AVMEDIA_TYPE_AUDIO);
 				std::lock_guard<std::mutex> lock(format_mutex);
-				format->astream.Transcode(frame);
+				if (format)
+					format->astream.Transcode(frame);
+				else if (ring)
+					ring->WriteAudio(*frame);
 			}
 		}
 		if (video_info && dwStreamIndex == video_info->stream_index) {
@@ -186,13 +335,41 @@ STDAPI SinkWriterWriteSample(
 			else {
 				auto frame = CreateVideoFrame(
 					video_info->width, video_info->height, video_info->pix_fmt, p_buffer);
+				WaitForInterleaver(AVMEDIA_TYPE_VIDEO);
 				std::lock_guard<std::mutex> lock(format_mutex);
-				format->vstream.Transcode(frame);
+				if (format)
+					format->vstream.Transcode(frame);
+				else if (ring)
+					ring->WriteVideo(*frame);
 			}
 		}
 		memset(p_buffer, 0, buffer_length); // clear sample so game will output blank video/audio
 		THROW_FAILED(p_media_buffer->Unlock());
 	}
+	catch (MemoryLimitError& e) {
+		// stop before the game runs out of memory, the game itself carries on with its blank export
+		LOG->error(e.what());
+		try {
+			std::lock_guard<std::mutex> lock(format_mutex);
+			if (format) {
+				format_failed = true;
+				format->Cancel();
+				format = nullptr;
+				LOG->error("export cancelled");
+			}
+		}
+		LOG_CATCH;
+	}
+	catch (FrameRingError& e) {
+		// a worker that is gone will not come back, so stop feeding it
+		LOG->error(e.what());
+		std::lock_guard<std::mutex> lock(format_mutex);
+		if (ring) {
+			format_failed = true;
+			ring = nullptr;
+			LOG->error("export cancelled");
+		}
+	}
 	LOG_CATCH;
 	auto hr = E_FAIL;
 	try {
@@ -213,11 +390,23 @@ STDAPI SinkWriterFlush(
 {
 	LOG_ENTER;
 	try {
-		LOG->info("flushing transcoder");
+		LOG->info("cancelling transcoder");
+		if (recorder)
+			recorder->Write(RecordType::Flush, dwStreamIndex, nullptr, 0);
 		if (format) {
-			std::lock_guard<std::mutex> lock(format_mutex);
-			format->Flush();
-			format = nullptr;
+			auto start = std::chrono::steady_clock::now();
+			{
+				std::lock_guard<std::mutex> lock(format_mutex);
+				format->Cancel();
+				format = nullptr;
+			}
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			LOG->info("transcoder cancelled in {:.3f} seconds", elapsed.count());
+		}
+		std::lock_guard<std::mutex> lock(format_mutex);
+		if (ring) {
+			ring->Close(FrameRingState::Cancelled);
+			ring = nullptr;
 		}
 	}
 	LOG_CATCH;
@@ -242,11 +431,49 @@ STDAPI SinkWriterFinalize(
 	LOG_ENTER;
 	auto hr = E_FAIL;
 	try {
-		LOG->info("flushing transcoder");
+		if (recorder)
+			recorder->Write(RecordType::Finalize, 0, nullptr, 0);
 		if (format) {
+			std::unique_ptr<Format> finished_format{ nullptr };
+			{
+				std::lock_guard<std::mutex> lock(format_mutex);
+				finished_format = std::move(format);
+			}
+			LOG->info("handing transcoder over to finalizer");
+			PinModule();
+			if (!finalizer)
+				finalizer = std::make_unique<Finalizer>();
+			std::function<void()> then{ nullptr };
+			if (settings && settings->transcode) {
+				// second stage of a two stage export, once the intermediate is complete
+				std::shared_ptr<TranscodeJob> job{ std::move(settings->transcode) };
+				then = [job, options = BackgroundTranscodeOptions(settings->format_options)] {
+					try {
+						RunTranscodeJob(*job, options);
+					}
+					catch (std::exception& e) {
+						LOG->error("transcoding {} failed, intermediate kept: {}", job->video.string(), e.what());
+					}
+				};
+			}
+			finalizer->Start(std::move(finished_format), std::move(then));
+		}
+		std::unique_ptr<FrameRing> finished_ring{ nullptr };
+		{
 			std::lock_guard<std::mutex> lock(format_mutex);
-			format->Flush();
-			format = nullptr;
+			finished_ring = std::move(ring);
+		}
+		if (finished_ring) {
+			// closing waits until the worker has opened the ring, which must not hold up the game
+			LOG->info("handing transcoder over to worker");
+			PinModule();
+			std::thread([finished_ring = std::move(finished_ring)]() mutable {
+				try {
+					finished_ring->Close(FrameRingState::Finished);
+				}
+				LOG_CATCH;
+				finished_ring = nullptr;
+			}).detach();
 		}
 		if (!sinkwriter_hook)
 			throw std::runtime_error("IMFSinkWriter hook not set up");
@@ -268,6 +495,8 @@ STDAPI CreateSinkWriterFromURL(
 	IMFSinkWriter **ppSinkWriter
 	)
 {
+	// without warm-up, the logger and settings are set up here, at the first export
+	Initialize();
 	LOG_ENTER;
 	const PLH::VFuncMap redirect_map = make_redirect_map(
 		VSinkWriterSetInputMediaType(&SinkWriterSetInputMediaType),
@@ -291,7 +520,8 @@ STDAPI CreateSinkWriterFromURL(
 		hr = create_sinkwriter_hook->origFunc(pwszOutputURL, pByteStream, pAttributes, ppSinkWriter);
 		LOG->trace("MFCreateSinkWriterFromURL: exit {}", hr);
 		// reload settings to see if the mod is enabled, and to get the latest settings
-		settings = std::make_unique<Settings>();
+		// presets are only compiled again if the ini file changed
+		settings = std::make_unique<Settings>(Presets().Refresh());
 		auto enable = true;
 		auto exportsec = GetSec(settings->sections, "export");
 		GetVar(exportsec, "enable", enable);
@@ -307,6 +537,8 @@ STDAPI CreateSinkWriterFromURL(
 			if (*ppSinkWriter == nullptr)
 				throw std::runtime_error("*ppSinkWriter is null");
 			sinkwriter_hook = std::make_unique<VTableSwapHook>(*ppSinkWriter, redirect_map);
+			if (!settings->record_filename.empty())
+				recorder = std::make_unique<Recorder>(settings->record_filename);
 		}
 	}
 	LOG_CATCH;
@@ -314,13 +546,18 @@ STDAPI CreateSinkWriterFromURL(
 	return hr;
 }
 
-void Hook()
+bool Hook(std::string& error)
 {
 	LOG_ENTER;
 	try {
 		UnhookVFuncDetours(); // virtual functions are hooked by CreateSinkWriterFromURL
 		create_sinkwriter_hook.reset(new IatHook("mfreadwrite.dll", "MFCreateSinkWriterFromURL", &CreateSinkWriterFromURL));
 	}
-	LOG_CATCH;
+	catch (std::exception& e) {
+		error = e.what();
+	}
+	if (!create_sinkwriter_hook && error.empty())
+		error = "unknown error";
 	LOG_EXIT;
+	return create_sinkwriter_hook != nullptr;
 }
@@ -4,9 +4,22 @@
 #include <mfplay.h>
 #include <mfreadwrite.h>
 
-void Hook();
+#include "presets.h"
+
+// returns whether MFCreateSinkWriterFromURL could be hooked, and if not, sets error to why
+// this runs under the loader lock, before the logger is set up, so the caller logs the error later
+bool Hook(std::string& error);
 void Unhook();
 
+// presets of the ini file, compiled once and again whenever the file changes
+PresetRegistry& Presets();
+
+// set up logger and settings, once, from the warm-up thread or the first export (defined in dllmain.cpp)
+void Initialize();
+
+// abandon background finalizations, which can only be left when the process is terminating
+void StopFinalizer();
+
 STDAPI SinkWriterSetInputMediaType(IMFSinkWriter* pThis, DWORD dwStreamIndex, IMFMediaType* pInputMediaType, IMFAttributes* pEncodingParameters);
 STDAPI SinkWriterBeginWriting(IMFSinkWriter* pThis);
 STDAPI SinkWriterWriteSample(IMFSinkWriter* pThis, DWORD dwStreamIndex, IMFSample* pSample);
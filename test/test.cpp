@@ -1,7 +1,19 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <codecvt>
+#include <cstdio>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
@@ -12,8 +24,22 @@ extern "C" {
 #include <libswscale/swscale.h>
 }
 
+#include "blender.h"
+#include "converter.h"
 #include "format.h"
+#include "framering.h"
+#include "quality.h"
+#include "recording.h"
 #include "settings.h"
+#include "source.h"
+#include "verifier.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
 
 #pragma comment(lib, "common.lib")
 
@@ -66,6 +92,16 @@ auto MakeVideoData(size_t width, size_t height, AVPixelFormat pix_fmt, double t)
 			for (int x = 0; x < width; x++)
 				data[i++] = DATAV(s, 0.5 * x, 0.5 * y, t);
 		break;
+	case AV_PIX_FMT_RGB24:
+		data = std::make_unique<uint8_t[]>(3 * width * height);
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				data[i++] = DATAY(s, x, y, t);
+				data[i++] = DATAU(s, 0.5 * x, 0.5 * y, t);
+				data[i++] = DATAV(s, 0.5 * x, 0.5 * y, t);
+			}
+		}
+		break;
 	default:
 		LOG->error("unsupported pixel format");
 	}
@@ -73,19 +109,23 @@ auto MakeVideoData(size_t width, size_t height, AVPixelFormat pix_fmt, double t)
 	return data;
 };
 
-auto MakeAudioData(AVSampleFormat sample_fmt, int sample_rate, uint64_t channel_layout, int nb_samples, uint64_t pts) {
-	LOG_ENTER;
+// the test signal at the given time in seconds: a sine whose phase wobbles slowly
+double AudioSignal(double time) {
 	const auto freq1 = 220.0;
 	const auto freq2 = 220.0 * 5.0 / 4.0; // perfect third
 	const auto freq3 = 1.0;
 	const auto delta = 0.5;
+	auto two_pi_time = 2.0 * M_PI * time;
+	return sin(freq1 * two_pi_time + delta * sin(freq2 * two_pi_time) * sin(freq3 * two_pi_time));
+}
+
+auto MakeAudioData(AVSampleFormat sample_fmt, int sample_rate, uint64_t channel_layout, int nb_samples, uint64_t pts) {
+	LOG_ENTER;
 	const auto channels = av_get_channel_layout_nb_channels(channel_layout);
 	auto data{ std::make_unique<uint8_t[]>(av_samples_get_buffer_size(NULL, channels, nb_samples, sample_fmt, 1)) };
 	auto rawdata{ std::make_unique<double[]>(nb_samples) };
-	for (int j = 0; j < nb_samples; j++) {
-		auto two_pi_time = (2.0 * M_PI * (pts + j)) / sample_rate;
-		rawdata[j] = sin(freq1 * two_pi_time + delta * sin(freq2 * two_pi_time) * sin(freq3 * two_pi_time));
-	}
+	for (int j = 0; j < nb_samples; j++)
+		rawdata[j] = AudioSignal(static_cast<double>(pts + j) / sample_rate);
 	auto* q_u8 = data.get();
 	auto* q_s16 = reinterpret_cast<int16_t*>(data.get());
 	auto* q_s32 = reinterpret_cast<int32_t*>(data.get());
@@ -153,46 +193,1233 @@ auto MakeAudioData(AVSampleFormat sample_fmt, int sample_rate, uint64_t channel_
 	return data;
 }
 
-void Test(
+// process cpu time in seconds, user and kernel, summed over all threads
+double ProcessCpuSeconds()
+{
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+		return 0.0;
+	auto ticks = [](const FILETIME& ft) { return (uint64_t{ ft.dwHighDateTime } << 32) | ft.dwLowDateTime; };
+	return (ticks(kernel) + ticks(user)) / 1e7;
+#else
+	rusage usage{ };
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0.0;
+	auto seconds = [](const timeval& tv) { return tv.tv_sec + tv.tv_usec / 1e6; };
+	return seconds(usage.ru_utime) + seconds(usage.ru_stime);
+#endif
+}
+
+// the clip that the tests and benchmarks export, either synthetic or read from a file
+struct Clip {
+	int width{ 1920 };
+	int height{ 1080 };
+	AVPixelFormat pix_fmt{ AV_PIX_FMT_YUV420P };
+	AVRational frame_rate{ 30, 1 };
+	std::function<AVFramePtr()> next{ }; // next frame, or nullptr at the end of the clip
+};
+
+// a synthetic clip of nb_frames frames
+Clip OpenSyntheticClip(int width, int height, AVPixelFormat pix_fmt, AVRational frame_rate, int nb_frames)
+{
+	LOG_ENTER;
+	Clip clip{ };
+	clip.width = width;
+	clip.height = height;
+	clip.pix_fmt = pix_fmt;
+	clip.frame_rate = frame_rate;
+	clip.next = [clip, n = 0, nb_frames]() mutable -> AVFramePtr {
+		if (n >= nb_frames)
+			return nullptr;
+		auto data = MakeVideoData(clip.width, clip.height, clip.pix_fmt, n++ / av_q2d(clip.frame_rate));
+		auto frame = CreateVideoFrame(clip.width, clip.height, clip.pix_fmt);
+		uint8_t* src_data[4];
+		int src_linesize[4];
+		av_image_fill_arrays(src_data, src_linesize, data.get(), clip.pix_fmt, clip.width, clip.height, 1);
+		av_image_copy(frame->data, frame->linesize, const_cast<const uint8_t**>(src_data), src_linesize, clip.pix_fmt, clip.width, clip.height);
+		return frame;
+	};
+	LOG_EXIT;
+	return clip;
+}
+
+// open the clip from the start, at most nb_frames frames
+Clip OpenClip(const std::filesystem::path& filename, AVPixelFormat pix_fmt, AVRational frame_rate, int nb_frames)
+{
+	LOG_ENTER;
+	Clip clip{ };
+	if (filename.empty()) {
+		clip = OpenSyntheticClip(clip.width, clip.height, pix_fmt, frame_rate, nb_frames);
+	}
+	else {
+		auto source = std::make_shared<Source>(filename);
+		const auto& decoder = source->VideoDecoder();
+		clip.width = decoder.width;
+		clip.height = decoder.height;
+		clip.pix_fmt = decoder.pix_fmt;
+		clip.frame_rate = source->VideoFrameRate();
+		clip.next = [source, n = 0, nb_frames]() mutable -> AVFramePtr {
+			return (n++ < nb_frames) ? source->ReadFrame(AVMEDIA_TYPE_VIDEO) : nullptr;
+		};
+	}
+	LOG_EXIT;
+	return clip;
+}
+
+// what ExportClip exported, and how long it took
+struct ClipExport {
+	int64_t frames{ 0 };  // video frames
+	int64_t samples{ 0 }; // audio samples
+	double wall{ 0.0 };   // wall clock seconds, from opening the export to closing it
+	double cpu{ 0.0 };    // process cpu seconds over the same time
+};
+
+// how ExportClip feeds the export
+struct ClipExportOptions {
+	bool threads{ false };  // audio and video on separate threads that wait for the interleaver, as in the game
+	int slow_video_ms{ 0 }; // with threads, time held on every video frame, to emulate a slow video encoder
+	std::function<void(Format&)> opened{ };  // called once the export is open, before the first frame
+	std::function<void(Format&)> flushed{ }; // called once the export is flushed, before it is closed
+};
+
+// export the frames of the clip, with the test signal as audio alongside
+// all frames are made before the clock starts, so the timings cover the export only
+ClipExport ExportClip(
+	const std::filesystem::path& filename, Clip& clip,
+	const AVCodec& vcodec, AVDictionaryPtr& voptions,
+	const AVCodec& acodec, AVDictionaryPtr& aoptions, AVSampleFormat sample_fmt, int sample_rate, uint64_t channel_layout,
+	const FormatOptions& options, const ClipExportOptions& clip_options = ClipExportOptions{ })
+{
+	LOG_ENTER;
+	ClipExport result{ };
+	const auto nb_samples = 1000;
+	const auto atb = AVRational{ 1, sample_rate };
+	const auto vtb = av_inv_q(clip.frame_rate);
+	std::vector<AVFramePtr> vframes{ };
+	while (auto vframe = clip.next())
+		vframes.push_back(std::move(vframe));
+	// audio up to the last video frame
+	std::vector<AVFramePtr> aframes{ };
+	const auto nb_frames = static_cast<int64_t>(vframes.size());
+	for (int64_t apts = 0; nb_frames > 0 && av_compare_ts(apts, atb, nb_frames - 1, vtb) <= 0; apts += nb_samples) {
+		auto adata = MakeAudioData(sample_fmt, sample_rate, channel_layout, nb_samples, apts);
+		aframes.push_back(CreateAudioFrame(sample_fmt, sample_rate, channel_layout, nb_samples, adata.get()));
+	}
+	auto wall_start = std::chrono::steady_clock::now();
+	auto cpu_start = ProcessCpuSeconds();
+	{
+		Format format{
+			filename,
+			vcodec, voptions, clip.width, clip.height, clip.frame_rate, clip.pix_fmt,
+			acodec, aoptions, sample_fmt, sample_rate, channel_layout,
+			options };
+		if (clip_options.opened)
+			clip_options.opened(format);
+		if (clip_options.threads) {
+			std::mutex format_mutex;
+			std::thread audio_thread([&] {
+				try {
+					for (auto& aframe : aframes) {
+						format.interleaver->Wait(format.astream.stream->index);
+						std::lock_guard<std::mutex> lock(format_mutex);
+						format.astream.Transcode(aframe);
+						result.samples += nb_samples;
+					}
+				}
+				LOG_CATCH;
+			});
+			try {
+				for (auto& vframe : vframes) {
+					format.interleaver->Wait(format.vstream.stream->index);
+					// outside the lock, as a slow encoder only holds up its own stream
+					std::this_thread::sleep_for(std::chrono::milliseconds(clip_options.slow_video_ms));
+					std::lock_guard<std::mutex> lock(format_mutex);
+					format.vstream.Transcode(vframe);
+					result.frames++;
+				}
+			}
+			LOG_CATCH;
+			audio_thread.join();
+		}
+		else {
+			size_t next_audio{ 0 };
+			for (auto& vframe : vframes) {
+				while (next_audio < aframes.size() && av_compare_ts(result.samples, atb, result.frames, vtb) <= 0) {
+					format.astream.Transcode(aframes[next_audio++]);
+					result.samples += nb_samples;
+				}
+				format.vstream.Transcode(vframe);
+				result.frames++;
+			}
+		}
+		format.Flush();
+		if (clip_options.flushed)
+			clip_options.flushed(format);
+	}
+	std::chrono::duration<double> wall = std::chrono::steady_clock::now() - wall_start;
+	result.wall = wall.count();
+	result.cpu = ProcessCpuSeconds() - cpu_start;
+	LOG_EXIT;
+	return result;
+}
+
+// returns the number of video frames and audio samples exported
+std::pair<int, int> Test(
 	const std::filesystem::path& filename,
 	AVCodecPtr vcodec, AVDictionaryPtr& voptions, AVRational frame_rate, AVPixelFormat pix_fmt,
-	AVCodecPtr acodec, AVDictionaryPtr& aoptions, AVSampleFormat sample_fmt, int sample_rate, uint64_t channel_layout)
+	AVCodecPtr acodec, AVDictionaryPtr& aoptions, AVSampleFormat sample_fmt, int sample_rate, uint64_t channel_layout,
+	const FormatOptions& options)
 {
 	LOG->info("export started");
-	auto width = 416;
-	auto height = 234;
-	std::unique_ptr<Format> format{ nullptr };
-	format = std::make_unique<Format>(
-		filename,
-		*vcodec, voptions, width, height, frame_rate, pix_fmt,
-		*acodec, aoptions, sample_fmt, sample_rate, channel_layout);
-	const auto atb = AVRational{ 1, sample_rate };
-	const auto vtb = av_inv_q(frame_rate);
-	int apts = 0;
-	int vpts = 0;
-	while (apts * av_q2d(atb) < 5.0) {
-		while (av_compare_ts(apts, atb, vpts, vtb) <= 0) {
-			const auto nb_samples = 1000;
-			auto adata = MakeAudioData(
-				sample_fmt, sample_rate, channel_layout,
-				nb_samples, apts);
-			auto aframe = CreateAudioFrame(sample_fmt, sample_rate, channel_layout, nb_samples, adata.get());
-			format->astream.Transcode(aframe);
-			apts += nb_samples;
-		}
-		while (av_compare_ts(apts, atb, vpts, vtb) >= 0) {
-			auto vdata = MakeVideoData(
-				width, height, pix_fmt,
-				vpts * av_q2d(vtb));
-			auto vframe = CreateVideoFrame(width, height, pix_fmt, vdata.get());
-			format->vstream.Transcode(vframe);
-			vpts++;
-		}
-	}
-	format->Flush();
-	format = nullptr;
+	const auto duration = 5.0;
+	auto clip = OpenSyntheticClip(416, 234, pix_fmt, frame_rate, static_cast<int>(std::ceil(duration * av_q2d(frame_rate))));
+	auto result = ExportClip(
+		filename, clip,
+		*vcodec, voptions,
+		*acodec, aoptions, sample_fmt, sample_rate, channel_layout,
+		options);
 	LOG->info("export finished");
-	LOG->info("exported {} video frames and {} audio frames", vpts, apts);
+	LOG->info("exported {} video frames and {} audio frames", result.frames, result.samples);
+	LOG_EXIT;
+	return { static_cast<int>(result.frames), static_cast<int>(result.samples) };
+}
+
+// write a test export split into segments of segment_seconds, and read the segments back through the manifest:
+// every segment must start with a keyframe, and together they must hold all frames and samples;
+// every segment but the last must hold the samples between its cut and the next one, starting at zero,
+// exactly for codecs that take frames of any size, otherwise up to one audio frame
+void TestSegment(
+	const std::filesystem::path& filename,
+	AVCodecPtr vcodec, AVDictionaryPtr& voptions, AVRational frame_rate, AVPixelFormat pix_fmt,
+	AVCodecPtr acodec, AVDictionaryPtr& aoptions, AVSampleFormat sample_fmt, int sample_rate, uint64_t channel_layout,
+	FormatOptions options, double segment_seconds)
+{
+	LOG_ENTER;
+	options.segments.duration = segment_seconds;
+	options.segments.size = 0;
+	auto [nb_frames, nb_samples] = Test(
+		filename,
+		vcodec, voptions, frame_rate, pix_fmt,
+		acodec, aoptions, sample_fmt, sample_rate, channel_layout,
+		options);
+	std::ifstream is{ SegmentManifestFilename(filename) };
+	if (is.fail())
+		throw std::runtime_error(fmt::format("failed to open {}", SegmentManifestFilename(filename).string()));
+	// segment start (seconds of the export) and filename, as listed in the manifest
+	std::vector<std::pair<double, std::string>> listed{ };
+	double start{ 0.0 };
+	for (std::string line; std::getline(is, line);) {
+		double end{ 0.0 };
+		int number{ 0 };
+		if (std::sscanf(line.c_str(), "# segment %d: %lf to %lf", &number, &start, &end) == 3)
+			continue;
+		if (line.rfind("file '", 0) != 0)
+			continue;
+		// the test filenames contain no quotes, so no unescaping needed
+		listed.emplace_back(start, line.substr(6, line.size() - 7));
+	}
+	const auto exact = (acodec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE) != 0;
+	std::cout << fmt::format(
+		"{:<24} {:>8} {:>10} {:>10} {:>10} {:>10} {:>6}",
+		"segment", "frames", "samples", "expected", "start", "audio", "key") << std::endl;
+	int64_t total_frames{ 0 };
+	int64_t total_samples{ 0 };
+	auto ok{ !listed.empty() };
+	for (size_t i = 0; i < listed.size(); i++) {
+		const auto& name = listed[i].second;
+		Source source{ filename.parent_path() / std::filesystem::u8path(name) };
+		int64_t frames{ 0 };
+		int64_t samples{ 0 };
+		double video_start{ 0.0 };
+		double audio_start{ 0.0 };
+		int max_frame_samples{ 0 };
+		auto key{ false };
+		while (auto frame = source.ReadFrame(AVMEDIA_TYPE_VIDEO)) {
+			if (frames == 0) {
+				key = frame->key_frame;
+				video_start = frame->best_effort_timestamp * av_q2d(source.VideoDecoder().pkt_timebase);
+			}
+			frames++;
+		}
+		if (source.HasAudio()) {
+			while (auto frame = source.ReadFrame(AVMEDIA_TYPE_AUDIO)) {
+				if (samples == 0)
+					audio_start = frame->best_effort_timestamp * av_q2d(source.AudioDecoder().pkt_timebase);
+				samples += frame->nb_samples;
+				max_frame_samples = std::max(max_frame_samples, frame->nb_samples);
+			}
+		}
+		// the last segment ends with the export, where codecs pad and flush
+		const auto last = (i + 1 == listed.size());
+		const auto expected = last ? int64_t{ -1 } : std::llround((listed[i + 1].first - listed[i].first) * sample_rate);
+		const auto tolerance = exact ? 1 : max_frame_samples;
+		const auto samples_ok = last || std::abs(samples - expected) <= tolerance;
+		const auto start_ok = std::abs(audio_start * sample_rate) <= tolerance;
+		std::cout << fmt::format(
+			"{:<24} {:>8} {:>10} {:>10} {:>10.3f} {:>10.6f} {:>6}",
+			name, frames, samples, last ? std::string{ "-" } : fmt::format("{}", expected),
+			video_start, audio_start, key ? "yes" : "no") << std::endl;
+		if (!key)
+			LOG->error("{} does not start with a keyframe", name);
+		if (!samples_ok)
+			LOG->error("{} holds {} audio samples instead of {}", name, samples, expected);
+		if (!start_ok)
+			LOG->error("{} audio starts at {:.6f} seconds instead of at zero", name, audio_start);
+		ok = ok && key && samples_ok && start_ok;
+		total_frames += frames;
+		total_samples += samples;
+	}
+	std::cout << fmt::format("{:<24} {:>8} {:>10}", "total", total_frames, total_samples) << std::endl;
+	std::cout << fmt::format("{:<24} {:>8} {:>10}", "exported", nb_frames, nb_samples) << std::endl;
+	// codecs with a fixed frame size pad the last frame of the export, and may add priming samples
+	const auto sample_tolerance = sample_rate / 10;
+	ok = ok && total_frames == nb_frames && std::abs(total_samples - nb_samples) <= sample_tolerance;
+	std::cout << (ok ? "segments ok" : "segments NOT ok") << std::endl;
+	if (!ok)
+		throw std::runtime_error(fmt::format("segments of {} do not match the export", filename.string()));
+	LOG_EXIT;
+}
+
+// export with audio and video transcoded on separate threads, as in the game,
+// with every video frame held back by slow_video_ms to emulate a slow video encoder
+// the interleaver report at the end shows how far audio ran ahead, and for how long it was held back;
+// the test fails if the skew or the queue went beyond the limits of the interleaver, by more than
+// what a producer can add once max_wait lets it go: a frame of each stream, or a tenth of the memory limit
+void TestInterleave(
+	const std::filesystem::path& filename,
+	AVCodecPtr vcodec, AVDictionaryPtr& voptions, AVRational frame_rate, AVPixelFormat pix_fmt,
+	AVCodecPtr acodec, AVDictionaryPtr& aoptions, AVSampleFormat sample_fmt, int sample_rate, uint64_t channel_layout,
+	const FormatOptions& options, int slow_video_ms)
+{
+	LOG_ENTER;
+	LOG->info("interleave test started");
+	const auto duration = 5.0;
+	auto clip = OpenSyntheticClip(416, 234, pix_fmt, frame_rate, static_cast<int>(std::ceil(duration * av_q2d(frame_rate))));
+	ClipExportOptions clip_options{ };
+	clip_options.threads = true;
+	clip_options.slow_video_ms = slow_video_ms;
+	double max_skew{ 0.0 };
+	int64_t max_bytes{ 0 };
+	clip_options.flushed = [&](Format& format) {
+		max_skew = format.interleaver->MaxSkew();
+		max_bytes = format.interleaver->MaxBytes();
+	};
+	ExportClip(
+		filename, clip,
+		*vcodec, voptions,
+		*acodec, aoptions, sample_fmt, sample_rate, channel_layout,
+		options, clip_options);
+	LOG->info("interleave test finished");
+	// the audio frames of ExportClip hold 1000 samples
+	const auto skew_tolerance = 1.0 / av_q2d(frame_rate) + 1000.0 / sample_rate;
+	const auto limits = options.interleave;
+	std::cout << fmt::format(
+		"maximum skew {:.3f} seconds (limit {:.3f}), maximum queue {:.1f} MB (limit {:.1f})",
+		max_skew, limits.max_skew, max_bytes / 1e6, limits.max_memory / 1e6) << std::endl;
+	if (max_skew > limits.max_skew + skew_tolerance)
+		throw std::runtime_error(fmt::format("streams ran {:.3f} seconds apart, more than {:.3f}", max_skew, limits.max_skew));
+	if (limits.max_memory > 0 && max_bytes > limits.max_memory + limits.max_memory / 10)
+		throw std::runtime_error(fmt::format("interleaver queued {:.1f} MB, more than {:.1f}", max_bytes / 1e6, limits.max_memory / 1e6));
+	LOG_EXIT;
+}
+
+// export the same clip twice with the preset, once with the streams that bypass the encoder (rawvideo, native pcm),
+// and once through the encoder, and check that both exports hold the same packets
+void TestDirect(
+	AVCodecPtr vcodec, AVDictionaryPtr& voptions, AVRational frame_rate, AVPixelFormat pix_fmt,
+	AVCodecPtr acodec, AVDictionaryPtr& aoptions, AVSampleFormat sample_fmt, int sample_rate, uint64_t channel_layout,
+	const FormatOptions& options, const std::string& extension)
+{
+	LOG_ENTER;
+	std::vector<std::filesystem::path> filenames{ };
+	auto any_direct{ false };
+	auto video_direct{ false };
+	for (auto direct : { true, false }) {
+		const std::filesystem::path filename{ fmt::format("direct-{}{}", direct ? "on" : "off", extension) };
+		const auto duration = 5.0;
+		auto clip = OpenSyntheticClip(416, 234, pix_fmt, frame_rate, static_cast<int>(std::ceil(duration * av_q2d(frame_rate))));
+		auto voptions_copy = CopyAVDictionary(voptions.get());
+		auto aoptions_copy = CopyAVDictionary(aoptions.get());
+		ClipExportOptions clip_options{ };
+		clip_options.opened = [&](Format& format) {
+			any_direct = any_direct || format.vstream.direct || format.astream.direct;
+			video_direct = video_direct || format.vstream.direct;
+			if (!direct) {
+				format.vstream.direct = false;
+				format.astream.direct = false;
+			}
+		};
+		ExportClip(
+			filename, clip,
+			*vcodec, voptions_copy,
+			*acodec, aoptions_copy, sample_fmt, sample_rate, channel_layout,
+			options, clip_options);
+		filenames.push_back(filename);
+	}
+	if (!any_direct)
+		throw std::runtime_error("neither codec of the preset bypasses the encoder, use rawvideo or native pcm");
+	// only yuv2 on yuyv422 and palette formats keep rawvideo on the encoder
+	auto pix_desc = av_pix_fmt_desc_get(pix_fmt);
+	if (vcodec->id == AV_CODEC_ID_RAWVIDEO && !video_direct && pix_fmt != AV_PIX_FMT_YUYV422 && pix_desc && !(pix_desc->flags & AV_PIX_FMT_FLAG_PAL))
+		throw std::runtime_error("rawvideo does not bypass the encoder");
+	auto direct_context = CreateAVInputFormatContext(filenames[0]);
+	auto encoded_context = CreateAVInputFormatContext(filenames[1]);
+	auto direct_pkt = CreateAVPacket();
+	auto encoded_pkt = CreateAVPacket();
+	int64_t nb_packets{ 0 };
+	std::string mismatch{ };
+	while (mismatch.empty()) {
+		auto direct_ret = av_read_frame(direct_context.get(), direct_pkt.get());
+		auto encoded_ret = av_read_frame(encoded_context.get(), encoded_pkt.get());
+		if (direct_ret < 0 || encoded_ret < 0) {
+			if ((direct_ret < 0) != (encoded_ret < 0))
+				mismatch = fmt::format("{} export ends first", (direct_ret < 0) ? "direct" : "encoded");
+			break;
+		}
+		const auto& d = *direct_pkt;
+		const auto& e = *encoded_pkt;
+		if (d.stream_index != e.stream_index)
+			mismatch = fmt::format("stream {} instead of {}", d.stream_index, e.stream_index);
+		else if (d.pts != e.pts || d.dts != e.dts || d.duration != e.duration)
+			mismatch = fmt::format(
+				"pts {} dts {} duration {} instead of pts {} dts {} duration {}",
+				d.pts, d.dts, d.duration, e.pts, e.dts, e.duration);
+		else if ((d.flags & AV_PKT_FLAG_KEY) != (e.flags & AV_PKT_FLAG_KEY))
+			mismatch = "key flag differs";
+		else if (d.size != e.size || std::memcmp(d.data, e.data, d.size) != 0)
+			mismatch = fmt::format("data differs ({} bytes instead of {})", d.size, e.size);
+		if (!mismatch.empty())
+			mismatch = fmt::format("packet {} of stream {}: {}", nb_packets, e.stream_index, mismatch);
+		av_packet_unref(direct_pkt.get());
+		av_packet_unref(encoded_pkt.get());
+		nb_packets++;
+	}
+	direct_context = nullptr;
+	encoded_context = nullptr;
+	for (const auto& filename : filenames) {
+		std::error_code ec;
+		std::filesystem::remove(filename, ec);
+	}
+	if (!mismatch.empty())
+		throw std::runtime_error(fmt::format("direct and encoded exports differ at {}", mismatch));
+	std::cout << fmt::format("direct and encoded exports hold the same {} packets", nb_packets) << std::endl;
+	LOG_EXIT;
+}
+
+void BenchmarkConversion(AVPixelFormat src_pix_fmt, AVPixelFormat dst_pix_fmt, int max_threads, int nb_frames)
+{
+	LOG_ENTER;
+	const auto width = 1920;
+	const auto height = 1080;
+	auto data = MakeVideoData(width, height, src_pix_fmt, 0.0);
+	auto src_frame = CreateVideoFrame(width, height, src_pix_fmt, data.get());
+	auto dst_frame = CreateVideoFrame(width, height, dst_pix_fmt);
+	if (max_threads <= 0)
+		max_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	// the output of every banding must match the single band byte for byte
+	const auto size = av_image_get_buffer_size(dst_pix_fmt, width, height, 1);
+	std::vector<uint8_t> single_band(size);
+	std::vector<uint8_t> banded(size);
+	auto single_fps{ 0.0 };
+	for (int threads = 1; threads <= max_threads; threads++) {
+		Converter converter{ width, height, src_pix_fmt, dst_pix_fmt, ThreadPolicy{ 0, ThreadPriority::Normal, threads } };
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < nb_frames; i++)
+			converter.Convert(*src_frame, *dst_frame);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		auto fps = nb_frames / elapsed.count();
+		auto& output = (threads == 1) ? single_band : banded;
+		av_image_copy_to_buffer(output.data(), size, dst_frame->data, dst_frame->linesize, dst_pix_fmt, width, height, 1);
+		if (threads == 1)
+			single_fps = fps;
+		else if (banded != single_band)
+			throw std::runtime_error(fmt::format(
+				"conversion {} to {} in {} bands differs from the single band",
+				av_get_pix_fmt_name(src_pix_fmt), av_get_pix_fmt_name(dst_pix_fmt), converter.NumBands()));
+		LOG->info(
+			"conversion {} to {} at {}x{}: {} threads, {} bands, {:.1f} fps, speedup {:.2f}",
+			av_get_pix_fmt_name(src_pix_fmt), av_get_pix_fmt_name(dst_pix_fmt), width, height,
+			threads, converter.NumBands(), fps, fps / single_fps);
+	}
+	LOG_EXIT;
+}
+
+// blend nb_frames 1080p frames at a time, and compare the luma of the first blend against the exact average
+void BenchmarkBlend(AVPixelFormat pix_fmt, const AVRational& frame_rate, int blend_frames, int max_threads, int nb_frames)
+{
+	LOG_ENTER;
+	const auto width = 1920;
+	const auto height = 1080;
+	std::vector<std::unique_ptr<uint8_t[]>> data{ };
+	std::vector<AVFramePtr> src_frames{ };
+	for (int i = 0; i < blend_frames; i++) {
+		data.push_back(MakeVideoData(width, height, pix_fmt, i * av_q2d(av_inv_q(frame_rate))));
+		src_frames.push_back(CreateVideoFrame(width, height, pix_fmt, data.back().get()));
+	}
+	if (max_threads <= 0)
+		max_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	auto single_fps{ 0.0 };
+	for (int threads = 1; threads <= max_threads; threads++) {
+		FrameBlender blender{ width, height, pix_fmt, blend_frames, ThreadPolicy{ 0, ThreadPriority::Normal, threads } };
+		if (threads == 1) {
+			for (const auto& src_frame : src_frames)
+				blender.Add(*src_frame);
+			const auto& frame = blender.Blend();
+			// the first plane holds luma (or packed samples), whose bytes all get averaged
+			auto row_bytes = av_image_get_linesize(pix_fmt, width, 0);
+			int max_error{ 0 };
+			for (int y = 0; y < height; y++) {
+				for (int x = 0; x < row_bytes; x++) {
+					int sum{ 0 };
+					for (const auto& src_frame : src_frames)
+						sum += src_frame->data[0][y * src_frame->linesize[0] + x];
+					int error = std::abs((sum + blend_frames / 2) / blend_frames - frame->data[0][y * frame->linesize[0] + x]);
+					max_error = std::max(max_error, error);
+				}
+			}
+			LOG->info("blend of {} frames: maximum error {}", blend_frames, max_error);
+			if (max_error > 1)
+				throw std::runtime_error(fmt::format("blend error {} too large", max_error));
+		}
+		int nb_blends{ 0 };
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < nb_frames; i++) {
+			if (blender.Add(*src_frames[i % blend_frames])) {
+				blender.Blend();
+				nb_blends++;
+			}
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		auto fps = nb_frames / elapsed.count();
+		if (threads == 1)
+			single_fps = fps;
+		LOG->info(
+			"blend {} frames of {} at {}x{}: {} threads, {} blends, {:.1f} input fps, speedup {:.2f}",
+			blend_frames, av_get_pix_fmt_name(pix_fmt), width, height,
+			threads, nb_blends, fps, fps / single_fps);
+	}
+	LOG_EXIT;
+}
+
+// convert nb_seconds of test audio through the resampler, in chunks of 1024 samples as the game sends them,
+// and return the speed relative to real time (0 if the resampler is bypassed)
+double BenchmarkResampler(
+	AVSampleFormat sample_fmt, int sample_rate, uint64_t channel_layout,
+	AVSampleFormat out_sample_fmt, int out_sample_rate,
+	const ResamplerOptions& options, int nb_seconds)
+{
+	LOG_ENTER;
+	const int chunk = 1024;
+	const int nb_chunks = std::max(1, static_cast<int>(int64_t{ nb_seconds } * sample_rate / chunk));
+	auto swr = CreateResampler(
+		channel_layout, out_sample_fmt, out_sample_rate,
+		channel_layout, sample_fmt, sample_rate,
+		options);
+	if (!swr) {
+		LOG_EXIT;
+		return 0.0;
+	}
+	auto data = MakeAudioData(sample_fmt, sample_rate, channel_layout, chunk, 0);
+	auto src_frame = CreateAudioFrame(sample_fmt, sample_rate, channel_layout, chunk, data.get());
+	int64_t nb_samples{ 0 };
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i <= nb_chunks; i++) {
+		auto dst_frame = CreateAudioFrame(out_sample_fmt, out_sample_rate, channel_layout);
+		int ret = swr_convert_frame(swr.get(), dst_frame.get(), (i < nb_chunks) ? src_frame.get() : nullptr);
+		if (ret < 0)
+			throw std::runtime_error(fmt::format("resampling error: {}", AVErrorString(ret)));
+		nb_samples += dst_frame->nb_samples;
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	LOG->debug("resampler produced {} samples", nb_samples);
+	LOG_EXIT;
+	return (static_cast<double>(nb_chunks) * chunk / sample_rate) / elapsed.count();
+}
+
+// resample a few seconds of the mono test signal in double precision, and return its THD+N in dB:
+// the energy of everything but the ideal signal at the output rate, relative to the signal,
+// after finding the delay and gain of the resampler
+double MeasureResamplerTHDN(int sample_rate, int out_sample_rate, const ResamplerOptions& options)
+{
+	LOG_ENTER;
+	const int chunk = 1024;
+	const int nb_seconds = 4;
+	auto swr = CreateResampler(
+		AV_CH_LAYOUT_MONO, AV_SAMPLE_FMT_DBL, out_sample_rate,
+		AV_CH_LAYOUT_MONO, AV_SAMPLE_FMT_DBL, sample_rate,
+		options);
+	if (!swr)
+		throw std::runtime_error("resampler bypassed, nothing to measure");
+	std::vector<double> output{ };
+	for (int64_t pts = 0; pts <= int64_t{ nb_seconds } * sample_rate; pts += chunk) {
+		// the last round flushes the resampler
+		auto last = (pts + chunk > int64_t{ nb_seconds } * sample_rate);
+		auto data = MakeAudioData(AV_SAMPLE_FMT_DBL, sample_rate, AV_CH_LAYOUT_MONO, chunk, pts);
+		auto src_frame = last ? AVFramePtr{ nullptr } : CreateAudioFrame(AV_SAMPLE_FMT_DBL, sample_rate, AV_CH_LAYOUT_MONO, chunk, data.get());
+		auto dst_frame = CreateAudioFrame(AV_SAMPLE_FMT_DBL, out_sample_rate, AV_CH_LAYOUT_MONO);
+		int ret = swr_convert_frame(swr.get(), dst_frame.get(), src_frame.get());
+		if (ret < 0)
+			throw std::runtime_error(fmt::format("resampling error: {}", AVErrorString(ret)));
+		auto samples = reinterpret_cast<const double*>(dst_frame->data[0]);
+		output.insert(output.end(), samples, samples + dst_frame->nb_samples);
+	}
+	// skip the filter transients at either end
+	const size_t skip = out_sample_rate / 10;
+	if (output.size() < 4 * skip)
+		throw std::runtime_error(fmt::format("resampler produced only {} samples", output.size()));
+	// residual energy and signal energy, with the gain fitted, for a delay of the given number of output samples
+	auto residual = [&](double delay, size_t end, double& signal) {
+		double yr{ 0.0 }, rr{ 0.0 }, yy{ 0.0 };
+		for (size_t n = skip; n < end; n++) {
+			auto r = AudioSignal((n - delay) / out_sample_rate);
+			yr += output[n] * r;
+			rr += r * r;
+			yy += output[n] * output[n];
+		}
+		auto gain = yr / rr;
+		signal = gain * gain * rr;
+		return std::max(0.0, yy - gain * yr);
+	};
+	// find the delay on a short window, first to the sample, and then by golden section search around it
+	const size_t search_end = std::min(output.size() - skip, 3 * skip);
+	double signal{ 0.0 };
+	double best_delay{ 0.0 };
+	double best_residual{ residual(0.0, search_end, signal) };
+	for (int k = -64; k <= 64; k++) {
+		auto r = residual(k, search_end, signal);
+		if (r < best_residual) {
+			best_residual = r;
+			best_delay = k;
+		}
+	}
+	const double golden = (std::sqrt(5.0) - 1.0) / 2.0;
+	double lo{ best_delay - 1.0 }, hi{ best_delay + 1.0 };
+	for (int i = 0; i < 40; i++) {
+		auto a = hi - golden * (hi - lo);
+		auto b = lo + golden * (hi - lo);
+		if (residual(a, search_end, signal) < residual(b, search_end, signal))
+			hi = b;
+		else
+			lo = a;
+	}
+	best_delay = (lo + hi) / 2.0;
+	auto noise = residual(best_delay, output.size() - skip, signal);
+	LOG->debug("resampler delay is {:.3f} samples", best_delay);
+	LOG_EXIT;
+	return 10.0 * std::log10(std::max(noise, 1e-30) / signal);
+}
+
+// benchmark every resampler tier, and the resampler of the current preset, converting the test format
+// to out_sample_rate, and to another sample format at the same rate (where no filter is needed),
+// and check the THD+N of each tier
+void BenchmarkResample(
+	AVSampleFormat sample_fmt, int sample_rate, uint64_t channel_layout,
+	int out_sample_rate, int nb_seconds, const ResamplerOptions& preset_options)
+{
+	LOG_ENTER;
+	// the sample format that most codecs (aac, opus, vorbis) want
+	const auto same_rate_fmt = (sample_fmt == AV_SAMPLE_FMT_FLTP) ? AV_SAMPLE_FMT_S16 : AV_SAMPLE_FMT_FLTP;
+	std::vector<std::pair<std::string, ResamplerOptions>> tiers{ };
+	for (auto tier : { "fast", "default", "high", "best" }) {
+		ResamplerOptions options{ };
+		SetResamplerTier(tier, options);
+		tiers.emplace_back(tier, options);
+	}
+	tiers.emplace_back("preset", preset_options);
+	for (const auto& [tier, options] : tiers) {
+		auto speed = BenchmarkResampler(sample_fmt, sample_rate, channel_layout, sample_fmt, out_sample_rate, options, nb_seconds);
+		auto same_rate_speed = BenchmarkResampler(sample_fmt, sample_rate, channel_layout, same_rate_fmt, sample_rate, options, nb_seconds);
+		auto thdn = (sample_rate != out_sample_rate) ? MeasureResamplerTHDN(sample_rate, out_sample_rate, options) : -INFINITY;
+		LOG->info(
+			"resampler {} ({}): {} Hz to {} Hz at {:.0f}x real time, THD+N {:.1f} dB; {} to {} at {:.0f}x real time",
+			tier,
+			(options.engine == ResamplerEngine::Soxr) ? fmt::format("soxr precision {}", options.precision) : fmt::format("swr filter size {}", options.filter_size),
+			sample_rate, out_sample_rate, speed, thdn,
+			av_get_sample_fmt_name(sample_fmt), av_get_sample_fmt_name(same_rate_fmt), same_rate_speed);
+		// every tier should be far cleaner than this, anything worse means the output is broken
+		if (thdn > -40.0)
+			throw std::runtime_error(fmt::format("resampler {} THD+N {:.1f} dB too large", tier, thdn));
+	}
+	LOG_EXIT;
+}
+
+// state shared between the replay driver and its audio and video threads
+struct ReplayState {
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::unique_ptr<Record> record{ nullptr }; // sample waiting to be transcoded
+	bool done{ false };
+};
+
+// transcode the samples of one stream, as the game does on its own thread for each stream
+void ReplayStream(ReplayState& state, uint32_t stream_index, const std::function<void(Record&)>& transcode)
+{
+	LOG_ENTER;
+	std::unique_lock<std::mutex> lock(state.mutex);
+	while (true) {
+		state.cond.wait(lock, [&] { return state.done || (state.record && state.record->stream_index == stream_index); });
+		if (!state.record)
+			break;
+		lock.unlock();
+		try {
+			transcode(*state.record);
+		}
+		LOG_CATCH;
+		lock.lock();
+		state.record = nullptr;
+		state.cond.notify_all();
+	}
+	LOG_EXIT;
+}
+
+// Replay a recording made by the plugin.
+// Samples are handed one at a time, in recorded order, to an audio and a video thread,
+// so the interleaving and the thread split are exactly as in the game.
+// With original timing, each event is delayed until its recorded arrival time.
+void Replay(const std::filesystem::path& filename, bool original_timing, const FormatOptions& options)
+{
+	LOG_ENTER;
+	LOG->info("replay of \"{}\" started", filename.string());
+	RecordingReader reader{ filename };
+	Record record{ };
+	RecordedAudioType ainfo{ };
+	RecordedVideoType vinfo{ };
+	uint32_t astream_index{ 0 };
+	uint32_t vstream_index{ 0 };
+	std::unique_ptr<Format> format{ nullptr };
+	std::mutex format_mutex;
+	ReplayState state{ };
+	std::vector<std::thread> threads{ };
+	int64_t nb_frames{ 0 };
+	int64_t nb_samples{ 0 };
+	int64_t max_lag{ 0 };
+	auto stop_threads = [&] {
+		{
+			std::unique_lock<std::mutex> lock(state.mutex);
+			state.cond.wait(lock, [&] { return !state.record; });
+			state.done = true;
+			state.cond.notify_all();
+		}
+		for (auto& thread : threads)
+			thread.join();
+		threads.clear();
+		state.done = false;
+	};
+	auto transcode_audio = [&](Record& sample) {
+		auto sample_fmt = static_cast<AVSampleFormat>(ainfo.sample_fmt);
+		auto bytes_per_sample = av_get_bytes_per_sample(sample_fmt) * av_get_channel_layout_nb_channels(ainfo.channel_layout);
+		auto nb = static_cast<int>(sample.data.size() / bytes_per_sample);
+		auto frame = CreateAudioFrame(sample_fmt, ainfo.sample_rate, ainfo.channel_layout, nb, sample.data.data());
+		std::lock_guard<std::mutex> lock(format_mutex);
+		format->astream.Transcode(frame);
+		nb_samples += nb;
+	};
+	auto transcode_video = [&](Record& sample) {
+		auto pix_fmt = static_cast<AVPixelFormat>(vinfo.pix_fmt);
+		auto size = av_image_get_buffer_size(pix_fmt, vinfo.width, vinfo.height, 1);
+		if (static_cast<int>(sample.data.size()) != size)
+			throw std::runtime_error(fmt::format(
+				"buffer length {} does not match video frame size {}", sample.data.size(), size));
+		auto frame = CreateVideoFrame(vinfo.width, vinfo.height, pix_fmt, sample.data.data());
+		std::lock_guard<std::mutex> lock(format_mutex);
+		format->vstream.Transcode(frame);
+		nb_frames++;
+	};
+	auto start = std::chrono::steady_clock::now();
+	try {
+		while (reader.Read(record)) {
+			if (original_timing) {
+				auto due = start + std::chrono::microseconds(record.time);
+				auto now = std::chrono::steady_clock::now();
+				if (now < due)
+					std::this_thread::sleep_until(due);
+				else
+					max_lag = std::max(max_lag, static_cast<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(now - due).count()));
+			}
+			switch (record.type) {
+			case RecordType::AudioType:
+				if (record.data.size() != sizeof(ainfo))
+					throw std::runtime_error("invalid audio type record");
+				std::memcpy(&ainfo, record.data.data(), sizeof(ainfo));
+				astream_index = record.stream_index;
+				break;
+			case RecordType::VideoType:
+				if (record.data.size() != sizeof(vinfo))
+					throw std::runtime_error("invalid video type record");
+				std::memcpy(&vinfo, record.data.data(), sizeof(vinfo));
+				vstream_index = record.stream_index;
+				break;
+			case RecordType::BeginWriting:
+				format = std::make_unique<Format>(
+					settings->export_filename,
+					*settings->video_codec, settings->video_codec_options, vinfo.width, vinfo.height,
+					AVRational{ vinfo.frame_rate_num, vinfo.frame_rate_den }, static_cast<AVPixelFormat>(vinfo.pix_fmt),
+					*settings->audio_codec, settings->audio_codec_options,
+					static_cast<AVSampleFormat>(ainfo.sample_fmt), ainfo.sample_rate, ainfo.channel_layout,
+					options);
+				threads.emplace_back(ReplayStream, std::ref(state), astream_index, transcode_audio);
+				threads.emplace_back(ReplayStream, std::ref(state), vstream_index, transcode_video);
+				break;
+			case RecordType::Sample:
+				if (!format) {
+					LOG->error("sample before begin writing");
+				}
+				else if (record.stream_index != astream_index && record.stream_index != vstream_index) {
+					LOG->debug("sample of unknown stream at index {}", record.stream_index);
+				}
+				else {
+					std::unique_lock<std::mutex> lock(state.mutex);
+					state.cond.wait(lock, [&] { return !state.record; });
+					state.record = std::make_unique<Record>(std::move(record));
+					state.cond.notify_all();
+				}
+				break;
+			case RecordType::Flush:
+			case RecordType::Finalize:
+				if (format) {
+					stop_threads();
+					if (record.type == RecordType::Flush)
+						format->Cancel();
+					else
+						format->Flush();
+					format = nullptr;
+				}
+				break;
+			default:
+				LOG->error("unknown record type {}", static_cast<int>(record.type));
+			}
+		}
+	}
+	catch (...) {
+		// threads must be joined before they are destroyed
+		if (!threads.empty())
+			stop_threads();
+		throw;
+	}
+	if (format) {
+		LOG->warn("recording ends before the export finished");
+		stop_threads();
+		format->Flush();
+		format = nullptr;
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	LOG->info("replay finished");
+	LOG->info(
+		"replayed {} video frames and {} audio samples in {:.2f} seconds ({:.1f} fps)",
+		nb_frames, nb_samples, elapsed.count(), nb_frames / elapsed.count());
+	if (original_timing)
+		LOG->info("maximum lag behind original timing: {:.3f} seconds", max_lag / 1000000.0);
+	LOG_EXIT;
+}
+
+// benchmark the frame ring transport: a synthetic producer writes 1080p frames,
+// and a consumer on another thread (which maps the ring separately, as the worker would) releases them
+// with consume_us of work per frame, to emulate an encoder
+void BenchmarkRing(AVPixelFormat pix_fmt, AVRational frame_rate, uint32_t nb_slots, int nb_frames, int consume_us)
+{
+	LOG_ENTER;
+	const auto width = 1920;
+	const auto height = 1080;
+	FrameRingFormat ring_format{ width, height, pix_fmt, frame_rate, AV_SAMPLE_FMT_S16, 44100, AV_CH_LAYOUT_STEREO };
+	FrameRing ring{ FrameRingName(), ring_format, nb_slots, std::chrono::milliseconds(1000) };
+	auto data = MakeVideoData(width, height, pix_fmt, 0.0);
+	auto frame = CreateVideoFrame(width, height, pix_fmt, data.get());
+	int64_t consumed{ 0 };
+	uint64_t checksum{ 0 };
+	std::thread consumer([&] {
+		try {
+			FrameRing consumer_ring{ ring.name, std::chrono::milliseconds(1000) };
+			while (true) {
+				AVMediaType type{ AVMEDIA_TYPE_UNKNOWN };
+				// the state must be read before the ring is found empty, or the last frames may be missed
+				auto closed = consumer_ring.State() != FrameRingState::Open;
+				auto slot_frame = consumer_ring.Front(type);
+				if (!slot_frame) {
+					if (closed)
+						break;
+					continue;
+				}
+				// touch the frame, so the copy cannot be optimized away
+				checksum += slot_frame->data[0][consumed % width];
+				if (consume_us > 0)
+					std::this_thread::sleep_for(std::chrono::microseconds(consume_us));
+				slot_frame = nullptr;
+				consumer_ring.Pop();
+				consumed++;
+			}
+		}
+		LOG_CATCH;
+	});
+	std::vector<double> latencies{ };
+	latencies.reserve(nb_frames);
+	auto start = std::chrono::steady_clock::now();
+	try {
+		for (int i = 0; i < nb_frames; i++) {
+			auto write_start = std::chrono::steady_clock::now();
+			ring.WriteVideo(*frame);
+			std::chrono::duration<double, std::micro> latency = std::chrono::steady_clock::now() - write_start;
+			latencies.push_back(latency.count());
+		}
+		ring.Close(FrameRingState::Finished);
+	}
+	catch (std::exception&) {
+		ring.Close(FrameRingState::Cancelled);
+		consumer.join();
+		throw;
+	}
+	consumer.join();
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	std::sort(latencies.begin(), latencies.end());
+	auto percentile = [&](double p) { return latencies.empty() ? 0.0 : latencies[static_cast<size_t>(p * (latencies.size() - 1))]; };
+	LOG->info(
+		"ring {} at {}x{}, {} slots, {} us per frame in consumer: {} of {} frames in {:.3f} seconds, {:.1f} fps, {:.2f} GB/s",
+		av_get_pix_fmt_name(pix_fmt), width, height, nb_slots, consume_us,
+		consumed, nb_frames, elapsed.count(), consumed / elapsed.count(), ring.nb_bytes / elapsed.count() / 1e9);
+	LOG->info(
+		"ring producer: write latency median {:.0f} us, p99 {:.0f} us, max {:.0f} us, blocked for {:.3f} seconds (checksum {})",
+		percentile(0.5), percentile(0.99), percentile(1.0), std::chrono::duration<double>(ring.blocked).count(), checksum);
+	LOG_EXIT;
+}
+
+struct Advice {
+	std::string preset{ };
+	int64_t frames{ 0 };
+	double fps{ 0.0 };
+	double cpu{ 0.0 };   // cpu seconds of the whole export
+	double wall{ 0.0 };  // wall clock seconds of the whole export
+	double kbps{ 0.0 };
+	double psnr{ 0.0 };  // luma, infinite if lossless
+	double ssim{ 0.0 };  // luma
+	std::string error{ };
+};
+
+// decode the video of the export, and compare the luma of every frame with the clip
+void MeasureQuality(const std::filesystem::path& filename, const Clip& clip, Advice& advice)
+{
+	LOG_ENTER;
+	auto context = CreateAVInputFormatContext(filename);
+	auto index = av_find_best_stream(context.get(), AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+	if (index < 0)
+		throw std::runtime_error(fmt::format("no video stream in '{}'", filename.string()));
+	AVCodecPtr codec = avcodec_find_decoder(context->streams[index]->codecpar->codec_id);
+	if (!codec)
+		throw std::runtime_error(fmt::format("no decoder for '{}'", filename.string()));
+	auto decoder = CreateAVCodecContext(*codec);
+	auto ret = avcodec_parameters_to_context(decoder.get(), context->streams[index]->codecpar);
+	if (ret < 0)
+		throw std::runtime_error(fmt::format("failed to set up {} decoder: {}", codec->name, AVErrorString(ret)));
+	ret = avcodec_open2(decoder.get(), codec, nullptr);
+	if (ret < 0)
+		throw std::runtime_error(fmt::format("failed to open {} decoder: {}", codec->name, AVErrorString(ret)));
+	// both sides are compared in gray, so formats and chroma subsampling need not match
+	const ThreadPolicy policy{ 0, ThreadPriority::Normal, 1 };
+	Converter src_converter{ clip.width, clip.height, clip.pix_fmt, AV_PIX_FMT_GRAY8, policy };
+	std::unique_ptr<Converter> dst_converter{ nullptr };
+	auto src_gray = CreateVideoFrame(clip.width, clip.height, AV_PIX_FMT_GRAY8);
+	auto dst_gray = CreateVideoFrame(clip.width, clip.height, AV_PIX_FMT_GRAY8);
+	int64_t sse{ 0 };
+	int64_t frames{ 0 };
+	double ssim{ 0.0 };
+	auto pkt = CreateAVPacket();
+	auto frame = CreateAVFrame();
+	auto receive = [&]() {
+		while ((ret = avcodec_receive_frame(decoder.get(), frame.get())) >= 0) {
+			auto src_frame = clip.next();
+			if (!src_frame)
+				throw std::runtime_error("export has more frames than the clip");
+			if (frame->width != clip.width || frame->height != clip.height)
+				throw std::runtime_error(fmt::format("export is {}x{} instead of {}x{}", frame->width, frame->height, clip.width, clip.height));
+			if (!dst_converter)
+				dst_converter = std::make_unique<Converter>(clip.width, clip.height, static_cast<AVPixelFormat>(frame->format), AV_PIX_FMT_GRAY8, policy);
+			src_converter.Convert(*src_frame, *src_gray);
+			dst_converter->Convert(*frame, *dst_gray);
+			sse += PlaneSSE(src_gray->data[0], src_gray->linesize[0], dst_gray->data[0], dst_gray->linesize[0], clip.width, clip.height);
+			ssim += PlaneSSIM(src_gray->data[0], src_gray->linesize[0], dst_gray->data[0], dst_gray->linesize[0], clip.width, clip.height);
+			frames++;
+			av_frame_unref(frame.get());
+		}
+		if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF)
+			throw std::runtime_error(fmt::format("failed to decode frame: {}", AVErrorString(ret)));
+	};
+	while (av_read_frame(context.get(), pkt.get()) >= 0) {
+		if (pkt->stream_index == index) {
+			ret = avcodec_send_packet(decoder.get(), pkt.get());
+			av_packet_unref(pkt.get());
+			if (ret < 0)
+				throw std::runtime_error(fmt::format("failed to send packet to decoder: {}", AVErrorString(ret)));
+			receive();
+		}
+		else {
+			av_packet_unref(pkt.get());
+		}
+	}
+	avcodec_send_packet(decoder.get(), nullptr);
+	receive();
+	if (frames != advice.frames)
+		LOG->warn("{}: decoded {} of {} frames", advice.preset, frames, advice.frames);
+	advice.psnr = PSNR(sse, frames * clip.width * clip.height);
+	advice.ssim = (frames > 0) ? ssim / frames : 0.0;
+	LOG_EXIT;
+}
+
+// export the clip with the preset, and measure speed, bitrate, and quality
+void AdvisePreset(
+	const std::string& preset, const std::filesystem::path& clip_filename, int nb_frames,
+	AVPixelFormat pix_fmt, AVRational frame_rate,
+	AVSampleFormat sample_fmt, int sample_rate, uint64_t channel_layout,
+	Advice& advice)
+{
+	LOG_ENTER;
+	advice.preset = preset;
+	settings->LoadPreset(preset, ".", "advise-" + preset);
+	// the fallback gets benchmarked under its own name
+	if (settings->preset != preset)
+		throw std::runtime_error(fmt::format("preset {} falls back on {}", preset, settings->preset));
+	const auto filename = settings->export_filename;
+	auto clip = OpenClip(clip_filename, pix_fmt, frame_rate, nb_frames);
+	LOG->info("benchmarking preset {} on {} frames at {}x{}", preset, nb_frames, clip.width, clip.height);
+	auto result = ExportClip(
+		filename, clip,
+		*settings->video_codec, settings->video_codec_options,
+		*settings->audio_codec, settings->audio_codec_options, sample_fmt, sample_rate, channel_layout,
+		settings->format_options);
+	advice.frames = result.frames;
+	advice.wall = result.wall;
+	advice.cpu = result.cpu;
+	advice.fps = advice.frames / advice.wall;
+	advice.kbps = (advice.frames > 0) ? std::filesystem::file_size(filename) * 8.0 / (advice.frames / av_q2d(clip.frame_rate)) / 1000.0 : 0.0;
+	MeasureQuality(filename, OpenClip(clip_filename, pix_fmt, frame_rate, nb_frames), advice);
+	std::error_code ec;
+	std::filesystem::remove(filename, ec);
+	LOG_EXIT;
+}
+
+// benchmark all presets of SimpleVideoExport.ini (or those listed), print them ranked by speed,
+// and suggest the fastest preset that runs in real time and meets the quality target
+void Advise(
+	const std::string& presets, const std::filesystem::path& clip_filename, int nb_frames, double min_psnr,
+	AVPixelFormat pix_fmt, AVRational frame_rate,
+	AVSampleFormat sample_fmt, int sample_rate, uint64_t channel_layout)
+{
+	LOG_ENTER;
+	std::vector<std::string> names{ };
+	std::istringstream iss{ presets };
+	for (std::string name; iss >> name;)
+		names.push_back(name);
+	if (names.empty()) {
+		for (const auto& [name, sec] : settings->sections)
+			if (sec.count("videocodec"))
+				names.push_back(name);
+	}
+	const auto clip_frame_rate = OpenClip(clip_filename, pix_fmt, frame_rate, 0).frame_rate;
+	std::vector<Advice> advices{ };
+	for (const auto& name : names) {
+		Advice advice{ };
+		try {
+			AdvisePreset(name, clip_filename, nb_frames, pix_fmt, frame_rate, sample_fmt, sample_rate, channel_layout, advice);
+		}
+		catch (std::exception& e) {
+			advice.preset = name;
+			advice.error = e.what();
+			LOG->error("preset {} failed: {}", name, advice.error);
+		}
+		advices.push_back(advice);
+	}
+	std::stable_sort(advices.begin(), advices.end(), [](const Advice& a, const Advice& b) {
+		return a.error.empty() && (!b.error.empty() || a.fps > b.fps);
+	});
+	const auto realtime_fps = av_q2d(clip_frame_rate);
+	std::cout << fmt::format("{:<24} {:>8} {:>9} {:>6} {:>10} {:>8} {:>7}", "preset", "fps", "realtime", "cores", "kbps", "psnr", "ssim") << std::endl;
+	const Advice* suggestion{ nullptr };
+	for (const auto& advice : advices) {
+		if (!advice.error.empty()) {
+			std::cout << fmt::format("{:<24} failed: {}", advice.preset, advice.error) << std::endl;
+			continue;
+		}
+		std::cout << fmt::format(
+			"{:<24} {:8.1f} {:>9} {:6.1f} {:10.0f} {:>8} {:7.4f}",
+			advice.preset, advice.fps, (advice.fps >= realtime_fps) ? "yes" : "no",
+			advice.cpu / advice.wall, advice.kbps,
+			std::isinf(advice.psnr) ? std::string{ "lossless" } : fmt::format("{:.2f}", advice.psnr),
+			advice.ssim) << std::endl;
+		if (!suggestion && advice.psnr >= min_psnr)
+			suggestion = &advice;
+	}
+	if (!suggestion)
+		std::cout << fmt::format("no preset reaches a luma psnr of {:.1f} dB", min_psnr) << std::endl;
+	else if (suggestion->fps < realtime_fps)
+		std::cout << fmt::format("suggested preset: {} (psnr target {:.1f} dB, but not real time at {:.2f} fps)", suggestion->preset, min_psnr, realtime_fps) << std::endl;
+	else
+		std::cout << fmt::format("suggested preset: {} (fastest that reaches {:.1f} dB in real time)", suggestion->preset, min_psnr) << std::endl;
+	LOG_EXIT;
+}
+
+// a 1080p clip at pix_fmt which is static except for a 128x128 box moving across the first plane,
+// as in a dialogue scene without hud
+Clip OpenStaticClip(AVPixelFormat pix_fmt, AVRational frame_rate, int nb_frames)
+{
+	LOG_ENTER;
+	Clip clip{ };
+	clip.pix_fmt = pix_fmt;
+	clip.frame_rate = frame_rate;
+	auto background = std::shared_ptr<uint8_t[]>{ MakeVideoData(clip.width, clip.height, clip.pix_fmt, 0.0).release() };
+	clip.next = [clip, background, n = 0, nb_frames]() mutable -> AVFramePtr {
+		if (n >= nb_frames)
+			return nullptr;
+		const int box = 128;
+		auto frame = CreateVideoFrame(clip.width, clip.height, clip.pix_fmt);
+		uint8_t* src_data[4];
+		int src_linesize[4];
+		av_image_fill_arrays(src_data, src_linesize, background.get(), clip.pix_fmt, clip.width, clip.height, 1);
+		av_image_copy(frame->data, frame->linesize, const_cast<const uint8_t**>(src_data), src_linesize, clip.pix_fmt, clip.width, clip.height);
+		const int bytes_per_pixel = std::max(1, src_linesize[0] / clip.width);
+		const int x0 = (n * 8) % (clip.width - box);
+		const int y0 = (clip.height - box) / 2;
+		for (int y = y0; y < y0 + box; y++)
+			std::memset(frame->data[0] + y * frame->linesize[0] + x0 * bytes_per_pixel, 235, size_t(box) * bytes_per_pixel);
+		n++;
+		return frame;
+	};
+	LOG_EXIT;
+	return clip;
+}
+
+// export a clip with the current preset, once without and once with a feature of the export,
+// and report each export while its file still exists, along with its speedup over the first export
+void CompareExports(
+	const std::string& name, const std::function<Clip()>& open_clip,
+	AVSampleFormat sample_fmt, int sample_rate, uint64_t channel_layout,
+	const std::function<void(FormatOptions&, bool)>& configure,
+	const std::function<void(Format&, bool)>& flushed,
+	const std::function<void(bool, const std::filesystem::path&, const ClipExport&, double)>& report)
+{
+	LOG_ENTER;
+	double plain_fps{ 0.0 };
+	for (auto enable : { false, true }) {
+		auto options = settings->format_options;
+		configure(options, enable);
+		const std::filesystem::path filename{ fmt::format("{}-{}{}", name, enable ? "on" : "off", settings->export_filename.extension().string()) };
+		auto clip = open_clip();
+		auto voptions = CopyAVDictionary(settings->video_codec_options.get());
+		auto aoptions = CopyAVDictionary(settings->audio_codec_options.get());
+		ClipExportOptions clip_options{ };
+		clip_options.flushed = [&](Format& format) {
+			flushed(format, enable);
+		};
+		auto result = ExportClip(
+			filename, clip,
+			*settings->video_codec, voptions,
+			*settings->audio_codec, aoptions, sample_fmt, sample_rate, channel_layout,
+			options, clip_options);
+		const auto fps = result.frames / result.wall;
+		if (!enable)
+			plain_fps = fps;
+		std::error_code ec;
+		try {
+			report(enable, filename, result, fps / plain_fps);
+		}
+		catch (...) {
+			std::filesystem::remove(filename, ec);
+			throw;
+		}
+		std::filesystem::remove(filename, ec);
+	}
+	LOG_EXIT;
+}
+
+// export a mostly static clip with the current preset, without and with static region hints,
+// and compare speed, bitrate, and quality
+void BenchmarkStatic(
+	int nb_frames, AVPixelFormat pix_fmt, AVRational frame_rate,
+	AVSampleFormat sample_fmt, int sample_rate, uint64_t channel_layout)
+{
+	LOG_ENTER;
+	std::cout << fmt::format("preset {} on {} mostly static frames", settings->preset, nb_frames) << std::endl;
+	std::cout << fmt::format("{:<8} {:>8} {:>8} {:>10} {:>8} {:>7}", "hints", "fps", "speedup", "kbps", "psnr", "static") << std::endl;
+	double static_fraction{ 0.0 };
+	CompareExports(
+		"static", [&]() { return OpenStaticClip(pix_fmt, frame_rate, nb_frames); },
+		sample_fmt, sample_rate, channel_layout,
+		[](FormatOptions& options, bool enable) {
+			options.regions.enable = enable;
+		},
+		[&](Format& format, bool) {
+			if (format.vstream.changes)
+				static_fraction = format.vstream.changes->StaticFraction();
+		},
+		[&](bool enable, const std::filesystem::path& filename, const ClipExport& result, double speedup) {
+			Advice advice{ };
+			advice.preset = settings->preset;
+			advice.frames = result.frames;
+			advice.fps = advice.frames / result.wall;
+			advice.kbps = (advice.frames > 0) ? std::filesystem::file_size(filename) * 8.0 / (advice.frames / av_q2d(frame_rate)) / 1000.0 : 0.0;
+			MeasureQuality(filename, OpenStaticClip(pix_fmt, frame_rate, nb_frames), advice);
+			std::cout << fmt::format(
+				"{:<8} {:8.1f} {:8.2f} {:10.0f} {:>8} {:>7}",
+				enable ? "on" : "off", advice.fps, speedup, advice.kbps,
+				std::isinf(advice.psnr) ? std::string{ "lossless" } : fmt::format("{:.2f}", advice.psnr),
+				enable ? fmt::format("{:.1f}%", 100.0 * static_fraction) : std::string{ "-" }) << std::endl;
+		});
+	LOG_EXIT;
+}
+
+// export a synthetic clip with the current preset, without and with round trip verification,
+// and compare speed; also time the frame hash, and check that it notices a single changed byte
+void BenchmarkVerify(
+	int nb_frames, AVPixelFormat pix_fmt, AVRational frame_rate,
+	AVSampleFormat sample_fmt, int sample_rate, uint64_t channel_layout)
+{
+	LOG_ENTER;
+	{
+		auto clip = OpenClip(std::filesystem::path{ }, pix_fmt, frame_rate, 1);
+		auto frame = clip.next();
+		const auto hash = HashFrame(*frame, AVMEDIA_TYPE_VIDEO);
+		const auto nb_hashes = 100;
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < nb_hashes; i++)
+			if (HashFrame(*frame, AVMEDIA_TYPE_VIDEO) != hash)
+				throw std::runtime_error("frame hash is not deterministic");
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		const auto size = av_image_get_buffer_size(pix_fmt, clip.width, clip.height, 1);
+		std::cout << fmt::format(
+			"frame hash: {:.3f} ms per {}x{} frame, {:.2f} GB/s",
+			1000.0 * elapsed.count() / nb_hashes, clip.width, clip.height, size * double{ nb_hashes } / elapsed.count() / 1e9) << std::endl;
+		frame->data[0][frame->linesize[0] * (clip.height / 2) + clip.width / 2] ^= 1;
+		if (HashFrame(*frame, AVMEDIA_TYPE_VIDEO) == hash)
+			throw std::runtime_error("frame hash misses a changed byte");
+	}
+	std::cout << fmt::format("preset {} on {} frames", settings->preset, nb_frames) << std::endl;
+	std::cout << fmt::format("{:<8} {:>8} {:>8} {:>10} {:>10} {:>10} {:>10}", "verify", "fps", "speedup", "frames", "mismatch", "max lag", "end wait") << std::endl;
+	std::string verified{ "-" };
+	std::string mismatches{ "-" };
+	std::string max_lag{ "-" };
+	std::string end_wait{ "-" };
+	auto passed{ true };
+	CompareExports(
+		"verify", [&]() { return OpenClip(std::filesystem::path{ }, pix_fmt, frame_rate, nb_frames); },
+		sample_fmt, sample_rate, channel_layout,
+		[](FormatOptions& options, bool enable) {
+			options.verify = enable;
+		},
+		[&](Format& format, bool) {
+			if (auto verifier = format.vstream.verifier.get()) {
+				verified = fmt::format("{}", verifier->nb_verified);
+				mismatches = fmt::format("{}", verifier->nb_mismatches + verifier->nb_missing + verifier->nb_extra);
+				max_lag = fmt::format("{:.3f}", verifier->max_lag.count());
+				end_wait = fmt::format("{:.3f}", verifier->finish_wait.count());
+			}
+			for (const Stream* stream : { static_cast<const Stream*>(&format.vstream), static_cast<const Stream*>(&format.astream) })
+				if (stream->verifier && !stream->verifier->Passed())
+					passed = false;
+		},
+		[&](bool enable, const std::filesystem::path&, const ClipExport& result, double speedup) {
+			std::cout << fmt::format(
+				"{:<8} {:8.1f} {:8.2f} {:>10} {:>10} {:>10} {:>10}",
+				enable ? "on" : "off", result.frames / result.wall, speedup, verified, mismatches, max_lag, end_wait) << std::endl;
+			if (!passed)
+				throw std::runtime_error(fmt::format("export with preset {} does not survive the round trip", settings->preset));
+		});
 	LOG_EXIT;
 }
 
@@ -224,6 +1451,22 @@ int main()
 		std::string sample_fmt_name{ "s16" };
 		auto sample_rate{ 44100 };
 		auto nb_channels{ 2 };
+		std::string mode{ "export" };
+		std::string conversion_pix_fmt_name{ "yuv420p" };
+		auto benchmark_threads{ 0 };
+		auto benchmark_frames{ 100 };
+		std::string replay_file{ };
+		std::string replay_timing{ "fast" };
+		auto slow_video_ms{ 20 };
+		std::string advise_presets{ };
+		std::string advise_clip{ };
+		auto advise_min_psnr{ 40.0 };
+		auto ring_slots{ 4 };
+		auto ring_consume_us{ 0 };
+		auto blend_frames{ 4 };
+		auto resample_rate{ 48000 };
+		auto resample_seconds{ 60 };
+		auto segment_seconds{ 1.0 };
 		auto& testsec = GetSec(test_settings.sections, "test");
 		GetVar(testsec, "frame_rate_numerator", frame_rate_numerator);
 		GetVar(testsec, "frame_rate_denominator", frame_rate_denominator);
@@ -231,6 +1474,33 @@ int main()
 		GetVar(testsec, "sample_fmt", sample_fmt_name);
 		GetVar(testsec, "sample_rate", sample_rate);
 		GetVar(testsec, "nb_channels", nb_channels);
+		GetVar(testsec, "mode", mode);
+		GetVar(testsec, "conversion_pix_fmt", conversion_pix_fmt_name);
+		GetVar(testsec, "benchmark_threads", benchmark_threads);
+		GetVar(testsec, "benchmark_frames", benchmark_frames);
+		if (mode == "interleave")
+			GetVar(testsec, "slow_video_ms", slow_video_ms);
+		if (mode == "replay") {
+			GetVar(testsec, "replay_file", replay_file);
+			GetVar(testsec, "replay_timing", replay_timing);
+		}
+		if (mode == "ring") {
+			GetVar(testsec, "ring_slots", ring_slots);
+			GetVar(testsec, "ring_consume_us", ring_consume_us);
+		}
+		if (mode == "blend")
+			GetVar(testsec, "blend_frames", blend_frames);
+		if (mode == "resample") {
+			GetVar(testsec, "resample_rate", resample_rate);
+			GetVar(testsec, "resample_seconds", resample_seconds);
+		}
+		if (mode == "segment")
+			GetVar(testsec, "segment_seconds", segment_seconds);
+		if (mode == "advise") {
+			GetVar(testsec, "advise_presets", advise_presets);
+			GetVar(testsec, "advise_clip", advise_clip);
+			GetVar(testsec, "advise_min_psnr", advise_min_psnr);
+		}
 		auto pix_fmt = av_get_pix_fmt(pix_fmt_name.c_str());
 		auto sample_fmt = av_get_sample_fmt(sample_fmt_name.c_str());
 		if (pix_fmt == AV_PIX_FMT_NONE) {
@@ -241,10 +1511,69 @@ int main()
 			LOG->error("test sample format {} not found, falling back on s16", sample_fmt_name);
 			sample_fmt = AV_SAMPLE_FMT_S16;
 		}
-		Test(
-			settings->export_filename,
-			settings->video_codec, settings->video_codec_options, AVRational{ frame_rate_numerator, frame_rate_denominator }, pix_fmt,
-			settings->audio_codec, settings->audio_codec_options, sample_fmt, sample_rate, av_get_default_channel_layout(nb_channels));
+		if (mode == "conversion") {
+			auto conversion_pix_fmt = av_get_pix_fmt(conversion_pix_fmt_name.c_str());
+			if (conversion_pix_fmt == AV_PIX_FMT_NONE)
+				throw std::runtime_error(fmt::format("conversion pixel format {} not found", conversion_pix_fmt_name));
+			BenchmarkConversion(pix_fmt, conversion_pix_fmt, benchmark_threads, benchmark_frames);
+		}
+		else if (mode == "blend") {
+			BenchmarkBlend(pix_fmt, AVRational{ frame_rate_numerator, frame_rate_denominator }, blend_frames, benchmark_threads, benchmark_frames);
+		}
+		else if (mode == "resample") {
+			BenchmarkResample(
+				sample_fmt, sample_rate, av_get_default_channel_layout(nb_channels),
+				resample_rate, resample_seconds, settings->format_options.resampler);
+		}
+		else if (mode == "replay") {
+			Replay(replay_file, replay_timing == "original", settings->format_options);
+		}
+		else if (mode == "ring") {
+			BenchmarkRing(pix_fmt, AVRational{ frame_rate_numerator, frame_rate_denominator }, ring_slots, benchmark_frames, ring_consume_us);
+		}
+		else if (mode == "advise") {
+			Advise(
+				advise_presets, advise_clip, benchmark_frames, advise_min_psnr,
+				pix_fmt, AVRational{ frame_rate_numerator, frame_rate_denominator },
+				sample_fmt, sample_rate, av_get_default_channel_layout(nb_channels));
+		}
+		else if (mode == "static") {
+			BenchmarkStatic(
+				benchmark_frames, pix_fmt, AVRational{ frame_rate_numerator, frame_rate_denominator },
+				sample_fmt, sample_rate, av_get_default_channel_layout(nb_channels));
+		}
+		else if (mode == "verify") {
+			BenchmarkVerify(
+				benchmark_frames, pix_fmt, AVRational{ frame_rate_numerator, frame_rate_denominator },
+				sample_fmt, sample_rate, av_get_default_channel_layout(nb_channels));
+		}
+		else if (mode == "direct") {
+			TestDirect(
+				settings->video_codec, settings->video_codec_options, AVRational{ frame_rate_numerator, frame_rate_denominator }, pix_fmt,
+				settings->audio_codec, settings->audio_codec_options, sample_fmt, sample_rate, av_get_default_channel_layout(nb_channels),
+				settings->format_options, settings->export_filename.extension().string());
+		}
+		else if (mode == "segment") {
+			TestSegment(
+				settings->export_filename,
+				settings->video_codec, settings->video_codec_options, AVRational{ frame_rate_numerator, frame_rate_denominator }, pix_fmt,
+				settings->audio_codec, settings->audio_codec_options, sample_fmt, sample_rate, av_get_default_channel_layout(nb_channels),
+				settings->format_options, segment_seconds);
+		}
+		else if (mode == "interleave") {
+			TestInterleave(
+				settings->export_filename,
+				settings->video_codec, settings->video_codec_options, AVRational{ frame_rate_numerator, frame_rate_denominator }, pix_fmt,
+				settings->audio_codec, settings->audio_codec_options, sample_fmt, sample_rate, av_get_default_channel_layout(nb_channels),
+				settings->format_options, slow_video_ms);
+		}
+		else {
+			Test(
+				settings->export_filename,
+				settings->video_codec, settings->video_codec_options, AVRational{ frame_rate_numerator, frame_rate_denominator }, pix_fmt,
+				settings->audio_codec, settings->audio_codec_options, sample_fmt, sample_rate, av_get_default_channel_layout(nb_channels),
+				settings->format_options);
+		}
 	}
 	LOG_CATCH;
 	std::cout << "Press enter...";
@@ -0,0 +1,158 @@
+/*
+Batch transcoding of clips with the presets from SimpleVideoExport.ini.
+
+Jobs are read from SimpleVideoExportBatch.ini (or from the file given as first
+argument). Every section other than [batch] is a job, which reads video from a
+y4m or nut file, and audio from a wav or nut file (or from the video file, or
+silence if neither has audio), and exports it with the given preset.
+This also finishes two stage exports by hand (see intermediate in
+SimpleVideoExport.ini): make a job that reads the intermediate and exports it
+with the final preset, and set delete_sources = true to remove the
+intermediate afterwards.
+
+Jobs run in parallel. The cores are divided between the jobs that run at the
+same time, and the encoders of each job get their share of the cores as codec
+threads. At the end, the wall time of each job and the aggregate throughput
+are reported. With telemetry enabled in SimpleVideoExport.ini, each job
+publishes its progress as SimpleVideoExport-<job name>.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "format.h"
+#include "settings.h"
+#include "source.h"
+#include "transcode.h"
+
+#pragma comment(lib, "common.lib")
+
+std::shared_ptr<spdlog::logger> logger = nullptr;
+std::unique_ptr<Settings> settings = nullptr;
+
+int main(int argc, char* argv[])
+{
+	auto nb_failed = 0;
+	try {
+		logger = spdlog::stdout_color_mt(SCRIPT_NAME);
+		logger->set_pattern("[%Y-%m-%d %H:%M:%S.%e] [%n] [%t] [%^%l%$] %v");
+		AVLogSetCallback();
+		settings = std::make_unique<Settings>();
+		LOG_ENTER;
+		auto batch_settings = inipp::Ini<char>();
+		const std::filesystem::path ini_batch_filename_{ (argc > 1) ? argv[1] : SCRIPT_NAME "Batch.ini" };
+		std::ifstream is{ ini_batch_filename_ };
+		if (is.fail())
+			throw std::runtime_error(fmt::format("failed to open \"{}\"", ini_batch_filename_.string()));
+		batch_settings.parse(is);
+		for (const auto& error : batch_settings.errors)
+			LOG->error("failed to parse \"{}\"", error);
+		batch_settings.interpolate();
+		auto nb_parallel{ 0 };
+		auto nb_cores{ 0 };
+		std::string folder{ "." };
+		auto& batchsec = GetSec(batch_settings.sections, "batch");
+		GetVar(batchsec, "jobs", nb_parallel);
+		GetVar(batchsec, "threads", nb_cores);
+		GetVar(batchsec, "folder", folder);
+		// set up all jobs before starting, as loading a preset modifies the settings
+		std::vector<TranscodeJob> jobs;
+		for (const auto& [name, sec] : batch_settings.sections) {
+			if (name == "batch")
+				continue;
+			TranscodeJob job{};
+			job.name = name;
+			std::string video{ };
+			std::string audio{ };
+			std::string preset{ };
+			std::string basename{ name };
+			GetVar(sec, "video", video);
+			if (sec.count("audio"))
+				GetVar(sec, "audio", audio);
+			GetVar(sec, "preset", preset);
+			if (sec.count("basename"))
+				GetVar(sec, "basename", basename);
+			job.video = video;
+			job.audio = audio;
+			settings->LoadPreset(preset, folder, basename);
+			job.filename = settings->export_filename;
+			job.video_codec = settings->video_codec;
+			job.video_codec_options = std::move(settings->video_codec_options);
+			job.audio_codec = settings->audio_codec;
+			job.audio_codec_options = std::move(settings->audio_codec_options);
+			job.streaming = settings->format_options.streaming;
+			job.resampler = settings->format_options.resampler;
+			job.regions = settings->format_options.regions;
+			job.segments = settings->format_options.segments;
+			job.verify = settings->format_options.verify;
+			if (sec.count("delete_sources"))
+				GetVar(sec, "delete_sources", job.delete_sources);
+			jobs.push_back(std::move(job));
+		}
+		if (jobs.empty())
+			throw std::runtime_error("no jobs");
+		// divide the cores between the jobs and their encoders
+		if (nb_cores <= 0)
+			nb_cores = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+		if (nb_parallel <= 0)
+			nb_parallel = std::max(1, nb_cores / 4);
+		nb_parallel = std::min(nb_parallel, static_cast<int>(jobs.size()));
+		auto options = settings->format_options;
+		options.threads.codec.threads = std::max(1, nb_cores / nb_parallel);
+		options.threads.codec.priority = ThreadPriority::Normal;
+		options.threads.conversion.threads = 1;
+		options.threads.conversion.priority = ThreadPriority::Normal;
+		LOG->info(
+			"running {} jobs, {} at a time, with {} codec threads each",
+			jobs.size(), nb_parallel, options.threads.codec.threads);
+		auto start = std::chrono::steady_clock::now();
+		std::atomic<size_t> next_job{ 0 };
+		std::vector<std::thread> workers;
+		for (int i = 0; i < nb_parallel; i++) {
+			workers.emplace_back([&] {
+				for (auto j = next_job++; j < jobs.size(); j = next_job++) {
+					try {
+						RunTranscodeJob(jobs[j], options);
+					}
+					catch (std::exception& e) {
+						LOG->error("job {} failed: {}", jobs[j].name, e.what());
+					}
+				}
+			});
+		}
+		for (auto& worker : workers)
+			worker.join();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		// report
+		int64_t nb_frames{ 0 };
+		uintmax_t size{ 0 };
+		for (const auto& job : jobs) {
+			if (job.finished) {
+				LOG->info(
+					"{}: {:.2f} seconds, {} frames, {:.1f} fps, {} bytes",
+					job.filename.string(), job.seconds, job.nb_frames, job.nb_frames / job.seconds, job.size);
+				nb_frames += job.nb_frames;
+				size += job.size;
+			}
+			else {
+				LOG->error("{}: failed", job.filename.string());
+				nb_failed++;
+			}
+		}
+		LOG->info(
+			"{} jobs finished in {:.2f} seconds ({} failed): {:.1f} fps, {:.1f} MB/s aggregate",
+			jobs.size(), elapsed.count(), nb_failed,
+			nb_frames / elapsed.count(), size / elapsed.count() / 1000000.0);
+	}
+	catch (std::exception& e) {
+		LOG->critical(e.what());
+		nb_failed++;
+	}
+	LOG_EXIT;
+	return nb_failed ? 1 : 0;
+}
@@ -0,0 +1,163 @@
+/*
+Decodes the video of an export in parallel, using the sidecar index written
+with index = true in the [export] section.
+
+Usage: SimpleVideoExportDecode <file> [threads]
+
+The frames are split at keyframes into one range per thread. Every thread
+opens the file, seeks to the byte position that the index recorded for the
+first keyframe of its range, and decodes until
+it has seen all frames of its range. The number of decoded frames is checked
+against the index, and the decode rate is reported.
+*/
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <unordered_set>
+
+#include "avcreate.h"
+#include "frameindex.h"
+#include "settings.h"
+
+#pragma comment(lib, "common.lib")
+
+std::shared_ptr<spdlog::logger> logger = nullptr;
+std::unique_ptr<Settings> settings = nullptr;
+
+struct DecodeRange {
+	size_t begin;  // first frame, always a keyframe
+	size_t end;    // one past the last frame
+	size_t decoded{ 0 };
+	std::string error{ };
+};
+
+void DecodeFrames(const std::filesystem::path& filename, int stream_index, const FrameIndexReader::IndexedStream& stream, DecodeRange& range)
+{
+	LOG_ENTER;
+	auto context = CreateAVInputFormatContext(filename);
+	if (stream_index >= (int)context->nb_streams)
+		throw std::runtime_error(fmt::format("stream {} not found in '{}'", stream_index, filename.string()));
+	auto avstream = context->streams[stream_index];
+	AVCodecPtr codec = avcodec_find_decoder(avstream->codecpar->codec_id);
+	if (!codec)
+		throw std::runtime_error(fmt::format("no decoder for stream {}", stream_index));
+	auto decoder = CreateAVCodecContext(*codec);
+	auto ret = avcodec_parameters_to_context(decoder.get(), avstream->codecpar);
+	if (ret < 0)
+		throw std::runtime_error(fmt::format("failed to set up {} decoder: {}", codec->name, AVErrorString(ret)));
+	decoder->pkt_timebase = avstream->time_base;
+	decoder->thread_count = 1;
+	ret = avcodec_open2(decoder.get(), codec, nullptr);
+	if (ret < 0)
+		throw std::runtime_error(fmt::format("failed to open {} decoder: {}", codec->name, AVErrorString(ret)));
+	// frames are identified by pts, as the entries are in decoding order
+	std::unordered_set<int64_t> pending{ };
+	for (auto i = range.begin; i < range.end; i++)
+		pending.insert(stream.entries[i].pts);
+	// seek to the recorded position of the keyframe, so the container needs no index of its own
+	const auto& keyframe = stream.entries[range.begin];
+	if (keyframe.pos >= 0 && !(context->iformat->flags & AVFMT_NO_BYTE_SEEK))
+		ret = av_seek_frame(context.get(), -1, keyframe.pos, AVSEEK_FLAG_BYTE);
+	else
+		ret = av_seek_frame(context.get(), stream_index, keyframe.pts, AVSEEK_FLAG_BACKWARD);
+	if (ret < 0)
+		throw std::runtime_error(fmt::format("failed to seek to frame {}: {}", range.begin, AVErrorString(ret)));
+	// the position can be before the keyframe (the start of a cluster or fragment), so start decoding at a keyframe
+	auto started{ false };
+	auto pkt = CreateAVPacket();
+	auto frame = CreateAVFrame();
+	auto receive = [&]() {
+		while (!pending.empty()) {
+			ret = avcodec_receive_frame(decoder.get(), frame.get());
+			if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+				break;
+			if (ret < 0)
+				throw std::runtime_error(fmt::format("failed to decode frame: {}", AVErrorString(ret)));
+			if (pending.erase(frame->best_effort_timestamp))
+				range.decoded++;
+			av_frame_unref(frame.get());
+		}
+	};
+	while (!pending.empty() && av_read_frame(context.get(), pkt.get()) >= 0) {
+		if (pkt->stream_index == stream_index)
+			started = started || (pkt->flags & AV_PKT_FLAG_KEY);
+		if (pkt->stream_index == stream_index && started) {
+			ret = avcodec_send_packet(decoder.get(), pkt.get());
+			if (ret < 0 && ret != AVERROR(EAGAIN)) {
+				av_packet_unref(pkt.get());
+				throw std::runtime_error(fmt::format("failed to send packet to decoder: {}", AVErrorString(ret)));
+			}
+			receive();
+		}
+		av_packet_unref(pkt.get());
+	}
+	if (!pending.empty()) {
+		avcodec_send_packet(decoder.get(), nullptr);
+		receive();
+	}
+	LOG_EXIT;
+}
+
+int main(int argc, char* argv[])
+{
+	try {
+		logger = spdlog::stdout_color_mt(SCRIPT_NAME);
+		logger->set_pattern("[%Y-%m-%d %H:%M:%S.%e] [%n] [%t] [%^%l%$] %v");
+		if (argc < 2)
+			throw std::runtime_error("usage: SimpleVideoExportDecode <file> [threads]");
+		const std::filesystem::path filename{ argv[1] };
+		size_t nb_threads = (argc > 2) ? std::stoul(argv[2]) : std::max(1u, std::thread::hardware_concurrency());
+		FrameIndexReader reader{ FrameIndexFilename(filename) };
+		auto stream_index = reader.FindStream(AVMEDIA_TYPE_VIDEO);
+		if (stream_index < 0)
+			throw std::runtime_error(fmt::format("no video stream in '{}'", reader.filename.string()));
+		const auto& stream = reader.streams[stream_index];
+		auto keyframes = stream.KeyFrames();
+		if (keyframes.empty())
+			throw std::runtime_error(fmt::format("no keyframes in '{}'", reader.filename.string()));
+		// divide the keyframes evenly over the threads
+		nb_threads = std::min(nb_threads, keyframes.size());
+		std::vector<DecodeRange> ranges{ };
+		for (size_t i = 0; i < nb_threads; i++) {
+			auto begin = keyframes[i * keyframes.size() / nb_threads];
+			auto end = (i + 1 < nb_threads) ? keyframes[(i + 1) * keyframes.size() / nb_threads] : stream.entries.size();
+			ranges.push_back(DecodeRange{ begin, end });
+		}
+		LOG->info("decoding {} frames ({} keyframes) of '{}' with {} threads", stream.entries.size(), keyframes.size(), filename.string(), nb_threads);
+		auto start = std::chrono::steady_clock::now();
+		std::vector<std::thread> threads{ };
+		for (auto& range : ranges) {
+			threads.emplace_back([&]() {
+				try {
+					DecodeFrames(filename, stream_index, stream, range);
+				}
+				catch (std::exception& e) {
+					range.error = e.what();
+				}
+			});
+		}
+		for (auto& thread : threads)
+			thread.join();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		size_t decoded{ 0 };
+		bool ok{ true };
+		for (const auto& range : ranges) {
+			decoded += range.decoded;
+			if (!range.error.empty() || range.decoded != range.end - range.begin) {
+				ok = false;
+				LOG->error("frames {}-{}: decoded {} of {} frames {}", range.begin, range.end - 1, range.decoded, range.end - range.begin, range.error);
+			}
+		}
+		std::cout << fmt::format(
+			"decoded {} of {} frames in {:.3f} seconds ({:.1f} fps)",
+			decoded, stream.entries.size(), elapsed.count(), decoded / elapsed.count()) << std::endl;
+		if (!ok)
+			return 1;
+	}
+	catch (std::exception& e) {
+		LOG->critical(e.what());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,85 @@
+/*
+Prints the progress of a running export, as published by the plugin (or by
+the batch tool) in shared memory when telemetry is enabled.
+
+The name of the shared memory block is the first argument. Every export has
+its own block, SimpleVideoExport-<basename>, as logged when the export
+starts; jobs of the batch tool append -<job name> to it. The block is polled
+once per second until the export is finished or cancelled.
+*/
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include "settings.h"
+#include "telemetry.h"
+
+#pragma comment(lib, "common.lib")
+
+std::shared_ptr<spdlog::logger> logger = nullptr;
+std::unique_ptr<Settings> settings = nullptr;
+
+auto StateName(TelemetryState state)
+{
+	switch (state) {
+	case TelemetryState::Idle:
+		return "idle";
+	case TelemetryState::Exporting:
+		return "exporting";
+	case TelemetryState::Finalizing:
+		return "finalizing";
+	case TelemetryState::Finished:
+		return "finished";
+	case TelemetryState::Cancelled:
+		return "cancelled";
+	default:
+		return "unknown";
+	}
+}
+
+void Print(const TelemetryBlock& block)
+{
+	const auto& video = block.video;
+	const auto& audio = block.audio;
+	auto state = block.state.load(std::memory_order_relaxed);
+	auto elapsed = (block.update_time.load(std::memory_order_relaxed) - block.start_time.load(std::memory_order_relaxed)) / 1000000.0;
+	auto eta = video.eta.load(std::memory_order_relaxed);
+	std::cout << fmt::format(
+		"{:>10} {:8.1f}s | video {:>8} frames {:7.1f} fps queue {:>4} {:9.0f} kbps | audio {:>10} samples queue {:>6} {:6.0f} kbps | skew {:5.2f}s | {:9.1f} MB | eta {}",
+		StateName(state), elapsed,
+		video.received.load(std::memory_order_relaxed), video.rate.load(std::memory_order_relaxed),
+		video.received.load(std::memory_order_relaxed) - video.written.load(std::memory_order_relaxed),
+		video.bitrate.load(std::memory_order_relaxed) / 1000.0,
+		audio.received.load(std::memory_order_relaxed),
+		audio.received.load(std::memory_order_relaxed) - audio.written.load(std::memory_order_relaxed),
+		audio.bitrate.load(std::memory_order_relaxed) / 1000.0,
+		block.skew.load(std::memory_order_relaxed),
+		block.file_size.load(std::memory_order_relaxed) / 1000000.0,
+		(eta < 0) ? std::string{ "unknown" } : fmt::format("{:.0f}s", eta)) << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	try {
+		logger = spdlog::stdout_color_mt(SCRIPT_NAME);
+		logger->set_pattern("[%Y-%m-%d %H:%M:%S.%e] [%n] [%t] [%^%l%$] %v");
+		if (argc < 2)
+			throw std::runtime_error("usage: " SCRIPT_NAME " <name of the telemetry block, as logged when the export starts>");
+		const std::string name{ argv[1] };
+		Telemetry telemetry{ name, false };
+		const auto& block = telemetry.Block();
+		while (true) {
+			Print(block);
+			auto state = block.state.load(std::memory_order_relaxed);
+			if (state == TelemetryState::Finished || state == TelemetryState::Cancelled)
+				break;
+			std::this_thread::sleep_for(std::chrono::seconds(1));
+		}
+	}
+	catch (std::exception& e) {
+		LOG->critical(e.what());
+		return 1;
+	}
+	return 0;
+}
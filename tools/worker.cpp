@@ -0,0 +1,121 @@
+/*
+Encodes an export in its own process, from frames that the plugin copies into
+a frame ring in shared memory (worker = true in SimpleVideoExport.ini).
+
+Usage: SimpleVideoExportWorker <ring name>
+
+The plugin starts the worker in the working directory of the game, so it
+reads the same SimpleVideoExport.ini. The export filename and the audio and
+video formats come from the ring, the codecs and all other options from the
+ini file. The worker transcodes every frame from the ring until the plugin
+closes it, and then finalizes or cancels the export. If the game goes away
+without closing the ring, the export is cancelled.
+For a two stage export, the worker then transcodes the intermediate to the
+final preset, and deletes the intermediate.
+*/
+
+#include <chrono>
+
+#include "format.h"
+#include "framering.h"
+#include "settings.h"
+#include "transcode.h"
+
+#pragma comment(lib, "common.lib")
+
+std::shared_ptr<spdlog::logger> logger = nullptr;
+std::unique_ptr<Settings> settings = nullptr;
+
+void Work(FrameRing& ring)
+{
+	LOG_ENTER;
+	const auto& ring_format = ring.Format();
+	const auto filename = std::filesystem::u8path(ring_format.filename);
+	auto format = std::make_unique<Format>(
+		filename,
+		*settings->video_codec, settings->video_codec_options, ring_format.width, ring_format.height, ring_format.frame_rate, ring_format.pix_fmt,
+		*settings->audio_codec, settings->audio_codec_options, ring_format.sample_fmt, ring_format.sample_rate, ring_format.channel_layout,
+		settings->format_options);
+	int64_t nb_frames{ 0 };
+	auto start = std::chrono::steady_clock::now();
+	try {
+		while (true) {
+			AVMediaType type{ AVMEDIA_TYPE_UNKNOWN };
+			// read the state before finding the ring empty, the plugin publishes its last frames before closing
+			const auto state = ring.State();
+			auto frame = ring.Front(type);
+			if (frame) {
+				// both streams come through the same ring, in the order in which the game sent them,
+				// so the interleaver never has to hold back a thread here
+				if (type == AVMEDIA_TYPE_VIDEO) {
+					format->vstream.Transcode(frame);
+					nb_frames++;
+				}
+				else {
+					format->astream.Transcode(frame);
+				}
+				frame = nullptr;
+				ring.Pop();
+			}
+			else if (state == FrameRingState::Finished) {
+				format->Flush();
+				break;
+			}
+			else if (state == FrameRingState::Cancelled) {
+				format->Cancel();
+				break;
+			}
+			else if (!ring.ProducerAlive()) {
+				LOG->error("game is gone");
+				format->Cancel();
+				break;
+			}
+		}
+	}
+	catch (std::exception&) {
+		format->Cancel();
+		throw;
+	}
+	auto finished = (ring.State() == FrameRingState::Finished);
+	format = nullptr;
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	LOG->info("worker transcoded {} video frames in {:.3f} seconds", nb_frames, elapsed.count());
+	if (finished && settings->transcode) {
+		// the plugin named the intermediate, the final export goes next to it, without the suffix
+		auto& job = *settings->transcode;
+		auto stem = filename.stem().u8string();
+		const std::string suffix{ "-intermediate" };
+		if (stem.size() > suffix.size() && stem.compare(stem.size() - suffix.size(), suffix.size(), suffix) == 0)
+			stem.resize(stem.size() - suffix.size());
+		job.video = filename;
+		job.filename = filename.parent_path() / std::filesystem::u8path(stem + job.filename.extension().u8string());
+		RunTranscodeJob(job, BackgroundTranscodeOptions(settings->format_options));
+	}
+	LOG_EXIT;
+}
+
+int main(int argc, char* argv[])
+{
+	int ret{ 0 };
+	try {
+		logger = spdlog::rotating_logger_mt(
+			SCRIPT_NAME, SCRIPT_NAME "Worker.log", 10000000, 5);
+		logger->set_pattern("[%Y-%m-%d %H:%M:%S.%e] [%n] [%t] [%^%l%$] %v");
+		AVLogSetCallback();
+		settings = std::make_unique<Settings>();
+		LOG_ENTER;
+		if (argc < 2)
+			throw std::runtime_error("usage: SimpleVideoExportWorker <ring name>");
+		LOG->info("worker started for ring {}", argv[1]);
+		FrameRing ring{ argv[1], settings->worker_timeout };
+		Work(ring);
+		LOG->info("worker stopped");
+		LOG_EXIT;
+	}
+	catch (std::exception& e) {
+		LOG->critical(e.what());
+		ret = 1;
+	}
+	logger->flush();
+	return ret;
+}